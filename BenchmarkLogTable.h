@@ -0,0 +1,60 @@
+// BenchmarkLogTable.h
+//
+// fixed code table generated by filecompress -g from
+// the .hi table of the 16 MiB log corpus of benchmark.cpp, do not edit
+#pragma once
+
+#include "FixedHuffman.h"
+
+struct BenchmarkLogTable {
+  static constexpr uint32_t codes[ALPHABET_SIZE] = {
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x6e, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0xe, 0x6f, 0x0,
+      0x1, 0x2, 0x3, 0x2a, 0x2b, 0x2c, 0xf, 0x2d,
+      0x10, 0x2e, 0x2f, 0x0, 0x0, 0x11, 0x0, 0x0,
+      0x0, 0x1f8, 0x1f9, 0x0, 0x1fa, 0xf6, 0xf7, 0x1fb,
+      0x0, 0xf8, 0x0, 0x0, 0x0, 0x0, 0x70, 0x71,
+      0x0, 0x0, 0x72, 0x0, 0x73, 0x1fc, 0x0, 0x1fd,
+      0x0, 0x0, 0x74, 0x75, 0x0, 0x76, 0x0, 0x0,
+      0x0, 0x30, 0x77, 0x12, 0x13, 0x4, 0x78, 0x0,
+      0x31, 0x32, 0x1fe, 0x33, 0xf9, 0x34, 0x79, 0x14,
+      0x7a, 0xfa, 0x35, 0x5, 0x6, 0x36, 0x0, 0x0,
+      0x1ff, 0xfb, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+      0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+  static constexpr uint8_t lengths[ALPHABET_SIZE] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 7, 0,
+      4, 4, 4, 6, 6, 6, 5, 6, 5, 6, 6, 0, 0, 5, 0, 0,
+      0, 9, 9, 0, 9, 8, 8, 9, 0, 8, 0, 0, 0, 0, 7, 7,
+      0, 0, 7, 0, 7, 9, 0, 9, 0, 0, 7, 7, 0, 7, 0, 0,
+      0, 6, 7, 5, 5, 4, 7, 0, 6, 6, 9, 6, 8, 6, 7, 5,
+      7, 8, 6, 4, 4, 6, 0, 0, 9, 8, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+};
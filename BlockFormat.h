@@ -0,0 +1,122 @@
+// Adam Shaar
+// ashaar2
+//
+// BlockFormat.h
+//
+// the block frame shared by blocked .hz files (see HuffmanContainer.h) and
+// compressed buffers (see HuffmanBuffer.h), a 16-byte block header and then
+// the block's payload. Nothing here touches files or threads, and every
+// function is inline, so it can be included from any number of source files.
+//
+// block header (all integers little-endian):
+//   1 byte    block mode
+//   3 bytes   table distance: for BLOCK_PREVIOUS_TABLE blocks the number of
+//             blocks back to the block holding their table, 0 if unknown
+//   4 bytes   original size of the block
+//   4 bytes   size of the block's bitstream
+//   4 bytes   CRC-32C of the original block
+//
+// the bitstream of a BLOCK_OWN_TABLE block starts with its code table: a
+// 32-byte bitmap of the byte values that have a code, then the code lengths
+// of those byte values packed two per byte, high nibble first.
+#pragma once
+
+#include "HuffmanCode.h"
+#include <cstdint>
+#include <vector>
+
+const size_t BLOCK_HEADER_SIZE = 16;
+// Largest distance a block header can hold to the block of its table
+const uint32_t MAX_TABLE_DISTANCE = (1 << 24) - 1;
+
+// Block modes
+const int BLOCK_SHARED_TABLE = 0;   // coded with the table in the file header
+const int BLOCK_RAW = 1;            // stored as is
+const int BLOCK_OWN_TABLE = 2;      // coded with a table stored in the block
+const int BLOCK_PREVIOUS_TABLE = 3; // coded with the last stored table
+const int BLOCK_END = 0xFF;         // marks the end of the blocks
+
+// BlockHeader holds the fields of the header in front of every block.
+struct BlockHeader {
+  int mode;
+  uint32_t tableDistance;
+  uint32_t rawSize;
+  uint32_t payloadSize;
+  uint32_t checksum;
+
+  BlockHeader() {
+    mode = BLOCK_RAW;
+    tableDistance = 0;
+    rawSize = 0;
+    payloadSize = 0;
+    checksum = 0;
+  }
+};
+
+//
+// putLittleEndian
+//
+// Function stores the lowest `bytes` bytes of value at p, lowest byte first
+inline void putLittleEndian(unsigned char *p, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    p[i] = value >> (8 * i);
+  }
+}
+
+//
+// getLittleEndian
+//
+// Function reads a `bytes` byte little-endian integer from p
+inline uint64_t getLittleEndian(const unsigned char *p, int bytes) {
+  uint64_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+//
+// serializeBlockHeader
+//
+// Function writes the block header into the BLOCK_HEADER_SIZE bytes at out
+inline void serializeBlockHeader(const BlockHeader &header,
+                                 unsigned char *out) {
+  out[0] = header.mode;
+  putLittleEndian(out + 1, header.tableDistance, 3);
+  putLittleEndian(out + 4, header.rawSize, 4);
+  putLittleEndian(out + 8, header.payloadSize, 4);
+  putLittleEndian(out + 12, header.checksum, 4);
+}
+
+//
+// parseBlockHeader
+//
+// Function reads the block header at the start of data
+inline BlockHeader parseBlockHeader(const unsigned char *data) {
+  BlockHeader header;
+  header.mode = data[0];
+  header.tableDistance = getLittleEndian(data + 1, 3);
+  header.rawSize = getLittleEndian(data + 4, 4);
+  header.payloadSize = getLittleEndian(data + 8, 4);
+  header.checksum = getLittleEndian(data + 12, 4);
+  return header;
+}
+
+//
+// encodedSize
+//
+// Function returns the number of bytes the symbols counted in counts take
+// with the given code lengths, or UINT64_MAX if one of them has no code
+inline uint64_t encodedSize(const std::vector<uint64_t> &counts,
+                            const std::vector<int> &codeLengths) {
+  uint64_t bits = 0;
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    if (counts[i] > 0) {
+      if (codeLengths[i] == 0) {
+        return UINT64_MAX;
+      }
+      bits += counts[i] * codeLengths[i];
+    }
+  }
+  return (bits + 7) / 8;
+}
@@ -0,0 +1,85 @@
+// Adam Shaar
+// ashaar2
+//
+// Checksum.h
+//
+// CRC-32C (Castagnoli) checksum used to verify decompressed data
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// Crc32cTable holds the lookup tables of the reflected CRC-32C polynomial
+// for slicing by 8: entries[0] is the byte-at-a-time table, entries[k] gives
+// the CRC of a byte followed by k zero bytes.
+struct Crc32cTable {
+  uint32_t entries[8][256];
+
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+      }
+      entries[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+      for (int i = 0; i < 256; i++) {
+        uint32_t previous = entries[k - 1][i];
+        entries[k][i] = (previous >> 8) ^ entries[0][previous & 0xFF];
+      }
+    }
+  }
+};
+
+//
+// crc32cTable
+//
+// Function returns the CRC-32C lookup tables, building them on first use
+inline const Crc32cTable &crc32cTable() {
+  static const Crc32cTable table;
+  return table;
+}
+
+//
+// crc32c
+//
+// Function extends the checksum `crc` of the data seen so far with `size`
+// more bytes, start with a crc of 0. Built for a processor with SSE 4.2 the
+// crc32 instruction takes 8 bytes at a time, otherwise 8 bytes are looked up
+// in 8 tables at once, which removes the dependency of every byte on the
+// lookup of the byte before it.
+inline uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t size) {
+  crc = ~crc;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+  uint64_t wide = crc;
+  for (; size >= 8; data += 8, size -= 8) {
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    wide = _mm_crc32_u64(wide, word);
+  }
+  crc = wide;
+  for (; size > 0; data++, size--) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+#else
+  const uint32_t(*table)[256] = crc32cTable().entries;
+  for (; size >= 8; data += 8, size -= 8) {
+    // the bytes are combined little-endian, so this works on any byte order
+    uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                          (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+    crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+          table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+          table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^
+          table[0][data[7]];
+  }
+  for (; size > 0; data++, size--) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *data) & 0xFF];
+  }
+#endif
+  return ~crc;
+}
@@ -0,0 +1,255 @@
+// Adam Shaar
+// ashaar2
+//
+// CodecStats.h
+//
+// timing and coding statistics gathered by every compress and decompress
+// call, and their JSON form for monitoring
+#pragma once
+
+#include "HuffmanCode.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// CodecStage names the parts of a call that are timed separately. Reading
+// and writing are waiting on I/O, the other stages are computation.
+enum CodecStage {
+  STAGE_READ,
+  STAGE_HISTOGRAM,
+  STAGE_TREE,
+  STAGE_TABLES,
+  STAGE_ENCODE,
+  STAGE_DECODE,
+  STAGE_CHECKSUM,
+  STAGE_WRITE,
+  STAGE_COUNT
+};
+
+// Name of every stage in the JSON output
+const char *const CODEC_STAGE_NAMES[STAGE_COUNT] = {
+    "read",   "histogram", "tree",     "tables",
+    "encode", "decode",    "checksum", "write"};
+
+// CodecStats holds what a call spent its time on and how well the data was
+// coded. Stage times are added up over all threads, so a call on a thread
+// pool can spend more time in its stages than the wall time. Mapped input is
+// read from disk by whichever stage touches it first.
+struct CodecStats {
+  double stageSeconds[STAGE_COUNT];
+  double wallSeconds;
+  uint64_t symbols;        // bytes encoded or decoded
+  uint64_t codeBits;       // bits those bytes took, without tables
+  uint64_t countedSymbols; // bytes whose frequencies were counted
+  double entropyBits;      // information content of the counted bytes
+  int maxCodeLength;       // longest code of every table used
+  std::chrono::steady_clock::time_point started;
+
+  CodecStats();
+  void start();
+  void finish();
+  void merge(const CodecStats &other);
+  void addEntropy(const std::vector<uint64_t> &counts);
+  void addCodeLengths(const std::vector<int> &codeLengths);
+  double ioSeconds() const;
+  double computeSeconds() const;
+  double entropy() const;
+  double averageCodeLength() const;
+  double symbolsPerSecond() const;
+  std::string json() const;
+};
+
+// StageClock times consecutive stages of a call into a CodecStats, doing
+// nothing at all when it has none.
+class StageClock {
+public:
+  StageClock(CodecStats *stats);
+  void lap(CodecStage stage);
+  void skip();
+
+private:
+  CodecStats *stats;
+  std::chrono::steady_clock::time_point last;
+};
+
+// Default constructor creates empty statistics and starts the wall clock.
+inline CodecStats::CodecStats() {
+  std::fill(stageSeconds, stageSeconds + STAGE_COUNT, 0.0);
+  wallSeconds = 0;
+  symbols = 0;
+  codeBits = 0;
+  countedSymbols = 0;
+  entropyBits = 0;
+  maxCodeLength = 0;
+  start();
+}
+
+// Restarts the wall clock of the call.
+inline void CodecStats::start() { started = std::chrono::steady_clock::now(); }
+
+// Stores the wall time since start.
+inline void CodecStats::finish() {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - started;
+  wallSeconds = elapsed.count();
+}
+
+//
+// merge
+//
+// Function adds the stage times and coding statistics of a part of the call,
+// such as a block or a nested call, keeping this call's wall time
+inline void CodecStats::merge(const CodecStats &other) {
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    stageSeconds[stage] += other.stageSeconds[stage];
+  }
+  symbols += other.symbols;
+  codeBits += other.codeBits;
+  countedSymbols += other.countedSymbols;
+  entropyBits += other.entropyBits;
+  maxCodeLength = std::max(maxCodeLength, other.maxCodeLength);
+}
+
+//
+// addEntropy
+//
+// Function adds the information content of the counted bytes, the number of
+// bits an ideal code would need for them
+inline void CodecStats::addEntropy(const std::vector<uint64_t> &counts) {
+  uint64_t total = 0;
+  for (uint64_t count : counts) {
+    total += count;
+  }
+  for (uint64_t count : counts) {
+    if (count > 0) {
+      entropyBits -= count * std::log2((double)count / total);
+    }
+  }
+  countedSymbols += total;
+}
+
+// Updates the longest code with a table of code lengths.
+inline void CodecStats::addCodeLengths(const std::vector<int> &codeLengths) {
+  for (int length : codeLengths) {
+    maxCodeLength = std::max(maxCodeLength, length);
+  }
+}
+
+// Returns the time spent reading and writing.
+inline double CodecStats::ioSeconds() const {
+  return stageSeconds[STAGE_READ] + stageSeconds[STAGE_WRITE];
+}
+
+// Returns the time spent in every stage that is not I/O.
+inline double CodecStats::computeSeconds() const {
+  double seconds = 0;
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    seconds += stageSeconds[stage];
+  }
+  return seconds - ioSeconds();
+}
+
+// Returns the entropy in bits per byte, or -1 if no bytes were counted.
+inline double CodecStats::entropy() const {
+  return countedSymbols > 0 ? entropyBits / countedSymbols : -1;
+}
+
+// Returns the average bits per byte of the coded data, or -1 without data.
+inline double CodecStats::averageCodeLength() const {
+  return symbols > 0 ? (double)codeBits / symbols : -1;
+}
+
+// Returns the bytes encoded or decoded per second of encoding and decoding.
+inline double CodecStats::symbolsPerSecond() const {
+  double seconds = stageSeconds[STAGE_ENCODE] + stageSeconds[STAGE_DECODE];
+  return seconds > 0 ? symbols / seconds : 0;
+}
+
+//
+// json
+//
+// Function returns the members of a JSON object with the statistics, without
+// the braces, so callers can add fields of their own. Unknown values are
+// null.
+inline std::string CodecStats::json() const {
+  auto number = [](double value) -> std::string {
+    if (value < 0 || std::isnan(value) || std::isinf(value)) {
+      return "null";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9g", value);
+    return text;
+  };
+  double spent = ioSeconds() + computeSeconds();
+  std::string text = "\"wall_seconds\":" + number(wallSeconds) +
+                     ",\"io_seconds\":" + number(ioSeconds()) +
+                     ",\"compute_seconds\":" + number(computeSeconds()) +
+                     ",\"io_fraction\":" +
+                     number(spent > 0 ? ioSeconds() / spent : -1) +
+                     ",\"stages\":{";
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    text += std::string(stage > 0 ? "," : "") + "\"" +
+            CODEC_STAGE_NAMES[stage] + "\":" + number(stageSeconds[stage]);
+  }
+  text += "},\"symbols\":" + std::to_string(symbols) +
+          ",\"symbols_per_second\":" + number(symbolsPerSecond()) +
+          ",\"entropy_bits\":" + number(entropy()) +
+          ",\"average_code_length\":" + number(averageCodeLength()) +
+          ",\"max_code_length\":" + std::to_string(maxCodeLength);
+  return text;
+}
+
+//
+// jsonString
+//
+// Function quotes text as a JSON string
+inline std::string jsonString(const std::string &text) {
+  std::string quoted = "\"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (c < 0x20) {
+      char escape[8];
+      std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+      quoted += escape;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+// Constructor starts timing the first stage.
+inline StageClock::StageClock(CodecStats *stats) {
+  this->stats = stats;
+  if (stats != nullptr) {
+    last = std::chrono::steady_clock::now();
+  }
+}
+
+//
+// lap
+//
+// Function adds the time since the last lap to the given stage
+inline void StageClock::lap(CodecStage stage) {
+  if (stats == nullptr) {
+    return;
+  }
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed = now - last;
+  stats->stageSeconds[stage] += elapsed.count();
+  last = now;
+}
+
+// Starts the next stage without counting the time since the last lap, for
+// time that is counted somewhere else.
+inline void StageClock::skip() {
+  if (stats != nullptr) {
+    last = std::chrono::steady_clock::now();
+  }
+}
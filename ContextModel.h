@@ -0,0 +1,454 @@
+// Adam Shaar
+// ashaar2
+//
+// ContextModel.h
+//
+// order-1 coding, where every byte is coded with a table chosen by the byte
+// before it. The 256 previous byte values are grouped into at most
+// MAX_CONTEXT_CLUSTERS clusters of contexts with similar statistics and each
+// cluster has one table, so the tables stay small enough for the cache and
+// cost little to store.
+//
+// compact form, stored after the header of a CONTAINER_CONTEXT .hz file:
+//   1 byte    number of clusters, 1 to MAX_CONTEXT_CLUSTERS
+//   128 bytes cluster of every previous byte value, two per byte, high
+//             nibble first
+//   ...       code table of every cluster in the compact block table form
+// The first byte of the data is coded as if it followed a 0 byte.
+//
+// Decoding has to know each byte before it can pick the table for the next
+// one, so its codes cannot be spread over interleaved streams. On the
+// generated corpora of the benchmark it decodes at 0.7 to 1.2 times the
+// speed of single stream order-0 decoding, and slower than decode4.
+#pragma once
+
+#include "FlatHuffmanTree.h"
+#include "HuffmanCode.h"
+#include "HuffmanDecoder.h"
+#include "HuffmanEncoder.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Most tables a context model may have, a cluster number fits in a nibble
+const int MAX_CONTEXT_CLUSTERS = 16;
+// Number of (previous byte, byte) pairs counted by contextHistogram
+const int CONTEXT_PAIRS = ALPHABET_SIZE * ALPHABET_SIZE;
+// Most rounds of moving contexts to the cluster that codes them best
+const int CONTEXT_CLUSTER_ROUNDS = 8;
+// Clusters formed that way before the closest of them are merged
+const int CONTEXT_FIRST_CLUSTERS = 64;
+
+// ContextModel maps every previous byte value to the table of its cluster.
+struct ContextModel {
+  int clusters;
+  unsigned char clusterOf[ALPHABET_SIZE];
+  std::vector<std::vector<int>> codeLengths; // table of every cluster
+
+  ContextModel() {
+    clusters = 0;
+    std::fill(clusterOf, clusterOf + ALPHABET_SIZE, 0);
+  }
+};
+
+// ContextEncoder codes bytes with the table the byte before them selects.
+class ContextEncoder {
+public:
+  bool build(const ContextModel &model);
+  void encodeBlock(const unsigned char *data, size_t size,
+                   unsigned char previous, BitWriter &writer) const;
+
+private:
+  std::vector<HuffmanCode> codes; // table of every cluster, one after another
+  unsigned char clusterOf[ALPHABET_SIZE];
+};
+
+// ContextDecoder decodes what ContextEncoder coded.
+class ContextDecoder {
+public:
+  bool build(const ContextModel &model);
+  bool decodeBuffer(const unsigned char *data, size_t size,
+                    unsigned char *output, size_t count) const;
+  int maxCodeLength() const;
+
+private:
+  std::vector<HuffmanDecoder> decoders;
+  const HuffmanDecoder *byContext[ALPHABET_SIZE];
+};
+
+//
+// contextHistogram
+//
+// Function adds the count of every byte value after every previous byte
+// value to counts, which must hold CONTEXT_PAIRS entries, pair
+// (previous, byte) at previous * ALPHABET_SIZE + byte
+inline void contextHistogram(const unsigned char *data, size_t size,
+                             unsigned char previous, uint64_t *counts) {
+  for (size_t i = 0; i < size; i++) {
+    counts[previous * ALPHABET_SIZE + data[i]]++;
+    previous = data[i];
+  }
+}
+
+//
+// contextClusterBits
+//
+// Function returns the bits a cluster with the byte counts first + second
+// (or first alone) takes: the information content of its bytes and the size
+// of its stored table
+inline double contextClusterBits(const uint64_t *first,
+                                 const uint64_t *second = nullptr) {
+  uint64_t total = 0;
+  int present = 0;
+  double bits = 0;
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    uint64_t count = first[symbol] + (second ? second[symbol] : 0);
+    if (count > 0) {
+      total += count;
+      present++;
+      bits -= count * std::log2((double)count);
+    }
+  }
+  if (total == 0) {
+    return 0;
+  }
+  bits += total * std::log2((double)total);
+  return bits + 8 * (ALPHABET_SIZE / 8 + (present + 1) / 2);
+}
+
+//
+// clusterContexts
+//
+// Function groups the counted contexts into at most maxClusters clusters,
+// k-means style: the busiest contexts seed the clusters, then every context
+// moves to the cluster whose statistics code its bytes in the fewest bits
+// until none moves. Every round takes a fixed number of steps, unlike
+// merging the 256 contexts pair by pair.
+inline void clusterContexts(const std::vector<std::vector<uint64_t>> &contexts,
+                            size_t maxClusters, std::vector<int> &assignment) {
+  size_t n = contexts.size();
+  std::vector<uint64_t> totals(n, 0);
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    for (uint64_t count : contexts[i]) {
+      totals[i] += count;
+    }
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return totals[a] > totals[b]; });
+  std::vector<std::vector<uint64_t>> sums(maxClusters);
+  for (size_t c = 0; c < maxClusters; c++) {
+    sums[c] = contexts[order[c]];
+  }
+  assignment.assign(n, -1);
+  std::vector<double> codeBits(maxClusters * ALPHABET_SIZE);
+  for (int round = 0; round < CONTEXT_CLUSTER_ROUNDS; round++) {
+    // bytes a cluster has not seen get the cost of a rare byte
+    for (size_t c = 0; c < maxClusters; c++) {
+      uint64_t total = 0;
+      for (uint64_t count : sums[c]) {
+        total += count;
+      }
+      for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+        codeBits[c * ALPHABET_SIZE + symbol] =
+            std::log2((total + 1.0) / (sums[c][symbol] + 1.0 / ALPHABET_SIZE));
+      }
+    }
+    bool moved = false;
+    for (size_t i = 0; i < n; i++) {
+      int best = 0;
+      double bestBits = 0;
+      for (size_t c = 0; c < maxClusters; c++) {
+        double bits = 0;
+        for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+          bits += contexts[i][symbol] * codeBits[c * ALPHABET_SIZE + symbol];
+        }
+        if (c == 0 || bits < bestBits) {
+          best = c;
+          bestBits = bits;
+        }
+      }
+      moved = moved || assignment[i] != best;
+      assignment[i] = best;
+    }
+    if (!moved) {
+      break;
+    }
+    for (size_t c = 0; c < maxClusters; c++) {
+      sums[c].assign(ALPHABET_SIZE, 0);
+    }
+    for (size_t i = 0; i < n; i++) {
+      for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+        sums[assignment[i]][symbol] += contexts[i][symbol];
+      }
+    }
+  }
+}
+
+//
+// buildContextModel
+//
+// Function groups the previous byte values into at most maxClusters clusters
+// and finds the code lengths of every cluster's table. More than
+// CONTEXT_FIRST_CLUSTERS contexts are clustered by clusterContexts first.
+// Then the two clusters that cost the fewest bits together, tables included,
+// are merged until there are few enough and no merge saves any more bits.
+// Returns false if nothing was counted.
+inline bool buildContextModel(const std::vector<uint64_t> &counts,
+                              int maxClusters, ContextModel &model) {
+  std::vector<std::vector<uint64_t>> contexts;
+  std::vector<int> previousOf;
+  for (int previous = 0; previous < ALPHABET_SIZE; previous++) {
+    auto first = counts.begin() + previous * ALPHABET_SIZE;
+    std::vector<uint64_t> row(first, first + ALPHABET_SIZE);
+    if (std::count(row.begin(), row.end(), 0) < ALPHABET_SIZE) {
+      contexts.push_back(row);
+      previousOf.push_back(previous);
+    }
+  }
+  if (contexts.empty()) {
+    return false;
+  }
+  std::vector<int> assignment(contexts.size());
+  size_t n = contexts.size();
+  if (n > CONTEXT_FIRST_CLUSTERS) {
+    clusterContexts(contexts, CONTEXT_FIRST_CLUSTERS, assignment);
+    n = CONTEXT_FIRST_CLUSTERS;
+  } else {
+    for (size_t i = 0; i < contexts.size(); i++) {
+      assignment[i] = i;
+    }
+  }
+  std::vector<std::vector<uint64_t>> clusterCounts(
+      n, std::vector<uint64_t>(ALPHABET_SIZE, 0));
+  std::vector<std::vector<int>> members(n);
+  for (size_t i = 0; i < contexts.size(); i++) {
+    for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+      clusterCounts[assignment[i]][symbol] += contexts[i][symbol];
+    }
+    members[assignment[i]].push_back(previousOf[i]);
+  }
+  std::vector<double> bits(n);
+  std::vector<bool> alive(n);
+  size_t clusters = 0;
+  for (size_t i = 0; i < n; i++) {
+    bits[i] = contextClusterBits(clusterCounts[i].data());
+    alive[i] = !members[i].empty();
+    clusters += alive[i];
+  }
+
+  // growth[i][j] is what merging clusters i < j adds to the total bits
+  auto mergeGrowth = [&](size_t i, size_t j) {
+    return contextClusterBits(clusterCounts[i].data(),
+                              clusterCounts[j].data()) -
+           bits[i] - bits[j];
+  };
+  std::vector<std::vector<double>> growth(n, std::vector<double>(n, 0));
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = i + 1; j < n; j++) {
+      growth[i][j] = mergeGrowth(i, j);
+    }
+  }
+  while (clusters > 1) {
+    size_t bestI = 0;
+    size_t bestJ = 0;
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = i + 1; alive[i] && j < n; j++) {
+        if (alive[j] && (bestJ == 0 || growth[i][j] < growth[bestI][bestJ])) {
+          bestI = i;
+          bestJ = j;
+        }
+      }
+    }
+    if (clusters <= (size_t)maxClusters && growth[bestI][bestJ] >= 0) {
+      break;
+    }
+    for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+      clusterCounts[bestI][symbol] += clusterCounts[bestJ][symbol];
+    }
+    members[bestI].insert(members[bestI].end(), members[bestJ].begin(),
+                          members[bestJ].end());
+    bits[bestI] = contextClusterBits(clusterCounts[bestI].data());
+    alive[bestJ] = false;
+    clusters--;
+    for (size_t k = 0; k < n; k++) {
+      if (alive[k] && k != bestI) {
+        size_t i = std::min(k, bestI);
+        size_t j = std::max(k, bestI);
+        growth[i][j] = mergeGrowth(i, j);
+      }
+    }
+  }
+
+  // previous bytes that never occur belong to the first cluster
+  model = ContextModel();
+  for (size_t i = 0; i < n; i++) {
+    if (!alive[i]) {
+      continue;
+    }
+    for (int previous : members[i]) {
+      model.clusterOf[previous] = model.clusters;
+    }
+    std::vector<int> lengths;
+    if (!optimalCodeLengths(clusterCounts[i], DEFAULT_MAX_CODE_LENGTH,
+                            lengths)) {
+      return false;
+    }
+    model.codeLengths.push_back(lengths);
+    model.clusters++;
+  }
+  return true;
+}
+
+//
+// contextCodedBits
+//
+// Function returns the number of bits the counted pairs take coded with the
+// model, or UINT64_MAX if one of them has no code
+inline uint64_t contextCodedBits(const std::vector<uint64_t> &counts,
+                                 const ContextModel &model) {
+  uint64_t total = 0;
+  for (int previous = 0; previous < ALPHABET_SIZE; previous++) {
+    const std::vector<int> &lengths =
+        model.codeLengths[model.clusterOf[previous]];
+    for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+      uint64_t count = counts[previous * ALPHABET_SIZE + symbol];
+      if (count > 0 && lengths[symbol] == 0) {
+        return UINT64_MAX;
+      }
+      total += count * lengths[symbol];
+    }
+  }
+  return total;
+}
+
+// Appends the compact form of the model to out.
+inline void appendContextModel(const ContextModel &model,
+                               std::vector<unsigned char> &out) {
+  out.push_back(model.clusters);
+  for (int previous = 0; previous < ALPHABET_SIZE; previous += 2) {
+    out.push_back(model.clusterOf[previous] << 4 |
+                  model.clusterOf[previous + 1]);
+  }
+  for (const std::vector<int> &lengths : model.codeLengths) {
+    appendCodeLengths(lengths, out);
+  }
+}
+
+//
+// parseContextModel
+//
+// Function reads the compact form of a model from data, storing the number
+// of bytes it takes in used, returns false if it does not fit or is invalid
+inline bool parseContextModel(const unsigned char *data, size_t size,
+                              ContextModel &model, size_t &used) {
+  model = ContextModel();
+  used = 1 + ALPHABET_SIZE / 2;
+  if (size < used || data[0] < 1 || data[0] > MAX_CONTEXT_CLUSTERS) {
+    return false;
+  }
+  model.clusters = data[0];
+  for (int previous = 0; previous < ALPHABET_SIZE; previous++) {
+    unsigned char packed = data[1 + previous / 2];
+    model.clusterOf[previous] = previous % 2 == 0 ? packed >> 4 : packed & 0xF;
+    if (model.clusterOf[previous] >= model.clusters) {
+      return false;
+    }
+  }
+  model.codeLengths.resize(model.clusters);
+  for (std::vector<int> &lengths : model.codeLengths) {
+    size_t tableSize;
+    if (!parseCodeLengths(data + used, size - used, lengths, tableSize)) {
+      return false;
+    }
+    used += tableSize;
+  }
+  return true;
+}
+
+//
+// build
+//
+// Function builds the codes of every cluster and keeps the cluster of every
+// previous byte value to find them
+inline bool ContextEncoder::build(const ContextModel &model) {
+  codes.assign(model.clusters * ALPHABET_SIZE, HuffmanCode());
+  for (int cluster = 0; cluster < model.clusters; cluster++) {
+    std::vector<HuffmanCode> clusterCodes;
+    if (!assignCanonicalCodes(model.codeLengths[cluster], clusterCodes)) {
+      return false;
+    }
+    std::copy(clusterCodes.begin(), clusterCodes.end(),
+              codes.begin() + cluster * ALPHABET_SIZE);
+  }
+  std::copy(model.clusterOf, model.clusterOf + ALPHABET_SIZE, clusterOf);
+  return true;
+}
+
+//
+// encodeBlock
+//
+// Function writes the codes of a block whose first byte follows previous.
+// Every code fits in one write, context tables hold no codes longer than
+// DEFAULT_MAX_CODE_LENGTH bits.
+inline void ContextEncoder::encodeBlock(const unsigned char *data, size_t size,
+                                        unsigned char previous,
+                                        BitWriter &writer) const {
+  for (size_t i = 0; i < size; i++) {
+    const HuffmanCode &code =
+        codes[clusterOf[previous] * ALPHABET_SIZE + data[i]];
+    writer.write(code.bits, code.length);
+    previous = data[i];
+  }
+}
+
+//
+// build
+//
+// Function builds the decoding tables of every cluster
+inline bool ContextDecoder::build(const ContextModel &model) {
+  decoders.assign(model.clusters, HuffmanDecoder());
+  for (int cluster = 0; cluster < model.clusters; cluster++) {
+    std::vector<HuffmanCode> codes;
+    if (!assignCanonicalCodes(model.codeLengths[cluster], codes) ||
+        !decoders[cluster].build(codes)) {
+      return false;
+    }
+  }
+  for (int previous = 0; previous < ALPHABET_SIZE; previous++) {
+    byContext[previous] = &decoders[model.clusterOf[previous]];
+  }
+  return true;
+}
+
+//
+// decodeBuffer
+//
+// Function decodes exactly `count` bytes from the bitstream in data, returns
+// false if it ends early or holds a code the context has no byte for
+inline bool ContextDecoder::decodeBuffer(const unsigned char *data, size_t size,
+                                         unsigned char *output,
+                                         size_t count) const {
+  BitReader reader;
+  reader.next = data;
+  reader.end = data + size;
+  unsigned char previous = 0;
+  for (size_t i = 0; i < count; i++) {
+    int symbol = byContext[previous]->decodeSymbol(reader);
+    if (symbol < 0) {
+      return false;
+    }
+    output[i] = previous = symbol;
+  }
+  return true;
+}
+
+// Returns the longest code of any cluster.
+inline int ContextDecoder::maxCodeLength() const {
+  int longest = 0;
+  for (const HuffmanDecoder &decoder : decoders) {
+    longest = std::max(longest, decoder.maxCodeLength());
+  }
+  return longest;
+}
@@ -0,0 +1,347 @@
+// Adam Shaar
+// ashaar2
+//
+// FixedHuffman.h
+//
+// encoders and decoders specialized at compile time for one fixed code table,
+// for tables that are known when the program is built, such as the .hi table
+// of a file format that is compressed all the time. A table is a struct with
+// the code and code length of every byte value as constexpr arrays, written
+// from a .hi file by writeFixedTable (filecompress -g):
+//
+//   struct LogTable {
+//     static constexpr uint32_t codes[ALPHABET_SIZE] = {...};
+//     static constexpr uint8_t lengths[ALPHABET_SIZE] = {...};
+//   };
+//
+// The decode table of such a struct is built by the compiler, so nothing is
+// built when the program starts, and the longest code is a constant the
+// kernels are unrolled for. Codes may be at most FIXED_MAX_CODE_LENGTH bits,
+// which keeps every code to a single lookup.
+#pragma once
+
+#include "HuffmanCode.h"
+#include "HuffmanDecoder.h"
+#include "HuffmanEncoder.h"
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Longest code a fixed table may hold, its decode table has an entry for
+// every pattern of that many bits
+const int FIXED_MAX_CODE_LENGTH = 12;
+
+//
+// fixedMaxLength
+//
+// Function returns the length of the longest code of a fixed table
+template <class Table> constexpr int fixedMaxLength() {
+  int longest = 0;
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    longest = Table::lengths[symbol] > longest ? Table::lengths[symbol]
+                                               : longest;
+  }
+  return longest;
+}
+
+//
+// fixedTableValid
+//
+// Function returns true if the codes of a fixed table are no longer than
+// FIXED_MAX_CODE_LENGTH bits and form a prefix code, checked by marking the
+// patterns every code covers in a table of the longest code's width
+template <class Table> constexpr bool fixedTableValid() {
+  constexpr int bits = fixedMaxLength<Table>();
+  if (bits == 0 || bits > FIXED_MAX_CODE_LENGTH) {
+    return false;
+  }
+  std::array<bool, 1 << bits> covered{};
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    int length = Table::lengths[symbol];
+    if (length == 0) {
+      continue;
+    }
+    if (Table::codes[symbol] >> length != 0) {
+      return false;
+    }
+    uint32_t first = Table::codes[symbol] << (bits - length);
+    for (uint32_t pattern = 0; pattern < 1u << (bits - length); pattern++) {
+      if (covered[first + pattern]) {
+        return false;
+      }
+      covered[first + pattern] = true;
+    }
+  }
+  return true;
+}
+
+//
+// fixedDecodeTable
+//
+// Function builds the decode table of a fixed table at compile time: the
+// entry of every pattern of the longest code's width holds the symbol whose
+// code starts it in the low byte and the code length above it, 0 for
+// patterns that start no code
+template <class Table>
+constexpr std::array<uint16_t, 1 << fixedMaxLength<Table>()>
+fixedDecodeTable() {
+  constexpr int bits = fixedMaxLength<Table>();
+  std::array<uint16_t, 1 << bits> table{};
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    int length = Table::lengths[symbol];
+    if (length == 0) {
+      continue;
+    }
+    uint32_t first = Table::codes[symbol] << (bits - length);
+    for (uint32_t pattern = 0; pattern < 1u << (bits - length); pattern++) {
+      table[first + pattern] = symbol | length << 8;
+    }
+  }
+  return table;
+}
+
+// FixedHuffmanEncoder writes codes of a fixed table, several codes to a
+// single write of the bit writer.
+template <class Table> class FixedHuffmanEncoder {
+public:
+  static void encodeBlock(const unsigned char *data, size_t size,
+                          BitWriter &writer);
+
+private:
+  static_assert(fixedTableValid<Table>(), "not a usable fixed code table");
+  // codes that always fit in one 32-bit write
+  static constexpr int PER_WRITE = 32 / fixedMaxLength<Table>();
+};
+
+// FixedHuffmanDecoder reads codes of a fixed table with one lookup per code
+// and one refill of the bit reader for as many codes as it always holds.
+template <class Table> class FixedHuffmanDecoder {
+public:
+  static bool decodeBuffer(const unsigned char *data, size_t size,
+                           unsigned char *output, size_t count);
+  static bool decodeSpan(const unsigned char *data, size_t size,
+                         std::ostream &out, uint64_t &bytesOut);
+
+private:
+  static_assert(fixedTableValid<Table>(), "not a usable fixed code table");
+  static constexpr int BITS = fixedMaxLength<Table>();
+  // codes a refill of at least 56 bits always holds
+  static constexpr int PER_REFILL = 56 / BITS;
+  static constexpr std::array<uint16_t, 1 << BITS> table =
+      fixedDecodeTable<Table>();
+  static size_t decodeRun(BitReader &reader, unsigned char *output,
+                          size_t count, int &status);
+};
+
+//
+// encodeBlock
+//
+// Function writes the code of every byte in the block to the bit writer,
+// joining PER_WRITE codes into one write. Bytes without a code write nothing,
+// as with HuffmanEncoder.
+template <class Table>
+void FixedHuffmanEncoder<Table>::encodeBlock(const unsigned char *data,
+                                             size_t size, BitWriter &writer) {
+  size_t i = 0;
+  for (; i + PER_WRITE <= size; i += PER_WRITE) {
+    uint64_t bits = 0;
+    int length = 0;
+    for (int k = 0; k < PER_WRITE; k++) {
+      unsigned char symbol = data[i + k];
+      bits = bits << Table::lengths[symbol] | Table::codes[symbol];
+      length += Table::lengths[symbol];
+    }
+    writer.write(bits, length);
+  }
+  for (; i < size; i++) {
+    writer.write(Table::codes[data[i]], Table::lengths[data[i]]);
+  }
+}
+
+//
+// decodeRun
+//
+// Function decodes up to `count` symbols into output and returns how many it
+// decoded. It stops early with DECODE_END in status when the remaining bits
+// do not hold a whole code, or with DECODE_ERROR on a code path that does not
+// exist, and leaves status 0 otherwise.
+template <class Table>
+size_t FixedHuffmanDecoder<Table>::decodeRun(BitReader &reader,
+                                             unsigned char *output,
+                                             size_t count, int &status) {
+  status = 0;
+  size_t i = 0;
+  // while 8 bytes are left a refill holds at least 56 bits
+  while (count - i >= PER_REFILL && reader.end - reader.next >= 8) {
+    reader.refill();
+    for (int k = 0; k < PER_REFILL; k++) {
+      uint16_t entry = table[reader.peek(BITS)];
+      if (entry == 0) {
+        status = DECODE_ERROR;
+        return i + k;
+      }
+      reader.consume(entry >> 8);
+      output[i + k] = entry;
+    }
+    i += PER_REFILL;
+  }
+  // the end of the input a code at a time, checking every bit is there
+  for (; i < count; i++) {
+    reader.refill();
+    uint16_t entry = table[reader.peek(BITS)];
+    if (entry == 0 || (entry >> 8) > reader.count) {
+      status = entry == 0 && reader.count >= BITS ? DECODE_ERROR : DECODE_END;
+      return i;
+    }
+    reader.consume(entry >> 8);
+    output[i] = entry;
+  }
+  return i;
+}
+
+//
+// decodeBuffer
+//
+// Function decodes exactly `count` symbols from the bitstream in data,
+// returns false if the bitstream ends early or holds an invalid code
+template <class Table>
+bool FixedHuffmanDecoder<Table>::decodeBuffer(const unsigned char *data,
+                                              size_t size,
+                                              unsigned char *output,
+                                              size_t count) {
+  BitReader reader;
+  reader.next = data;
+  reader.end = data + size;
+  int status;
+  return decodeRun(reader, output, count, status) == count;
+}
+
+//
+// decodeSpan
+//
+// Function decodes every code of a bitstream in memory, such as a .hc file,
+// and writes the symbols to the output stream in large chunks, returns false
+// if it runs into an invalid code or more bits than padding after the last
+// code
+template <class Table>
+bool FixedHuffmanDecoder<Table>::decodeSpan(const unsigned char *data,
+                                            size_t size, std::ostream &out,
+                                            uint64_t &bytesOut) {
+  bytesOut = 0;
+  std::vector<unsigned char> output(DECODE_OUTPUT_SIZE);
+  BitReader reader;
+  reader.next = data;
+  reader.end = data + size;
+  int status = 0;
+  while (status == 0) {
+    size_t got = decodeRun(reader, output.data(), output.size(), status);
+    out.write((const char *)output.data(), got);
+    bytesOut += got;
+  }
+  return status == DECODE_END && reader.padding();
+}
+
+// FixedTableList is the list of fixed tables compiled into a program. A table
+// loaded at run time is looked up in it by its codes, and a table found there
+// is coded with the kernels of FixedHuffmanEncoder and FixedHuffmanDecoder.
+template <class... Tables> struct FixedTableList {
+  //
+  // find
+  //
+  // Function returns the index of the table of the list with exactly the
+  // given "0"/"1" codes, -1 if there is none
+  static int find(const std::vector<std::string> &huffmanCodes) {
+    int index = 0;
+    int found = -1;
+    ((found = found < 0 && matches<Tables>(huffmanCodes) ? index : found,
+      index++),
+     ...);
+    return found;
+  }
+
+  // Encodes data with the table at index, see FixedHuffmanEncoder. Does
+  // nothing if there is no such table.
+  static void encodeBlock(int index, const unsigned char *data, size_t size,
+                          BitWriter &writer) {
+    // one kernel per table, the null entry keeps an empty list valid C++
+    static constexpr void (*encoders[])(const unsigned char *, size_t,
+                                        BitWriter &) = {
+        FixedHuffmanEncoder<Tables>::encodeBlock..., nullptr};
+    if (index < 0 || index >= (int)sizeof...(Tables)) {
+      return;
+    }
+    encoders[index](data, size, writer);
+  }
+
+  // Decodes a bitstream with the table at index, see FixedHuffmanDecoder.
+  // Returns false if there is no such table.
+  static bool decodeSpan(int index, const unsigned char *data, size_t size,
+                         std::ostream &out, uint64_t &bytesOut) {
+    static constexpr bool (*decoders[])(const unsigned char *, size_t,
+                                        std::ostream &, uint64_t &) = {
+        FixedHuffmanDecoder<Tables>::decodeSpan..., nullptr};
+    if (index < 0 || index >= (int)sizeof...(Tables)) {
+      return false;
+    }
+    return decoders[index](data, size, out, bytesOut);
+  }
+
+private:
+  template <class Table>
+  static bool matches(const std::vector<std::string> &huffmanCodes) {
+    for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+      const std::string &code = huffmanCodes[symbol];
+      if (code.size() != Table::lengths[symbol] ||
+          (!code.empty() &&
+           std::stoul(code, nullptr, 2) != Table::codes[symbol])) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+//
+// writeFixedTable
+//
+// Function writes a header that defines the fixed table `name` with the given
+// "0"/"1" codes, for FixedTables.h to include. Returns false with a message
+// in error if the codes are not a prefix code of at most
+// FIXED_MAX_CODE_LENGTH bits.
+inline bool writeFixedTable(const std::string &name,
+                            const std::vector<std::string> &huffmanCodes,
+                            const std::string &source, std::ostream &out,
+                            std::string &error) {
+  std::vector<HuffmanCode> codes;
+  HuffmanDecoder check;
+  if (!codesFromStrings(huffmanCodes, codes) || !check.build(codes)) {
+    error = "the codes of " + source + " are not a prefix code";
+    return false;
+  }
+  if (check.maxCodeLength() > FIXED_MAX_CODE_LENGTH) {
+    error = "fixed tables hold codes of at most " +
+            std::to_string(FIXED_MAX_CODE_LENGTH) + " bits, " + source +
+            " has codes of " + std::to_string(check.maxCodeLength());
+    return false;
+  }
+  out << "// " << name << ".h\n//\n// fixed code table generated by "
+      << "filecompress -g from\n// " << source
+      << ", do not edit\n#pragma once\n\n"
+      << "#include \"FixedHuffman.h\"\n\nstruct " << name << " {\n"
+      << "  static constexpr uint32_t codes[ALPHABET_SIZE] = {";
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    out << (symbol % 8 == 0 ? "\n      " : " ") << "0x" << std::hex
+        << codes[symbol].bits << std::dec
+        << (symbol + 1 < ALPHABET_SIZE ? "," : "");
+  }
+  out << "};\n  static constexpr uint8_t lengths[ALPHABET_SIZE] = {";
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    out << (symbol % 16 == 0 ? "\n      " : " ") << codes[symbol].length
+        << (symbol + 1 < ALPHABET_SIZE ? "," : "");
+  }
+  out << "};\n};\n";
+  return (bool)out;
+}
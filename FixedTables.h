@@ -0,0 +1,16 @@
+// Adam Shaar
+// ashaar2
+//
+// FixedTables.h
+//
+// the fixed code tables compiled into filecompress (see FixedHuffman.h). .hc
+// files coded with one of them are compressed and decompressed with its
+// specialized kernels instead of tables built at run time. To add a table,
+// write its header from the .hi file with
+//   filecompress -g Name table.hi > Name.h
+// include the header here and add Name to the list.
+#pragma once
+
+#include "FixedHuffman.h"
+
+typedef FixedTableList<> BuiltinFixedTables;
@@ -0,0 +1,258 @@
+// Adam Shaar
+// ashaar2
+//
+// FlatHuffmanTree.h
+//
+// Huffman tree stored in one fixed-size array of nodes linked by 16-bit
+// indices, built in place without any heap allocation
+#pragma once
+
+#include "HuffmanCode.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class FlatHuffmanTree {
+public:
+  // Index of a child that does not exist
+  static const uint16_t NO_NODE = 0xFFFF;
+  // A full binary tree with a leaf per symbol has 2n - 1 nodes
+  static const int CAPACITY = 2 * ALPHABET_SIZE - 1;
+
+  // FlatNode is a tree node, leaves have no children and hold a symbol
+  struct FlatNode {
+    uint16_t child[2];
+    uint16_t symbol;
+    uint16_t height; // longest path from this node down to a leaf
+  };
+
+  FlatHuffmanTree();
+  void clear();
+  bool empty() const;
+  bool build(const std::vector<uint64_t> &frequencies);
+  bool rebuild(const std::vector<std::string> &huffmanCodes);
+
+  uint16_t root() const;
+  const FlatNode &node(uint16_t index) const;
+  bool isLeaf(uint16_t index) const;
+  void codeLengths(std::vector<int> &lengths) const;
+
+private:
+  FlatNode nodes[CAPACITY];
+  int count;
+  uint16_t rootIndex;
+  uint16_t addNode(uint16_t symbol);
+};
+
+// Default constructor creates an empty tree.
+inline FlatHuffmanTree::FlatHuffmanTree() { clear(); }
+
+// Removes every node from the tree.
+inline void FlatHuffmanTree::clear() {
+  count = 0;
+  rootIndex = NO_NODE;
+}
+
+// Returns true if the tree has no nodes.
+inline bool FlatHuffmanTree::empty() const { return count == 0; }
+
+// Returns the index of the root node, NO_NODE for an empty tree.
+inline uint16_t FlatHuffmanTree::root() const { return rootIndex; }
+
+// Returns the node at the given index.
+inline const FlatHuffmanTree::FlatNode &
+FlatHuffmanTree::node(uint16_t index) const {
+  return nodes[index];
+}
+
+// Returns true if the node at the given index is a leaf.
+inline bool FlatHuffmanTree::isLeaf(uint16_t index) const {
+  return nodes[index].child[0] == NO_NODE && nodes[index].child[1] == NO_NODE;
+}
+
+//
+// addNode
+//
+// Function appends a node without children and returns its index
+inline uint16_t FlatHuffmanTree::addNode(uint16_t symbol) {
+  nodes[count].child[0] = nodes[count].child[1] = NO_NODE;
+  nodes[count].symbol = symbol;
+  nodes[count].height = 0;
+  return count++;
+}
+
+//
+// build
+//
+// Function builds the Huffman tree of the given frequencies in place. The
+// leaves are sorted by frequency once and stored first, every merged node is
+// appended after them, and merged nodes come out in order of weight as well.
+// The two lightest trees are therefore always at the front of one of these
+// two queues, so the merging takes linear time. Bytes with a frequency of 0
+// get no leaf, and a single byte value is hung below a root so that it still
+// gets a one bit code.
+inline bool FlatHuffmanTree::build(const std::vector<uint64_t> &frequencies) {
+  clear();
+  uint16_t order[ALPHABET_SIZE];
+  int leaves = 0;
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    if (frequencies[symbol] > 0) {
+      order[leaves++] = symbol;
+    }
+  }
+  if (leaves == 0) {
+    return true;
+  }
+  std::sort(order, order + leaves, [&frequencies](uint16_t a, uint16_t b) {
+    return frequencies[a] < frequencies[b] ||
+           (frequencies[a] == frequencies[b] && a < b);
+  });
+
+  uint64_t weights[CAPACITY];
+  for (int i = 0; i < leaves; i++) {
+    uint16_t leaf = addNode(order[i]);
+    weights[leaf] = frequencies[order[i]];
+  }
+  if (leaves == 1) {
+    rootIndex = addNode(0);
+    nodes[rootIndex].child[0] = 0;
+    nodes[rootIndex].height = 1;
+    return true;
+  }
+
+  // front of the leaf queue and of the merged queue, ties go to the leaf to
+  // keep the tree shallow
+  int nextLeaf = 0;
+  int nextMerged = leaves;
+  auto takeLightest = [&]() -> uint16_t {
+    if (nextLeaf < leaves &&
+        (nextMerged == count || weights[nextLeaf] <= weights[nextMerged])) {
+      return nextLeaf++;
+    }
+    return nextMerged++;
+  };
+  while (count < 2 * leaves - 1) {
+    uint16_t first = takeLightest();
+    uint16_t second = takeLightest();
+    // merge the two lightest trees under a new node
+    uint16_t merged = addNode(0);
+    nodes[merged].child[0] = first;
+    nodes[merged].child[1] = second;
+    nodes[merged].height =
+        std::max(nodes[first].height, nodes[second].height) + 1;
+    weights[merged] = weights[first] + weights[second];
+  }
+  rootIndex = count - 1;
+  return true;
+}
+
+//
+// rebuild
+//
+// Function rebuilds the tree from the "0"/"1" code of every symbol, returns
+// false and leaves the tree empty if the codes are malformed, are not prefix
+// free or need more nodes than a tree of the whole alphabet
+inline bool
+FlatHuffmanTree::rebuild(const std::vector<std::string> &huffmanCodes) {
+  clear();
+  rootIndex = addNode(0);
+  for (size_t symbol = 0; symbol < huffmanCodes.size(); symbol++) {
+    const std::string &code = huffmanCodes[symbol];
+    if (code.empty()) {
+      continue;
+    }
+    uint16_t current = rootIndex;
+    for (const char c : code) {
+      if ((c != '0' && c != '1') || (isLeaf(current) && current != rootIndex &&
+                                     nodes[current].symbol != NO_NODE)) {
+        clear();
+        return false;
+      }
+      int bit = c == '1';
+      if (nodes[current].child[bit] == NO_NODE) {
+        if (count == CAPACITY) {
+          clear();
+          return false;
+        }
+        // internal nodes are marked with NO_NODE until they get a symbol
+        uint16_t child = addNode(NO_NODE);
+        nodes[current].child[bit] = child;
+      }
+      current = nodes[current].child[bit];
+    }
+    // the code must end on a fresh node, not on an existing code or prefix
+    if (!isLeaf(current) || nodes[current].symbol != NO_NODE) {
+      clear();
+      return false;
+    }
+    nodes[current].symbol = symbol;
+  }
+  if (isLeaf(rootIndex)) {
+    clear();
+    return true;
+  }
+  // children always come after their parent, so heights can be filled in
+  // from the back
+  for (int index = count - 1; index >= 0; index--) {
+    for (int bit = 0; bit < 2; bit++) {
+      uint16_t child = nodes[index].child[bit];
+      if (child != NO_NODE) {
+        nodes[index].height =
+            std::max<uint16_t>(nodes[index].height, nodes[child].height + 1);
+      }
+    }
+  }
+  return true;
+}
+
+//
+// codeLengths
+//
+// Function stores the depth of every leaf, which is the length of its code,
+// and 0 for symbols without a leaf
+inline void FlatHuffmanTree::codeLengths(std::vector<int> &lengths) const {
+  lengths.assign(ALPHABET_SIZE, 0);
+  if (empty()) {
+    return;
+  }
+  // parents always have a larger index than their children after build but a
+  // smaller one after rebuild, so walk down from the root with a stack
+  uint16_t stack[CAPACITY];
+  uint16_t depths[CAPACITY];
+  int size = 0;
+  stack[size] = rootIndex;
+  depths[size++] = 0;
+  while (size > 0) {
+    uint16_t index = stack[--size];
+    uint16_t depth = depths[size];
+    if (isLeaf(index)) {
+      lengths[nodes[index].symbol] = depth;
+      continue;
+    }
+    for (int bit = 0; bit < 2; bit++) {
+      if (nodes[index].child[bit] != NO_NODE) {
+        stack[size] = nodes[index].child[bit];
+        depths[size++] = depth + 1;
+      }
+    }
+  }
+}
+
+//
+// optimalCodeLengths
+//
+// Function finds the optimal code length of every byte value with no code
+// longer than maxLength bits. The Huffman tree is already within the limit
+// for most inputs, only deeper trees fall back to package-merge. Returns
+// false if the limit is too small for the number of distinct bytes.
+inline bool optimalCodeLengths(const std::vector<uint64_t> &frequencies,
+                               int maxLength, std::vector<int> &lengths) {
+  FlatHuffmanTree tree;
+  tree.build(frequencies);
+  if (tree.empty() || tree.node(tree.root()).height <= maxLength) {
+    tree.codeLengths(lengths);
+    return true;
+  }
+  return limitedCodeLengths(frequencies, maxLength, lengths);
+}
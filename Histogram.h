@@ -0,0 +1,131 @@
+// Adam Shaar
+// ashaar2
+//
+// Histogram.h
+//
+// fast byte frequency counting over large buffers, on one thread (see
+// HistogramKernel.h) or spread over a thread pool
+#pragma once
+
+#include "CodecStats.h"
+#include "HistogramKernel.h"
+#include "HuffmanCode.h"
+#include "ThreadPool.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Number of bytes read from a file at a time while counting
+const size_t HISTOGRAM_READ_SIZE = 1 << 24;
+// Smallest piece of a buffer worth handing to another thread
+const size_t HISTOGRAM_MIN_PARALLEL_SIZE = 1 << 20;
+// Size of the chunks a sample takes from the body of a file
+const uint64_t HISTOGRAM_SAMPLE_CHUNK_SIZE = 64 << 10;
+
+// HistogramSample describes the parts of a file counted to train a table
+// without reading all of it: the head of the file and chunks spread evenly
+// over the rest, each at a random offset within its stretch of the file.
+struct HistogramSample {
+  uint64_t headBytes;  // counted from the start of the file
+  uint64_t chunkBytes; // size of every chunk of the rest
+  uint64_t chunks;     // number of chunks, 0 counts the whole file
+};
+
+//
+// parallelHistogram
+//
+// Function counts data in one piece per thread of the pool and adds the
+// merged counts to counts
+inline void parallelHistogram(const unsigned char *data, size_t size,
+                              uint64_t *counts, ThreadPool &pool) {
+  size_t pieces = std::min<size_t>(pool.size(),
+                                   size / HISTOGRAM_MIN_PARALLEL_SIZE);
+  if (pieces <= 1) {
+    histogram(data, size, counts);
+    return;
+  }
+  std::vector<std::vector<uint64_t>> partial(
+      pieces, std::vector<uint64_t>(ALPHABET_SIZE, 0));
+  size_t pieceSize = (size + pieces - 1) / pieces;
+  pool.parallelFor(pieces, [&](size_t i) {
+    size_t start = i * pieceSize;
+    size_t end = std::min(size, start + pieceSize);
+    histogram(data + start, end - start, partial[i].data());
+  });
+  for (size_t i = 0; i < pieces; i++) {
+    for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+      counts[symbol] += partial[i][symbol];
+    }
+  }
+}
+
+//
+// histogramSampleOfSize
+//
+// Function returns a sample of about `bytes` bytes, a quarter of them from
+// the head of the file and the rest in HISTOGRAM_SAMPLE_CHUNK_SIZE chunks
+inline HistogramSample histogramSampleOfSize(uint64_t bytes) {
+  HistogramSample sample;
+  sample.headBytes = bytes / 4;
+  sample.chunkBytes = HISTOGRAM_SAMPLE_CHUNK_SIZE;
+  sample.chunks = (bytes - sample.headBytes) / sample.chunkBytes;
+  return sample;
+}
+
+//
+// sampleHistogram
+//
+// Function adds the counts of a sample of data to counts and returns false,
+// or counts all of it and returns true if the sample would take more than
+// half of the data. Chunk offsets come from a fixed seed, the same data
+// always gets the same counts.
+inline bool sampleHistogram(const unsigned char *data, size_t size,
+                            const HistogramSample &sample, uint64_t *counts) {
+  uint64_t sampled = sample.headBytes + sample.chunks * sample.chunkBytes;
+  if (sample.chunks == 0 || sample.chunkBytes == 0 || sampled > size / 2) {
+    histogram(data, size, counts);
+    return true;
+  }
+  histogram(data, sample.headBytes, counts);
+  // at least chunkBytes, as the sample takes at most half of the data
+  uint64_t stretch = (size - sample.headBytes) / sample.chunks;
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (uint64_t i = 0; i < sample.chunks; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    uint64_t offset = sample.headBytes + i * stretch +
+                      state % (stretch - sample.chunkBytes + 1);
+    histogram(data + offset, sample.chunkBytes, counts);
+  }
+  return false;
+}
+
+//
+// fileHistogram
+//
+// Function counts every byte value of a file, reading it in large buffers and
+// counting each buffer on `threads` threads (0 uses every hardware thread),
+// returns false if the file cannot be read. The time spent reading and
+// counting is added to stats if given.
+inline bool fileHistogram(const std::string &filename,
+                          std::vector<uint64_t> &counts, int threads = 1,
+                          CodecStats *stats = nullptr) {
+  counts.assign(ALPHABET_SIZE, 0);
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  ThreadPool pool(threads);
+  std::vector<unsigned char> buffer(HISTOGRAM_READ_SIZE);
+  StageClock clock(stats);
+  while (file) {
+    file.read((char *)buffer.data(), buffer.size());
+    size_t got = file.gcount();
+    clock.lap(STAGE_READ);
+    parallelHistogram(buffer.data(), got, counts.data(), pool);
+    clock.lap(STAGE_HISTOGRAM);
+  }
+  return file.eof();
+}
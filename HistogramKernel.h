@@ -0,0 +1,68 @@
+// Adam Shaar
+// ashaar2
+//
+// HistogramKernel.h
+//
+// byte frequency counting of a buffer on the calling thread, the kernel that
+// Histogram.h spreads over a thread pool. Every function is inline, so it can
+// be included from any number of source files.
+#pragma once
+
+#include "HuffmanCode.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Bytes counted into the 32-bit tables before they are added to the totals,
+// small enough that no 32-bit count can overflow
+const size_t HISTOGRAM_SLICE_SIZE = 1 << 30;
+
+//
+// histogramSlice
+//
+// Function adds the byte counts of at most HISTOGRAM_SLICE_SIZE bytes to
+// counts. Consecutive bytes go to four separate tables, so runs of the same
+// byte do not have to wait on the store to the counter before.
+inline void histogramSlice(const unsigned char *data, size_t size,
+                           uint64_t *counts) {
+  uint32_t tables[4][ALPHABET_SIZE];
+  std::memset(tables, 0, sizeof(tables));
+  size_t i = 0;
+  // Load 16 bytes as two 64-bit words and pick the bytes out with shifts
+  for (; i + 16 <= size; i += 16) {
+    uint64_t first;
+    uint64_t second;
+    std::memcpy(&first, data + i, 8);
+    std::memcpy(&second, data + i + 8, 8);
+    for (int shift = 0; shift < 64; shift += 32) {
+      tables[0][(uint8_t)(first >> shift)]++;
+      tables[1][(uint8_t)(first >> (shift + 8))]++;
+      tables[2][(uint8_t)(first >> (shift + 16))]++;
+      tables[3][(uint8_t)(first >> (shift + 24))]++;
+      tables[0][(uint8_t)(second >> shift)]++;
+      tables[1][(uint8_t)(second >> (shift + 8))]++;
+      tables[2][(uint8_t)(second >> (shift + 16))]++;
+      tables[3][(uint8_t)(second >> (shift + 24))]++;
+    }
+  }
+  for (; i < size; i++) {
+    tables[0][data[i]]++;
+  }
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    counts[symbol] += (uint64_t)tables[0][symbol] + tables[1][symbol] +
+                      tables[2][symbol] + tables[3][symbol];
+  }
+}
+
+//
+// histogram
+//
+// Function adds the count of every byte value in data to counts, which must
+// hold ALPHABET_SIZE entries
+inline void histogram(const unsigned char *data, size_t size,
+                      uint64_t *counts) {
+  for (size_t start = 0; start < size; start += HISTOGRAM_SLICE_SIZE) {
+    histogramSlice(data + start, std::min(HISTOGRAM_SLICE_SIZE, size - start),
+                   counts);
+  }
+}
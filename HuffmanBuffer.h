@@ -0,0 +1,423 @@
+// Adam Shaar
+// ashaar2
+//
+// HuffmanBuffer.h
+//
+// compression of a buffer in memory into another buffer, for programs that
+// embed the codec and code many small payloads, such as the messages of an
+// RPC layer. Nothing here touches files, threads or prints, everything is in
+// namespace huffman and every function is inline, so any number of source
+// files of a program can include it. A BufferContext holds all the scratch
+// space of a call, so a context that is reused from call to call allocates
+// nothing after it is constructed:
+//
+//   huffman::BufferContext context;
+//   std::vector<unsigned char> packed(huffman::compressBound(size));
+//   size_t packedSize = huffman::compress(data, size, packed.data(),
+//                                         packed.size(), context);
+//   if (packedSize == huffman::BUFFER_ERROR) { report context.error }
+//
+// A context is used by one thread at a time, give every thread its own.
+//
+// a compressed buffer is a single block frame as in blocked .hz files (see
+// BlockFormat.h): the 16-byte block header with the size and CRC-32C of
+// the original data, then the payload of one of these block modes:
+//   BLOCK_RAW           the original data, when coding would not shrink it
+//   BLOCK_OWN_TABLE     the compact code table of the data, then its bitstream
+//   BLOCK_SHARED_TABLE  the bitstream only, coded with a table set on the
+//                       contexts of both sides with setSharedTable
+// Small payloads rarely pay for a table of their own, a shared table trained
+// on typical payloads codes them without one. Codes are at most
+// DEFAULT_MAX_CODE_LENGTH bits, so every code is decoded by a single lookup.
+#pragma once
+
+#include "BlockFormat.h"
+#include "Checksum.h"
+#include "FlatHuffmanTree.h"
+#include "HistogramKernel.h"
+#include "HuffmanCode.h"
+#include "HuffmanDecoder.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+namespace huffman {
+
+// Returned by compress and decompress when they fail
+const size_t BUFFER_ERROR = SIZE_MAX;
+// Bits of a lookup of BufferTable::decode, the longest code it holds
+const int BUFFER_CODE_BITS = DEFAULT_MAX_CODE_LENGTH;
+// Codes a refill of the bit reader always holds
+const int BUFFER_CODES_PER_REFILL = 56 / BUFFER_CODE_BITS;
+
+// BufferTable is a code table in fixed arrays: the code of every byte value
+// for encoding and an entry for every BUFFER_CODE_BITS-bit pattern for
+// decoding, holding the symbol whose code starts the pattern in the low byte
+// and the code length above it, 0 for patterns that start no code.
+struct BufferTable {
+  std::vector<int> codeLengths;
+  uint16_t codes[ALPHABET_SIZE];
+  uint8_t lengths[ALPHABET_SIZE];
+  uint16_t decode[1 << BUFFER_CODE_BITS];
+
+  BufferTable() : codeLengths(ALPHABET_SIZE, 0) {}
+  bool build();
+  void buildDecode();
+};
+
+// BufferContext is the scratch space of compress and decompress, and the
+// shared table of both if there is one.
+struct BufferContext {
+  const char *error; // why the last call failed
+  bool hasSharedTable;
+  BufferTable shared;
+  BufferTable own;
+  std::vector<uint64_t> counts;
+  std::vector<uint64_t> weights;
+  FlatHuffmanTree tree;
+
+  BufferContext() : counts(ALPHABET_SIZE, 0), weights(ALPHABET_SIZE, 0) {
+    error = "";
+    hasSharedTable = false;
+  }
+  bool setSharedTable(const std::vector<int> &codeLengths);
+  void clearSharedTable();
+};
+
+//
+// build
+//
+// Function gives every byte value with a code length its canonical code,
+// returns false if a length is over BUFFER_CODE_BITS or the lengths cannot
+// form a prefix code
+inline bool BufferTable::build() {
+  int lengthCount[BUFFER_CODE_BITS + 1] = {0};
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    if (codeLengths[symbol] < 0 || codeLengths[symbol] > BUFFER_CODE_BITS) {
+      return false;
+    }
+    lengthCount[codeLengths[symbol]]++;
+  }
+  lengthCount[0] = 0;
+  uint32_t nextCode[BUFFER_CODE_BITS + 1] = {0};
+  uint32_t code = 0;
+  for (int length = 1; length <= BUFFER_CODE_BITS; length++) {
+    code = (code + lengthCount[length - 1]) << 1;
+    nextCode[length] = code;
+  }
+  // the last code of the longest length must still fit in its bits
+  if (code + lengthCount[BUFFER_CODE_BITS] > 1u << BUFFER_CODE_BITS) {
+    return false;
+  }
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    int length = codeLengths[symbol];
+    codes[symbol] = length > 0 ? nextCode[length]++ : 0;
+    lengths[symbol] = length;
+  }
+  return true;
+}
+
+//
+// buildDecode
+//
+// Function fills the decode table for the codes found by build
+inline void BufferTable::buildDecode() {
+  std::fill(decode, decode + (1 << BUFFER_CODE_BITS), 0);
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    int length = lengths[symbol];
+    if (length == 0) {
+      continue;
+    }
+    uint32_t first = codes[symbol] << (BUFFER_CODE_BITS - length);
+    uint32_t patterns = 1 << (BUFFER_CODE_BITS - length);
+    std::fill(decode + first, decode + first + patterns, symbol | length << 8);
+  }
+}
+
+//
+// setSharedTable
+//
+// Function makes the table with the given code lengths the shared table of
+// the context, such as one found by optimalCodeLengths with
+// DEFAULT_MAX_CODE_LENGTH on a sample of typical payloads. Buffers coded
+// with it can only be decompressed by a context with the same table. Returns
+// false and keeps no shared table if the lengths are not a prefix code of at
+// most BUFFER_CODE_BITS bits.
+inline bool BufferContext::setSharedTable(const std::vector<int> &codeLengths) {
+  hasSharedTable = false;
+  if (codeLengths.size() != ALPHABET_SIZE) {
+    return false;
+  }
+  std::copy(codeLengths.begin(), codeLengths.end(),
+            shared.codeLengths.begin());
+  if (!shared.build()) {
+    return false;
+  }
+  shared.buildDecode();
+  hasSharedTable = true;
+  return true;
+}
+
+// Drops the shared table, compress then only uses tables of its own.
+inline void BufferContext::clearSharedTable() { hasSharedTable = false; }
+
+// Returns the largest compressed size of size bytes of input, the capacity
+// that compress never fails for.
+inline size_t compressBound(size_t size) { return BLOCK_HEADER_SIZE + size; }
+
+//
+// decompressedSize
+//
+// Function returns the original size of a compressed buffer, read from its
+// block header, or BUFFER_ERROR if the buffer is too short to hold one
+inline size_t decompressedSize(const unsigned char *data, size_t size) {
+  if (size < BLOCK_HEADER_SIZE) {
+    return BUFFER_ERROR;
+  }
+  return parseBlockHeader(data).rawSize;
+}
+
+// Stores the reason a call failed in the context and returns BUFFER_ERROR.
+inline size_t failBuffer(BufferContext &context, const char *error) {
+  context.error = error;
+  return BUFFER_ERROR;
+}
+
+//
+// bufferCodeLengths
+//
+// Function finds the code lengths of the own table for the bytes counted in
+// the context. A Huffman tree deeper than BUFFER_CODE_BITS is built again
+// with the counts halved, which evens them out until it fits: package-merge
+// would find slightly shorter codes but needs memory of its own.
+inline void bufferCodeLengths(BufferContext &context) {
+  std::copy(context.counts.begin(), context.counts.end(),
+            context.weights.begin());
+  context.tree.build(context.weights);
+  while (context.tree.node(context.tree.root()).height > BUFFER_CODE_BITS) {
+    for (uint64_t &weight : context.weights) {
+      weight = weight == 0 ? 0 : weight >> 1 | 1;
+    }
+    context.tree.build(context.weights);
+  }
+  context.tree.codeLengths(context.own.codeLengths);
+}
+
+//
+// encodeWithTable
+//
+// Function writes the code of every byte of data to out, padding the last
+// byte with zeros, and returns the number of bytes written. The caller makes
+// sure every byte has a code and out has room for all of them.
+inline size_t encodeWithTable(const BufferTable &table,
+                              const unsigned char *data, size_t size,
+                              unsigned char *out) {
+  unsigned char *next = out;
+  uint64_t accumulator = 0;
+  int count = 0;
+  for (size_t i = 0; i < size; i++) {
+    // fewer than 32 bits are pending, so no pending bit is shifted out
+    accumulator = accumulator << table.lengths[data[i]] | table.codes[data[i]];
+    count += table.lengths[data[i]];
+    if (count >= 32) {
+      count -= 32;
+      uint32_t word = accumulator >> count;
+      next[0] = word >> 24;
+      next[1] = word >> 16;
+      next[2] = word >> 8;
+      next[3] = word;
+      next += 4;
+    }
+  }
+  while (count >= 8) {
+    count -= 8;
+    *next++ = accumulator >> count;
+  }
+  if (count > 0) {
+    *next++ = accumulator << (8 - count);
+  }
+  return next - out;
+}
+
+//
+// decodeWithTable
+//
+// Function decodes exactly `count` bytes from the bitstream in data into
+// output, returns false if the bitstream ends early or holds an invalid code
+inline bool decodeWithTable(const BufferTable &table,
+                            const unsigned char *data, size_t size,
+                            unsigned char *output, size_t count) {
+  BitReader reader;
+  reader.next = data;
+  reader.end = data + size;
+  size_t i = 0;
+  // while 8 bytes are left a refill holds at least 56 bits
+  while (count - i >= BUFFER_CODES_PER_REFILL &&
+         reader.end - reader.next >= 8) {
+    reader.refill();
+    for (int k = 0; k < BUFFER_CODES_PER_REFILL; k++) {
+      uint16_t entry = table.decode[reader.peek(BUFFER_CODE_BITS)];
+      if (entry == 0) {
+        return false;
+      }
+      reader.consume(entry >> 8);
+      output[i + k] = entry;
+    }
+    i += BUFFER_CODES_PER_REFILL;
+  }
+  for (; i < count; i++) {
+    reader.refill();
+    uint16_t entry = table.decode[reader.peek(BUFFER_CODE_BITS)];
+    if (entry == 0 || (entry >> 8) > reader.count) {
+      return false;
+    }
+    reader.consume(entry >> 8);
+    output[i] = entry;
+  }
+  return true;
+}
+
+//
+// compress
+//
+// Function compresses the `size` bytes of input into output, which holds
+// `capacity` bytes, and returns the compressed size. The data is coded with
+// its own table or the shared table of the context, whichever is smaller,
+// or stored as is if neither makes it smaller. Returns BUFFER_ERROR with the
+// reason in context.error if the input is over 4 GiB or the output is too
+// small, which it never is with compressBound(size) bytes.
+inline size_t compress(const unsigned char *input, size_t size,
+                       unsigned char *output, size_t capacity,
+                       BufferContext &context) {
+  if (size > UINT32_MAX) {
+    return failBuffer(context, "input is larger than 4 GiB");
+  }
+  std::fill(context.counts.begin(), context.counts.end(), 0);
+  histogram(input, size, context.counts.data());
+  uint64_t sharedSize =
+      context.hasSharedTable
+          ? encodedSize(context.counts, context.shared.codeLengths)
+          : UINT64_MAX;
+  // an own table alone takes more than ALPHABET_SIZE / 8 bytes
+  uint64_t ownSize = UINT64_MAX;
+  if (size > ALPHABET_SIZE / 8) {
+    bufferCodeLengths(context);
+    ownSize = compactTableSize(context.own.codeLengths) +
+              encodedSize(context.counts, context.own.codeLengths);
+  }
+
+  BlockHeader header;
+  header.rawSize = size;
+  header.payloadSize = size;
+  if (size <= ownSize && size <= sharedSize) {
+    header.mode = BLOCK_RAW;
+  } else if (sharedSize <= ownSize) {
+    header.mode = BLOCK_SHARED_TABLE;
+    header.payloadSize = sharedSize;
+  } else {
+    header.mode = BLOCK_OWN_TABLE;
+    header.payloadSize = ownSize;
+  }
+  if (capacity < BLOCK_HEADER_SIZE + header.payloadSize) {
+    return failBuffer(context, "output buffer is too small");
+  }
+  header.checksum = crc32c(0, input, size);
+  serializeBlockHeader(header, output);
+
+  unsigned char *payload = output + BLOCK_HEADER_SIZE;
+  if (header.mode == BLOCK_RAW) {
+    std::copy(input, input + size, payload);
+  } else if (header.mode == BLOCK_SHARED_TABLE) {
+    encodeWithTable(context.shared, input, size, payload);
+  } else {
+    context.own.build();
+    size_t used = packCodeLengths(context.own.codeLengths, payload);
+    encodeWithTable(context.own, input, size, payload + used);
+  }
+  return BLOCK_HEADER_SIZE + header.payloadSize;
+}
+
+//
+// decompress
+//
+// Function decompresses the `size` bytes of a buffer written by compress
+// into output, which holds `capacity` bytes, and returns the original size.
+// Returns BUFFER_ERROR with the reason in context.error if the buffer is
+// damaged, needs a shared table the context does not have or does not fit in
+// the output (see decompressedSize).
+inline size_t decompress(const unsigned char *input, size_t size,
+                         unsigned char *output, size_t capacity,
+                         BufferContext &context) {
+  if (size < BLOCK_HEADER_SIZE) {
+    return failBuffer(context, "block header is truncated");
+  }
+  BlockHeader header = parseBlockHeader(input);
+  if (header.payloadSize != size - BLOCK_HEADER_SIZE) {
+    return failBuffer(context, "block size does not match the buffer");
+  }
+  if (header.rawSize > capacity) {
+    return failBuffer(context, "output buffer is too small");
+  }
+  const unsigned char *payload = input + BLOCK_HEADER_SIZE;
+  size_t payloadSize = header.payloadSize;
+  const BufferTable *table = nullptr;
+  if (header.mode == BLOCK_RAW) {
+    if (payloadSize != header.rawSize) {
+      return failBuffer(context, "raw block has the wrong size");
+    }
+    std::copy(payload, payload + payloadSize, output);
+  } else if (header.mode == BLOCK_SHARED_TABLE) {
+    if (!context.hasSharedTable) {
+      return failBuffer(context, "block needs a shared table the context "
+                                 "does not have");
+    }
+    table = &context.shared;
+  } else if (header.mode == BLOCK_OWN_TABLE) {
+    size_t used;
+    if (!unpackCodeLengths(payload, payloadSize,
+                           context.own.codeLengths.data(), used) ||
+        !context.own.build()) {
+      return failBuffer(context, "invalid block code table");
+    }
+    context.own.buildDecode();
+    table = &context.own;
+    payload += used;
+    payloadSize -= used;
+  } else {
+    return failBuffer(context, "unknown block mode");
+  }
+  if (table != nullptr && !decodeWithTable(*table, payload, payloadSize,
+                                           output, header.rawSize)) {
+    return failBuffer(context, "compressed data is truncated or corrupt");
+  }
+  if (crc32c(0, output, header.rawSize) != header.checksum) {
+    return failBuffer(context, "block checksum mismatch");
+  }
+  return header.rawSize;
+}
+
+#if __cplusplus >= 202002L
+// Compresses input into output, see compress above.
+inline size_t compress(std::span<const uint8_t> input,
+                       std::span<uint8_t> output, BufferContext &context) {
+  return compress(input.data(), input.size(), output.data(), output.size(),
+                  context);
+}
+
+// Decompresses input into output, see decompress above.
+inline size_t decompress(std::span<const uint8_t> input,
+                         std::span<uint8_t> output, BufferContext &context) {
+  return decompress(input.data(), input.size(), output.data(), output.size(),
+                    context);
+}
+
+// Returns the original size of a compressed buffer, see decompressedSize.
+inline size_t decompressedSize(std::span<const uint8_t> input) {
+  return decompressedSize(input.data(), input.size());
+}
+#endif
+
+} // namespace huffman
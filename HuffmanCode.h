@@ -0,0 +1,319 @@
+// Adam Shaar
+// ashaar2
+//
+// HuffmanCode.h
+//
+// integer representation of Huffman codes shared by the encoder and decoder
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Number of symbols in the alphabet, one for every byte value
+const int ALPHABET_SIZE = 256;
+// Longest code that fits in the 64-bit code representation
+const int MAX_CODE_LENGTH = 64;
+// Default limit for canonical codes, codes this short are always resolved by
+// a single lookup in the decoder's primary table
+const int DEFAULT_MAX_CODE_LENGTH = 11;
+// Most bitstreams a block can be interleaved into, see encodeInterleaved
+const int MAX_INTERLEAVED_STREAMS = 8;
+// Largest compact form of a code table (see appendCodeLengths): a bitmap of
+// the byte values with a code, then a nibble for each of them
+const size_t COMPACT_TABLE_MAX_SIZE = ALPHABET_SIZE / 8 + ALPHABET_SIZE / 2;
+
+// HuffmanCode stores a code as an integer (first bit is the most significant)
+// together with its length in bits. A length of 0 means the symbol has no code.
+struct HuffmanCode {
+  uint64_t bits;
+  int length;
+
+  HuffmanCode() {
+    bits = 0;
+    length = 0;
+  }
+
+  HuffmanCode(uint64_t b, int l) {
+    bits = b;
+    length = l;
+  }
+};
+
+//
+// codesFromStrings
+//
+// Function converts the "0"/"1" code strings used by the .hi files into
+// integer codes, returns false if a code is malformed. Codes longer than
+// MAX_CODE_LENGTH are rejected unless allowLong is set, in which case they
+// keep their length but not their bits.
+inline bool codesFromStrings(const std::vector<std::string> &huffmanCodes,
+                             std::vector<HuffmanCode> &codes,
+                             bool allowLong = false) {
+  codes.assign(huffmanCodes.size(), HuffmanCode());
+  for (size_t i = 0; i < huffmanCodes.size(); ++i) {
+    const std::string &code = huffmanCodes[i];
+    if (code.size() > MAX_CODE_LENGTH && !allowLong) {
+      std::cout << "Error: Huffman code longer than " << MAX_CODE_LENGTH
+                << " bits" << std::endl;
+      return false;
+    }
+    uint64_t bits = 0;
+    for (const char c : code) {
+      if (c != '0' && c != '1') {
+        std::cout << "Invalid character in Huffman code" << std::endl;
+        return false;
+      }
+      bits = (bits << 1) | (c == '1');
+    }
+    codes[i] = HuffmanCode(bits, code.size());
+  }
+  return true;
+}
+
+//
+// codeString
+//
+// Function returns the "0"/"1" string form of an integer code
+inline std::string codeString(const HuffmanCode &code) {
+  std::string result;
+  for (int i = code.length - 1; i >= 0; --i) {
+    result += ((code.bits >> i) & 1) ? '1' : '0';
+  }
+  return result;
+}
+
+//
+// assignCanonicalCodes
+//
+// Function gives every symbol with a nonzero code length its canonical code:
+// shorter codes come first and codes of equal length count up in symbol
+// order, so the lengths alone describe the whole code. Returns false if the
+// lengths cannot form a prefix code.
+inline bool assignCanonicalCodes(const std::vector<int> &lengths,
+                                 std::vector<HuffmanCode> &codes) {
+  std::vector<int> lengthCount(MAX_CODE_LENGTH + 1, 0);
+  for (int length : lengths) {
+    if (length < 0 || length > MAX_CODE_LENGTH) {
+      return false;
+    }
+    lengthCount[length]++;
+  }
+  lengthCount[0] = 0;
+
+  // Find the first code of every length, checking that no length runs out
+  // of codes (left is capped since it can only shrink by the symbol count)
+  std::vector<uint64_t> nextCode(MAX_CODE_LENGTH + 1, 0);
+  uint64_t code = 0;
+  int64_t left = 1;
+  for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+    code = (code + lengthCount[length - 1]) << 1;
+    nextCode[length] = code;
+    left = std::min<int64_t>(left * 2, 1 << 20) - lengthCount[length];
+    if (left < 0) {
+      return false;
+    }
+  }
+
+  codes.assign(lengths.size(), HuffmanCode());
+  for (size_t symbol = 0; symbol < lengths.size(); symbol++) {
+    if (lengths[symbol] > 0) {
+      codes[symbol] =
+          HuffmanCode(nextCode[lengths[symbol]]++, lengths[symbol]);
+    }
+  }
+  return true;
+}
+
+//
+// compactTableSize
+//
+// Function returns the number of bytes the compact form of a code table takes
+inline size_t compactTableSize(const std::vector<int> &codeLengths) {
+  int present = 0;
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    present += codeLengths[i] > 0;
+  }
+  return ALPHABET_SIZE / 8 + (present + 1) / 2;
+}
+
+//
+// packCodeLengths
+//
+// Function writes the compact form of a code table to out, which must have
+// room for COMPACT_TABLE_MAX_SIZE bytes, and returns the number of bytes
+// written
+inline size_t packCodeLengths(const std::vector<int> &codeLengths,
+                              unsigned char *out) {
+  std::fill(out, out + ALPHABET_SIZE / 8, 0);
+  size_t size = ALPHABET_SIZE / 8;
+  int present = 0;
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    if (codeLengths[i] > 0) {
+      out[i / 8] |= 1 << (i % 8);
+      if (present++ % 2 == 0) {
+        out[size++] = codeLengths[i] << 4;
+      } else {
+        out[size - 1] |= codeLengths[i];
+      }
+    }
+  }
+  return size;
+}
+
+//
+// appendCodeLengths
+//
+// Function appends the compact form of a code table, as stored in blocks,
+// table caches and context models, to out
+inline void appendCodeLengths(const std::vector<int> &codeLengths,
+                              std::vector<unsigned char> &out) {
+  size_t start = out.size();
+  out.resize(start + COMPACT_TABLE_MAX_SIZE);
+  out.resize(start + packCodeLengths(codeLengths, out.data() + start));
+}
+
+//
+// unpackCodeLengths
+//
+// Function reads a code table in compact form from data into codeLengths,
+// which must hold ALPHABET_SIZE entries, storing the number of bytes it takes
+// in used. Returns false if it does not fit; whether the lengths form a
+// prefix code is left to the caller.
+inline bool unpackCodeLengths(const unsigned char *data, size_t size,
+                              int *codeLengths, size_t &used) {
+  if (size < ALPHABET_SIZE / 8) {
+    return false;
+  }
+  int present = 0;
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    present += (data[i / 8] >> (i % 8)) & 1;
+  }
+  used = ALPHABET_SIZE / 8 + (present + 1) / 2;
+  if (size < used) {
+    return false;
+  }
+  int index = 0;
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    codeLengths[i] = 0;
+    if ((data[i / 8] >> (i % 8)) & 1) {
+      unsigned char packed = data[ALPHABET_SIZE / 8 + index / 2];
+      codeLengths[i] = index % 2 == 0 ? packed >> 4 : packed & 0xF;
+      if (codeLengths[i] == 0) {
+        return false;
+      }
+      index++;
+    }
+  }
+  return true;
+}
+
+//
+// parseCodeLengths
+//
+// Function reads a code table in compact form from data, storing the number
+// of bytes it takes in used, returns false if it does not fit or is not a
+// prefix code
+inline bool parseCodeLengths(const unsigned char *data, size_t size,
+                             std::vector<int> &codeLengths, size_t &used) {
+  codeLengths.assign(ALPHABET_SIZE, 0);
+  if (!unpackCodeLengths(data, size, codeLengths.data(), used)) {
+    return false;
+  }
+  std::vector<HuffmanCode> codes;
+  return assignCanonicalCodes(codeLengths, codes);
+}
+
+//
+// limitedCodeLengths
+//
+// Function finds optimal code lengths for the given frequencies with no code
+// longer than maxLength bits, using the package-merge algorithm. Symbols with
+// a frequency of 0 get no code. Returns false if maxLength is too small to
+// give every occurring symbol a code.
+inline bool limitedCodeLengths(const std::vector<uint64_t> &frequencies,
+                               int maxLength, std::vector<int> &lengths) {
+  // Item is a coin of the package-merge algorithm, either a single symbol or
+  // a package of two items from the list of the level below
+  struct Item {
+    uint64_t weight;
+    int symbol;
+    int left;
+  };
+
+  lengths.assign(frequencies.size(), 0);
+  std::vector<Item> leaves;
+  int symbols = frequencies.size();
+  for (int symbol = 0; symbol < symbols; symbol++) {
+    if (frequencies[symbol] > 0) {
+      leaves.push_back(Item{frequencies[symbol], symbol, -1});
+    }
+  }
+  int n = leaves.size();
+  if (n == 0) {
+    return true;
+  }
+  if (n == 1) {
+    lengths[leaves[0].symbol] = 1;
+    return true;
+  }
+  if (maxLength > MAX_CODE_LENGTH) {
+    maxLength = MAX_CODE_LENGTH;
+  }
+  if (((uint64_t)1 << std::min(maxLength, 63)) < (uint64_t)n) {
+    return false;
+  }
+  // no Huffman code is deeper than n - 1, so more levels change nothing
+  int levels = std::min(maxLength, n - 1);
+  std::stable_sort(leaves.begin(), leaves.end(),
+                   [](const Item &a, const Item &b) {
+                     return a.weight < b.weight;
+                   });
+
+  // Build the list of every level by merging the leaves with the packages
+  // of adjacent pairs of the level below, keeping at most 2n - 2 items
+  size_t listSize = 2 * n - 2;
+  std::vector<std::vector<Item>> lists(levels);
+  lists[0] = leaves;
+  for (int level = 1; level < levels; level++) {
+    const std::vector<Item> &below = lists[level - 1];
+    std::vector<Item> &list = lists[level];
+    int belowSize = below.size();
+    int leaf = 0;
+    int pair = 0;
+    while (list.size() < listSize && (leaf < n || pair + 1 < belowSize)) {
+      bool havePackage = pair + 1 < belowSize;
+      uint64_t packageWeight =
+          havePackage ? below[pair].weight + below[pair + 1].weight : 0;
+      if (leaf < n && (!havePackage || leaves[leaf].weight <= packageWeight)) {
+        list.push_back(leaves[leaf++]);
+      } else {
+        list.push_back(Item{packageWeight, -1, pair});
+        pair += 2;
+      }
+    }
+  }
+
+  if (lists[levels - 1].size() < listSize) {
+    return false;
+  }
+
+  // Every time a symbol is part of a selected item its code gets a bit
+  // longer. The selected items of each level are always a prefix of its list.
+  int selected = 2 * n - 2;
+  for (int level = levels - 1; level >= 0; level--) {
+    int selectedBelow = 0;
+    for (int i = 0; i < selected; i++) {
+      const Item &item = lists[level][i];
+      if (item.symbol >= 0) {
+        lengths[item.symbol]++;
+      } else {
+        selectedBelow = item.left + 2;
+      }
+    }
+    selected = selectedBelow;
+  }
+  return true;
+}
@@ -0,0 +1,2171 @@
+// Adam Shaar
+// ashaar2
+//
+// HuffmanContainer.h
+//
+// self-contained compressed file format (.hz) that carries its own canonical
+// code table, the original size and a checksum of the original data
+//
+// layout (all integers little-endian):
+//   4 bytes   magic "HUFZ"
+//   1 byte    format version
+//   1 byte    flags
+//   1 byte    streams per block with CONTAINER_INTERLEAVED, otherwise 0
+//   1 byte    reserved, 0
+//   8 bytes   original size in bytes
+//   4 bytes   CRC-32C of the original data
+//   256 bytes code length of every byte value, 0 if the byte does not occur
+//   ...       canonical Huffman bitstream, last byte padded with zeros
+//
+// with the CONTAINER_BLOCKED flag the bitstream is replaced by independent
+// blocks that can be encoded and decoded in parallel:
+//   4 bytes   block size, every block but the last holds this many bytes
+//   ...       one frame per block: 16-byte block header, then its bitstream
+//   16 bytes  end frame, a block header with mode BLOCK_END
+//   ...       block index, 8-byte file offset of every frame
+//   16 bytes  footer: 4-byte block count, 8-byte index offset, magic "HZIX"
+// and the checksum field holds the CRC-32C of the block checksums in order.
+// With the CONTAINER_INTERLEAVED flag as well the codes of every coded block
+// take turns between several bitstreams, which a decoder can decode side by
+// side (see the block layout below).
+// With the CONTAINER_ADAPTIVE flag as well the header has no code table and
+// every block picks its own coding, see the block modes below.
+// Streams written without seeking (see StreamEncoder below and
+// StreamPipeline.h) set CONTAINER_STREAMED too. Their header holds 0 for the
+// size and checksum, and the end frame is followed by a stream footer instead
+// of a block index:
+//   8 bytes   original size in bytes
+//   4 bytes   CRC-32C of the block checksums in order
+//   4 bytes   magic "HZST"
+//
+// with the CONTAINER_TABLE_ID flag the header refers to a table of a table
+// cache (see TableCache.h) instead of holding one, which suits many small
+// files of the same kind. Such files are never blocked:
+//   4 bytes   magic "HUFZ"
+//   1 byte    format version
+//   1 byte    flags
+//   2 bytes   reserved, 0
+//   8 bytes   original size in bytes
+//   4 bytes   CRC-32C of the original data
+//   4 bytes   table ID
+//   ...       canonical Huffman bitstream, last byte padded with zeros
+//
+// with the CONTAINER_CONTEXT flag every byte is coded with the table of the
+// byte before it (see ContextModel.h). The header ends after the checksum,
+// the context model follows it and then the bitstream. Such files are never
+// blocked either.
+//
+// with the CONTAINER_RUN_LENGTH flag the bitstream codes the run-length form
+// of the original data (see RunLength.h) instead of the data itself; the
+// size and checksum are still those of the original data. Such files are
+// single stream files with a table in the header.
+//
+// The block index makes blocked files seekable: block i starts at byte
+// i * block size of the original data, so any range can be decoded from the
+// blocks that hold it (see readRange).
+//
+// the block header and the code table of BLOCK_OWN_TABLE blocks are laid out
+// as in BlockFormat.h. In interleaved files the bitstream of a coded block is
+// split into N streams, byte i of the block coded in stream i % N:
+//   4 bytes   size of each of the first N - 1 streams
+//   ...       the N streams one after the other, each padded with zeros
+#pragma once
+
+#include "BlockFormat.h"
+#include "Checksum.h"
+#include "CodecStats.h"
+#include "ContextModel.h"
+#include "FlatHuffmanTree.h"
+#include "Histogram.h"
+#include "HuffmanCode.h"
+#include "HuffmanDecoder.h"
+#include "HuffmanEncoder.h"
+#include "MappedFile.h"
+#include "RunLength.h"
+#include "StreamPipeline.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+const unsigned char CONTAINER_MAGIC[4] = {'H', 'U', 'F', 'Z'};
+const int CONTAINER_VERSION = 1;
+const size_t CONTAINER_HEADER_SIZE = 16 + 4 + ALPHABET_SIZE;
+// Size of the header of a file that refers to a cached table
+const size_t CONTAINER_TABLE_HEADER_SIZE = 16 + 4 + 4;
+// Size of the header of a file with context tables, which follow it
+const size_t CONTAINER_CONTEXT_HEADER_SIZE = 16 + 4;
+
+// Header flags
+const int CONTAINER_BLOCKED = 1;
+const int CONTAINER_ADAPTIVE = 2;
+const int CONTAINER_STREAMED = 4;
+const int CONTAINER_TABLE_ID = 8;
+const int CONTAINER_INTERLEAVED = 16;
+const int CONTAINER_CONTEXT = 32;
+const int CONTAINER_RUN_LENGTH = 64;
+// Largest share by which a table trained on a sample may make the coded data
+// of a file larger than a table of the whole file would
+const double SAMPLE_MAX_LOSS = 0.01;
+// Code length limit of tables trained on a sample, long enough that the codes
+// of bytes the sample missed take next to no room from the others
+const int SAMPLE_MAX_CODE_LENGTH = 16;
+
+const unsigned char INDEX_MAGIC[4] = {'H', 'Z', 'I', 'X'};
+const unsigned char STREAM_MAGIC[4] = {'H', 'Z', 'S', 'T'};
+const size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+const size_t CONTAINER_FOOTER_SIZE = 16;
+
+// ContainerHeader holds the fields of a .hz file header.
+struct ContainerHeader {
+  int version;
+  int flags;
+  uint64_t originalSize;
+  uint32_t checksum;
+  std::vector<int> codeLengths;
+  uint32_t tableId;
+  int streams; // bitstreams per coded block
+
+  ContainerHeader() : codeLengths(ALPHABET_SIZE, 0) {
+    version = CONTAINER_VERSION;
+    flags = 0;
+    originalSize = 0;
+    checksum = 0;
+    tableId = 0;
+    streams = 1;
+  }
+};
+
+// TableLookup returns the decoder of a cached table by its ID, or null if
+// there is no such table.
+typedef std::function<const HuffmanDecoder *(uint32_t)> TableLookup;
+
+// BlockPlan is the coding chosen for one block before it is encoded.
+struct BlockPlan {
+  int mode;
+  uint32_t tableDistance; // blocks back to the table a block reuses
+  std::vector<uint64_t> counts;
+  std::vector<int> codeLengths;
+  std::shared_ptr<const HuffmanEncoder> encoder;
+};
+
+// CodecResult reports the outcome of a compress or decompress call without
+// printing anything, so callers decide how to present it. The statistics of
+// a call that failed are incomplete.
+struct CodecResult {
+  bool ok;
+  std::string error;
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+  CodecStats stats;
+
+  CodecResult() {
+    ok = false;
+    bytesIn = 0;
+    bytesOut = 0;
+  }
+};
+
+//
+// mergeOuterStats
+//
+// Function adds the statistics of the work done around a nested call, such
+// as counting the input before compressToContainer, to the nested call's
+// result. The wall time then runs from the start of the outer call.
+inline void mergeOuterStats(const CodecStats &outer, CodecResult &result) {
+  CodecStats stats = outer;
+  stats.merge(result.stats);
+  result.stats = stats;
+  result.stats.finish();
+}
+
+//
+// codecResultJson
+//
+// Function returns the result and statistics of a call as a JSON object on
+// one line
+inline std::string codecResultJson(const std::string &operation,
+                                   const std::string &input,
+                                   const std::string &output,
+                                   const CodecResult &result) {
+  return "{\"operation\":" + jsonString(operation) +
+         ",\"input\":" + jsonString(input) +
+         ",\"output\":" + jsonString(output) +
+         ",\"ok\":" + (result.ok ? "true" : "false") +
+         ",\"error\":" + jsonString(result.error) +
+         ",\"bytes_in\":" + std::to_string(result.bytesIn) +
+         ",\"bytes_out\":" + std::to_string(result.bytesOut) + "," +
+         result.stats.json() + "}";
+}
+
+// Returns the size of the header of a file with the given flags.
+inline size_t containerHeaderSize(int flags) {
+  if (flags & CONTAINER_CONTEXT) {
+    return CONTAINER_CONTEXT_HEADER_SIZE;
+  }
+  return flags & CONTAINER_TABLE_ID ? CONTAINER_TABLE_HEADER_SIZE
+                                    : CONTAINER_HEADER_SIZE;
+}
+
+// Returns a table ID as it is shown to users, in hexadecimal.
+inline std::string tableIdString(uint32_t id) {
+  char text[16];
+  std::snprintf(text, sizeof(text), "%08x", id);
+  return text;
+}
+
+//
+// serializeContainerHeader
+//
+// Function writes the header into the containerHeaderSize(header.flags)
+// bytes at out
+inline void serializeContainerHeader(const ContainerHeader &header,
+                                     unsigned char *out) {
+  std::copy(CONTAINER_MAGIC, CONTAINER_MAGIC + 4, out);
+  out[4] = header.version;
+  out[5] = header.flags;
+  out[6] = header.flags & CONTAINER_INTERLEAVED ? header.streams : 0;
+  out[7] = 0;
+  putLittleEndian(out + 8, header.originalSize, 8);
+  putLittleEndian(out + 16, header.checksum, 4);
+  if (header.flags & CONTAINER_TABLE_ID) {
+    putLittleEndian(out + 20, header.tableId, 4);
+    return;
+  }
+  if (header.flags & CONTAINER_CONTEXT) {
+    return;
+  }
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    out[20 + i] = header.codeLengths[i];
+  }
+}
+
+//
+// parseContainerHeader
+//
+// Function reads and validates the header at the start of data, returns false
+// with a message in error if it is not a usable .hz header
+inline bool parseContainerHeader(const unsigned char *data, size_t size,
+                                 ContainerHeader &header, std::string &error) {
+  if (size < CONTAINER_CONTEXT_HEADER_SIZE ||
+      !std::equal(CONTAINER_MAGIC, CONTAINER_MAGIC + 4, data) ||
+      size < containerHeaderSize(data[5])) {
+    error = "not a compressed .hz file";
+    return false;
+  }
+  header.version = data[4];
+  header.flags = data[5];
+  if (header.version != CONTAINER_VERSION) {
+    error = "unsupported .hz version " + std::to_string(header.version);
+    return false;
+  }
+  if (((header.flags & (CONTAINER_TABLE_ID | CONTAINER_CONTEXT)) &&
+       (header.flags & CONTAINER_BLOCKED)) ||
+      ((header.flags & CONTAINER_TABLE_ID) &&
+       (header.flags & CONTAINER_CONTEXT)) ||
+      ((header.flags & CONTAINER_INTERLEAVED) &&
+       !(header.flags & CONTAINER_BLOCKED)) ||
+      ((header.flags & CONTAINER_RUN_LENGTH) &&
+       (header.flags & ~CONTAINER_RUN_LENGTH))) {
+    error = "unsupported .hz flags " + std::to_string(header.flags);
+    return false;
+  }
+  header.streams = header.flags & CONTAINER_INTERLEAVED ? data[6] : 1;
+  if (header.streams < 1 || header.streams > MAX_INTERLEAVED_STREAMS) {
+    error = "unsupported number of streams " + std::to_string(header.streams);
+    return false;
+  }
+  header.originalSize = getLittleEndian(data + 8, 8);
+  header.checksum = getLittleEndian(data + 16, 4);
+  header.codeLengths.assign(ALPHABET_SIZE, 0);
+  header.tableId = 0;
+  if (header.flags & CONTAINER_TABLE_ID) {
+    header.tableId = getLittleEndian(data + 20, 4);
+  } else if (!(header.flags & CONTAINER_CONTEXT)) {
+    header.codeLengths.assign(data + 20, data + 20 + ALPHABET_SIZE);
+  }
+  return true;
+}
+
+//
+// planAdaptiveBlock
+//
+// Function counts the bytes of a block and finds the code lengths of its own
+// table, this part of the planning is independent of the other blocks. The
+// lengths stay within DEFAULT_MAX_CODE_LENGTH so they fit in a nibble.
+inline void planAdaptiveBlock(const unsigned char *data, size_t size,
+                              BlockPlan &plan, CodecStats *stats = nullptr) {
+  StageClock clock(stats);
+  plan.counts.assign(ALPHABET_SIZE, 0);
+  histogram(data, size, plan.counts.data());
+  clock.lap(STAGE_HISTOGRAM);
+  optimalCodeLengths(plan.counts, DEFAULT_MAX_CODE_LENGTH, plan.codeLengths);
+  clock.lap(STAGE_TREE);
+  if (stats != nullptr) {
+    stats->addEntropy(plan.counts);
+  }
+}
+
+//
+// chooseBlockMode
+//
+// Function picks the smallest of storing the block raw, reusing the previous
+// table and storing a table of its own, and updates the previous table when
+// the block stores one. previousDistance counts the blocks since the block
+// of the previous table. Blocks have to be chosen in file order.
+inline void
+chooseBlockMode(BlockPlan &plan, size_t size, std::vector<int> &previousLengths,
+                std::shared_ptr<const HuffmanEncoder> &previousEncoder,
+                uint64_t &previousDistance, CodecStats *stats = nullptr) {
+  StageClock clock(stats);
+  previousDistance++;
+  plan.tableDistance = 0;
+  uint64_t ownSize = compactTableSize(plan.codeLengths) +
+                     encodedSize(plan.counts, plan.codeLengths);
+  uint64_t previousSize = previousEncoder == nullptr
+                              ? UINT64_MAX
+                              : encodedSize(plan.counts, previousLengths);
+
+  if (size <= ownSize && size <= previousSize) {
+    plan.mode = BLOCK_RAW;
+    plan.encoder = nullptr;
+  } else if (previousSize <= ownSize) {
+    plan.mode = BLOCK_PREVIOUS_TABLE;
+    plan.encoder = previousEncoder;
+    if (previousDistance <= MAX_TABLE_DISTANCE) {
+      plan.tableDistance = previousDistance;
+    }
+  } else {
+    plan.mode = BLOCK_OWN_TABLE;
+    std::vector<HuffmanCode> codes;
+    std::shared_ptr<HuffmanEncoder> encoder(new HuffmanEncoder());
+    assignCanonicalCodes(plan.codeLengths, codes);
+    encoder->build(codes);
+    plan.encoder = encoder;
+    previousLengths = plan.codeLengths;
+    previousEncoder = encoder;
+    previousDistance = 0;
+    if (stats != nullptr) {
+      stats->addCodeLengths(plan.codeLengths);
+    }
+  }
+  clock.lap(STAGE_TABLES);
+}
+
+//
+// encodeContainerBlock
+//
+// Function replaces frame with the block header and contents of one block
+// coded as planned in `streams` interleaved bitstreams, storing it raw if
+// coding would not make it smaller
+inline void encodeContainerBlock(const BlockPlan &plan,
+                                 const unsigned char *data, size_t size,
+                                 std::vector<unsigned char> &frame, int streams,
+                                 CodecStats *stats = nullptr) {
+  StageClock clock(stats);
+  BlockHeader header;
+  header.mode = plan.mode;
+  header.tableDistance =
+      plan.mode == BLOCK_PREVIOUS_TABLE ? plan.tableDistance : 0;
+  header.rawSize = size;
+  header.checksum = crc32c(0, data, size);
+  clock.lap(STAGE_CHECKSUM);
+
+  frame.assign(BLOCK_HEADER_SIZE, 0);
+  uint64_t codedBytes = 0;
+  if (plan.mode != BLOCK_RAW) {
+    if (plan.mode == BLOCK_OWN_TABLE) {
+      appendCodeLengths(plan.codeLengths, frame);
+    }
+    if (streams > 1) {
+      std::vector<std::vector<unsigned char>> coded(streams);
+      plan.encoder->encodeInterleaved(data, size, coded);
+      size_t sizes = frame.size();
+      frame.resize(sizes + (streams - 1) * 4);
+      for (int k = 0; k < streams; k++) {
+        if (k < streams - 1) {
+          putLittleEndian(frame.data() + sizes + k * 4, coded[k].size(), 4);
+        }
+        frame.insert(frame.end(), coded[k].begin(), coded[k].end());
+        codedBytes += coded[k].size();
+      }
+    } else {
+      BitWriter writer(frame);
+      plan.encoder->encodeBlock(data, size, writer);
+      writer.flush();
+      codedBytes = writer.bytesWritten();
+    }
+  }
+  // Shared table blocks are not planned on size, so they still fall back to
+  // raw storage here if coding made them larger
+  if (plan.mode == BLOCK_RAW || frame.size() > BLOCK_HEADER_SIZE + size) {
+    header.mode = BLOCK_RAW;
+    header.tableDistance = 0;
+    frame.resize(BLOCK_HEADER_SIZE);
+    frame.insert(frame.end(), data, data + size);
+  }
+  header.payloadSize = frame.size() - BLOCK_HEADER_SIZE;
+  serializeBlockHeader(header, frame.data());
+  clock.lap(STAGE_ENCODE);
+  if (stats != nullptr) {
+    stats->symbols += size;
+    stats->codeBits += (header.mode == BLOCK_RAW ? size : codedBytes) * 8;
+  }
+}
+
+//
+// blockTableDecoder
+//
+// Function returns the decoder for a block, building it from the block's own
+// table or taking the header's or previous table's, with null for raw blocks.
+// Blocks have to be visited in file order to keep track of the previous
+// table.
+inline bool
+blockTableDecoder(const unsigned char *frame, size_t available,
+                  const std::shared_ptr<const HuffmanDecoder> &shared,
+                  std::shared_ptr<const HuffmanDecoder> &previous,
+                  std::shared_ptr<const HuffmanDecoder> &decoder,
+                  std::string &error) {
+  if (available < BLOCK_HEADER_SIZE) {
+    error = "block header is truncated";
+    return false;
+  }
+  BlockHeader header = parseBlockHeader(frame);
+  decoder = nullptr;
+  if (header.mode == BLOCK_SHARED_TABLE) {
+    decoder = shared;
+  } else if (header.mode == BLOCK_PREVIOUS_TABLE) {
+    decoder = previous;
+  } else if (header.mode == BLOCK_OWN_TABLE) {
+    std::vector<int> codeLengths;
+    std::vector<HuffmanCode> codes;
+    size_t used;
+    std::shared_ptr<HuffmanDecoder> own(new HuffmanDecoder());
+    if (!parseCodeLengths(frame + BLOCK_HEADER_SIZE,
+                          std::min<size_t>(header.payloadSize,
+                                           available - BLOCK_HEADER_SIZE),
+                          codeLengths, used) ||
+        !assignCanonicalCodes(codeLengths, codes) || !own->build(codes)) {
+      error = "invalid block code table";
+      return false;
+    }
+    decoder = own;
+    previous = own;
+  } else if (header.mode != BLOCK_RAW) {
+    error = "unknown block mode " + std::to_string(header.mode);
+    return false;
+  }
+  if (decoder == nullptr && header.mode != BLOCK_RAW && header.rawSize > 0) {
+    error = "block refers to a code table that does not exist";
+    return false;
+  }
+  return true;
+}
+
+//
+// splitStreams
+//
+// Function finds the interleaved bitstreams of a coded block in its payload,
+// returns false if their sizes do not add up to it
+inline bool splitStreams(const unsigned char *payload, size_t size, int streams,
+                         const unsigned char **starts, size_t *sizes) {
+  size_t used = (streams - 1) * 4;
+  if (size < used) {
+    return false;
+  }
+  for (int k = 0; k < streams; k++) {
+    starts[k] = payload + used;
+    sizes[k] = k < streams - 1 ? getLittleEndian(payload + k * 4, 4)
+                               : size - used;
+    if (sizes[k] > size - used) {
+      return false;
+    }
+    used += sizes[k];
+  }
+  return true;
+}
+
+//
+// decodeContainerBlock
+//
+// Function decodes the frame of one block, which must fit in the `available`
+// bytes at frame and hold exactly `expectedSize` original bytes in `streams`
+// interleaved bitstreams, into output using the decoder found by
+// blockTableDecoder
+inline bool decodeContainerBlock(const HuffmanDecoder *decoder,
+                                 const unsigned char *frame, size_t available,
+                                 unsigned char *output, size_t expectedSize,
+                                 int streams, std::string &error,
+                                 CodecStats *stats = nullptr) {
+  StageClock clock(stats);
+  if (available < BLOCK_HEADER_SIZE) {
+    error = "block header is truncated";
+    return false;
+  }
+  BlockHeader header = parseBlockHeader(frame);
+  if (header.payloadSize > available - BLOCK_HEADER_SIZE) {
+    error = "block is truncated";
+    return false;
+  }
+  if (header.rawSize != expectedSize) {
+    error = "block size does not match the block index";
+    return false;
+  }
+  const unsigned char *payload = frame + BLOCK_HEADER_SIZE;
+  size_t payloadSize = header.payloadSize;
+  if (header.mode == BLOCK_RAW) {
+    if (payloadSize != header.rawSize) {
+      error = "raw block has the wrong size";
+      return false;
+    }
+    std::copy(payload, payload + payloadSize, output);
+  } else {
+    if (header.mode == BLOCK_OWN_TABLE) {
+      // the table was already read by blockTableDecoder, skip over it
+      std::vector<int> codeLengths;
+      size_t used;
+      parseCodeLengths(payload, payloadSize, codeLengths, used);
+      payload += used;
+      payloadSize -= used;
+    }
+    const unsigned char *starts[MAX_INTERLEAVED_STREAMS] = {payload};
+    size_t sizes[MAX_INTERLEAVED_STREAMS] = {payloadSize};
+    if (streams > 1 && !splitStreams(payload, payloadSize, streams, starts,
+                                     sizes)) {
+      error = "stream sizes do not match the block";
+      return false;
+    }
+    if (header.rawSize > 0 &&
+        (decoder == nullptr ||
+         !decoder->decodeInterleaved(starts, sizes, streams, output,
+                                     header.rawSize))) {
+      error = "compressed data is truncated or corrupt";
+      return false;
+    }
+  }
+  clock.lap(STAGE_DECODE);
+  if (crc32c(0, output, header.rawSize) != header.checksum) {
+    error = "block checksum mismatch";
+    return false;
+  }
+  clock.lap(STAGE_CHECKSUM);
+  if (stats != nullptr) {
+    stats->symbols += header.rawSize;
+    stats->codeBits += (uint64_t)payloadSize * 8;
+    if (decoder != nullptr && header.mode != BLOCK_RAW) {
+      stats->maxCodeLength =
+          std::max(stats->maxCodeLength, decoder->maxCodeLength());
+    }
+  }
+  return true;
+}
+
+// StreamEncoder compresses data handed to it in pieces of any size into a
+// streamed .hz file, holding at most one block of input and the frames of
+// about one block of output at a time. Input is only accepted once the
+// output so far has been pulled, so callers alternate push and pull:
+//
+//   while (size > 0) {
+//     size_t used = encoder.push(data, size);
+//     data += used;
+//     size -= used;
+//     while ((got = encoder.pull(buffer, sizeof(buffer))) > 0) { write }
+//   }
+//   encoder.finish();
+//   while ((got = encoder.pull(buffer, sizeof(buffer))) > 0) { write }
+class StreamEncoder {
+public:
+  StreamEncoder(size_t blockSize = DEFAULT_BLOCK_SIZE);
+  size_t push(const unsigned char *data, size_t size);
+  void finish();
+  size_t pull(unsigned char *output, size_t capacity);
+  bool finished() const;
+  uint64_t bytesIn() const;
+  uint64_t bytesOut() const;
+  const CodecStats &stats() const;
+
+private:
+  size_t blockSize;
+  std::vector<unsigned char> block;
+  std::vector<unsigned char> pending;
+  size_t pendingStart;
+  std::vector<unsigned char> frame;
+  BlockPlan plan;
+  std::vector<int> previousLengths;
+  std::shared_ptr<const HuffmanEncoder> previousEncoder;
+  uint64_t previousDistance;
+  uint64_t originalSize;
+  uint64_t written;
+  uint32_t checksum;
+  bool ended;
+  CodecStats statistics;
+  void appendPending(const unsigned char *data, size_t size);
+  void encodeBlock();
+};
+
+// Constructor queues the file header. A block size of 0 or one that does not
+// fit the 4-byte size field uses DEFAULT_BLOCK_SIZE.
+inline StreamEncoder::StreamEncoder(size_t blockSize) {
+  if (blockSize == 0 || blockSize > UINT32_MAX) {
+    blockSize = DEFAULT_BLOCK_SIZE;
+  }
+  this->blockSize = blockSize;
+  block.reserve(blockSize);
+  pendingStart = 0;
+  previousDistance = 0;
+  originalSize = 0;
+  written = 0;
+  checksum = 0;
+  ended = false;
+
+  ContainerHeader header;
+  header.flags = CONTAINER_BLOCKED | CONTAINER_ADAPTIVE | CONTAINER_STREAMED;
+  unsigned char headerBytes[CONTAINER_HEADER_SIZE + 4];
+  serializeContainerHeader(header, headerBytes);
+  putLittleEndian(headerBytes + CONTAINER_HEADER_SIZE, blockSize, 4);
+  appendPending(headerBytes, sizeof(headerBytes));
+}
+
+//
+// push
+//
+// Function takes input bytes until the current block is full and has been
+// encoded, returns how many of the `size` bytes it took. It takes none while
+// encoded output is waiting to be pulled.
+inline size_t StreamEncoder::push(const unsigned char *data, size_t size) {
+  size_t used = 0;
+  while (!ended && used < size && pendingStart == pending.size()) {
+    size_t take = std::min(size - used, blockSize - block.size());
+    block.insert(block.end(), data + used, data + used + take);
+    used += take;
+    if (block.size() == blockSize) {
+      encodeBlock();
+    }
+  }
+  return used;
+}
+
+//
+// finish
+//
+// Function encodes the last partial block and queues the end frame and the
+// stream footer, nothing can be pushed afterwards
+inline void StreamEncoder::finish() {
+  if (ended) {
+    return;
+  }
+  if (!block.empty()) {
+    encodeBlock();
+  }
+  unsigned char trailer[BLOCK_HEADER_SIZE + CONTAINER_FOOTER_SIZE] = {};
+  trailer[0] = BLOCK_END;
+  putLittleEndian(trailer + BLOCK_HEADER_SIZE, originalSize, 8);
+  putLittleEndian(trailer + BLOCK_HEADER_SIZE + 8, checksum, 4);
+  std::copy(STREAM_MAGIC, STREAM_MAGIC + 4, trailer + BLOCK_HEADER_SIZE + 12);
+  appendPending(trailer, sizeof(trailer));
+  ended = true;
+}
+
+//
+// pull
+//
+// Function copies up to `capacity` bytes of encoded output to output and
+// returns how many it copied, 0 once nothing is waiting
+inline size_t StreamEncoder::pull(unsigned char *output, size_t capacity) {
+  size_t count = std::min(capacity, pending.size() - pendingStart);
+  std::copy(pending.begin() + pendingStart,
+            pending.begin() + pendingStart + count, output);
+  pendingStart += count;
+  written += count;
+  if (pendingStart == pending.size()) {
+    pending.clear();
+    pendingStart = 0;
+  }
+  return count;
+}
+
+// Returns true once finish was called and all of the output was pulled.
+inline bool StreamEncoder::finished() const { return ended && pending.empty(); }
+
+// Returns the number of input bytes taken so far.
+inline uint64_t StreamEncoder::bytesIn() const {
+  return originalSize + block.size();
+}
+
+// Returns the number of output bytes pulled so far.
+inline uint64_t StreamEncoder::bytesOut() const { return written; }
+
+// Returns the time spent on the blocks so far and how well they were coded.
+inline const CodecStats &StreamEncoder::stats() const { return statistics; }
+
+//
+// appendPending
+//
+// Function adds bytes to the output waiting to be pulled, dropping the part
+// that was already pulled first
+inline void StreamEncoder::appendPending(const unsigned char *data,
+                                         size_t size) {
+  pending.erase(pending.begin(), pending.begin() + pendingStart);
+  pendingStart = 0;
+  pending.insert(pending.end(), data, data + size);
+}
+
+//
+// encodeBlock
+//
+// Function codes the buffered block with the cheapest of its own table, the
+// previous table or raw storage and queues its frame
+inline void StreamEncoder::encodeBlock() {
+  planAdaptiveBlock(block.data(), block.size(), plan, &statistics);
+  chooseBlockMode(plan, block.size(), previousLengths, previousEncoder,
+                  previousDistance, &statistics);
+  encodeContainerBlock(plan, block.data(), block.size(), frame, 1,
+                       &statistics);
+  appendPending(frame.data(), frame.size());
+  originalSize += block.size();
+  checksum = crc32c(checksum, frame.data() + 12, 4);
+  block.clear();
+}
+
+// StreamDecoder decodes a blocked .hz file handed to it in pieces of any size,
+// streamed or not, holding at most one frame of input and one block of output
+// at a time. Like StreamEncoder it only takes input once the decoded output
+// so far has been pulled. The block index of seekable files is skipped
+// without being stored.
+class StreamDecoder {
+public:
+  StreamDecoder();
+  size_t push(const unsigned char *data, size_t size);
+  bool finish();
+  size_t pull(unsigned char *output, size_t capacity);
+  bool finished() const;
+  bool failed() const;
+  const std::string &error() const;
+  uint64_t bytesIn() const;
+  uint64_t bytesOut() const;
+  const CodecStats &stats() const;
+
+private:
+  // what the bytes being collected in input are
+  enum Stage { HEADER, FRAME_HEADER, FRAME, INDEX, FOOTER, DONE, FAILED };
+
+  Stage stage;
+  std::vector<unsigned char> input;
+  size_t needed;
+  std::vector<unsigned char> output;
+  size_t outputStart;
+  ContainerHeader header;
+  uint64_t blockSize;
+  uint64_t blockCount;
+  uint64_t indexLeft;
+  uint64_t decodedSize;
+  uint64_t consumed;
+  uint64_t written;
+  uint32_t checksum;
+  bool shortBlockSeen;
+  std::shared_ptr<const HuffmanDecoder> sharedDecoder;
+  std::shared_ptr<const HuffmanDecoder> previousDecoder;
+  std::string message;
+  CodecStats statistics;
+  void expect(Stage next, size_t size);
+  void process();
+  void readHeader();
+  void readFrameHeader();
+  void readFrame();
+  void readFooter();
+  void fail(const std::string &error);
+};
+
+// Default constructor waits for the file header.
+inline StreamDecoder::StreamDecoder() {
+  outputStart = 0;
+  blockSize = blockCount = indexLeft = 0;
+  decodedSize = consumed = written = 0;
+  checksum = 0;
+  shortBlockSeen = false;
+  expect(HEADER, CONTAINER_HEADER_SIZE + 4);
+}
+
+//
+// push
+//
+// Function takes compressed bytes until a whole frame has been decoded and
+// returns how many of the `size` bytes it took. It takes none while decoded
+// output is waiting to be pulled. After an error, or data past the end of the
+// file, every byte is taken and dropped so callers cannot get stuck.
+inline size_t StreamDecoder::push(const unsigned char *data, size_t size) {
+  size_t used = 0;
+  while (used < size && outputStart == output.size()) {
+    if (stage == FAILED) {
+      return size;
+    }
+    if (stage == DONE) {
+      fail("unexpected data after the end of the compressed file");
+      return size;
+    }
+    size_t take;
+    if (stage == INDEX) {
+      // the index only matters for seeking, count it off without storing it
+      take = std::min<uint64_t>(size - used, indexLeft);
+      indexLeft -= take;
+      if (indexLeft == 0) {
+        expect(FOOTER, CONTAINER_FOOTER_SIZE);
+      }
+    } else {
+      take = std::min(size - used, needed - input.size());
+      input.insert(input.end(), data + used, data + used + take);
+      if (input.size() == needed) {
+        process();
+      }
+    }
+    used += take;
+    consumed += take;
+  }
+  return used;
+}
+
+//
+// finish
+//
+// Function tells the decoder that no more input follows, returns false if
+// the file ended early or anything in it failed to decode
+inline bool StreamDecoder::finish() {
+  if (stage != DONE && stage != FAILED) {
+    fail("compressed file is truncated");
+  }
+  return stage == DONE;
+}
+
+//
+// pull
+//
+// Function copies up to `capacity` decoded bytes to output and returns how
+// many it copied, 0 once nothing is waiting
+inline size_t StreamDecoder::pull(unsigned char *output, size_t capacity) {
+  size_t count = std::min(capacity, this->output.size() - outputStart);
+  std::copy(this->output.begin() + outputStart,
+            this->output.begin() + outputStart + count, output);
+  outputStart += count;
+  written += count;
+  return count;
+}
+
+// Returns true once the whole file was decoded and checked.
+inline bool StreamDecoder::finished() const { return stage == DONE; }
+
+// Returns true if the input was not a valid .hz file.
+inline bool StreamDecoder::failed() const { return stage == FAILED; }
+
+// Returns the reason the decoder failed.
+inline const std::string &StreamDecoder::error() const { return message; }
+
+// Returns the number of compressed bytes taken so far.
+inline uint64_t StreamDecoder::bytesIn() const { return consumed; }
+
+// Returns the number of decoded bytes pulled so far.
+inline uint64_t StreamDecoder::bytesOut() const { return written; }
+
+// Returns the time spent on the blocks so far and how well they were coded.
+inline const CodecStats &StreamDecoder::stats() const { return statistics; }
+
+//
+// expect
+//
+// Function starts collecting the `size` bytes of the next part of the file
+inline void StreamDecoder::expect(Stage next, size_t size) {
+  stage = next;
+  input.clear();
+  needed = size;
+}
+
+//
+// process
+//
+// Function handles the part of the file that was just collected
+inline void StreamDecoder::process() {
+  if (stage == HEADER) {
+    readHeader();
+  } else if (stage == FRAME_HEADER) {
+    readFrameHeader();
+  } else if (stage == FRAME) {
+    readFrame();
+  } else if (stage == FOOTER) {
+    readFooter();
+  }
+}
+
+//
+// readHeader
+//
+// Function checks the file header and builds the shared table of files that
+// have one
+inline void StreamDecoder::readHeader() {
+  if (!parseContainerHeader(input.data(), input.size(), header, message)) {
+    fail(message);
+    return;
+  }
+  if (!(header.flags & CONTAINER_BLOCKED)) {
+    fail("only blocked .hz files can be decompressed as a stream");
+    return;
+  }
+  blockSize = getLittleEndian(input.data() + CONTAINER_HEADER_SIZE, 4);
+  if (blockSize == 0) {
+    fail("invalid block size");
+    return;
+  }
+  if (!(header.flags & CONTAINER_ADAPTIVE) &&
+      std::count(header.codeLengths.begin(), header.codeLengths.end(), 0) <
+          ALPHABET_SIZE) {
+    std::vector<HuffmanCode> codes;
+    std::shared_ptr<HuffmanDecoder> decoder(new HuffmanDecoder());
+    if (!assignCanonicalCodes(header.codeLengths, codes) ||
+        !decoder->build(codes)) {
+      fail("invalid code table");
+      return;
+    }
+    sharedDecoder = decoder;
+  }
+  expect(FRAME_HEADER, BLOCK_HEADER_SIZE);
+}
+
+//
+// readFrameHeader
+//
+// Function checks the header of the next frame, which is either a block or
+// the end frame
+inline void StreamDecoder::readFrameHeader() {
+  BlockHeader frameHeader = parseBlockHeader(input.data());
+  bool streamed = header.flags & CONTAINER_STREAMED;
+  if (frameHeader.mode == BLOCK_END) {
+    if (streamed) {
+      expect(FOOTER, CONTAINER_FOOTER_SIZE);
+    } else {
+      indexLeft = blockCount * 8;
+      expect(indexLeft > 0 ? INDEX : FOOTER, CONTAINER_FOOTER_SIZE);
+    }
+    return;
+  }
+  // every block but the last is full, and a coded block is never stored
+  // larger than the original
+  uint64_t expectedSize =
+      streamed ? frameHeader.rawSize
+               : std::min(blockSize, header.originalSize - decodedSize);
+  if (frameHeader.rawSize == 0 || frameHeader.rawSize != expectedSize ||
+      frameHeader.rawSize > blockSize || shortBlockSeen ||
+      frameHeader.payloadSize > frameHeader.rawSize) {
+    fail("block " + std::to_string(blockCount) + " has an invalid size");
+    return;
+  }
+  shortBlockSeen = frameHeader.rawSize < blockSize;
+  needed = BLOCK_HEADER_SIZE + frameHeader.payloadSize;
+  stage = FRAME;
+  if (input.size() == needed) {
+    readFrame();
+  }
+}
+
+//
+// readFrame
+//
+// Function decodes the block in the frame that was just collected
+inline void StreamDecoder::readFrame() {
+  std::shared_ptr<const HuffmanDecoder> decoder;
+  BlockHeader frameHeader = parseBlockHeader(input.data());
+  output.resize(frameHeader.rawSize);
+  outputStart = 0;
+  StageClock clock(&statistics);
+  bool tableFound = blockTableDecoder(input.data(), input.size(),
+                                      sharedDecoder, previousDecoder, decoder,
+                                      message);
+  clock.lap(STAGE_TABLES);
+  if (!tableFound ||
+      !decodeContainerBlock(decoder.get(), input.data(), input.size(),
+                            output.data(), output.size(), header.streams,
+                            message, &statistics)) {
+    output.clear();
+    fail(message + " in block " + std::to_string(blockCount));
+    return;
+  }
+  checksum = crc32c(checksum, input.data() + 12, 4);
+  decodedSize += frameHeader.rawSize;
+  blockCount++;
+  expect(FRAME_HEADER, BLOCK_HEADER_SIZE);
+}
+
+//
+// readFooter
+//
+// Function checks the size and checksum of the whole file against the stream
+// footer, or against the header for files with a block index
+inline void StreamDecoder::readFooter() {
+  const unsigned char *footer = input.data();
+  uint64_t originalSize = header.originalSize;
+  uint32_t expectedChecksum = header.checksum;
+  if (header.flags & CONTAINER_STREAMED) {
+    if (!std::equal(STREAM_MAGIC, STREAM_MAGIC + 4, footer + 12)) {
+      fail("stream footer is missing or damaged");
+      return;
+    }
+    originalSize = getLittleEndian(footer, 8);
+    expectedChecksum = getLittleEndian(footer + 8, 4);
+  } else if (!std::equal(INDEX_MAGIC, INDEX_MAGIC + 4, footer + 12) ||
+             getLittleEndian(footer, 4) != blockCount) {
+    fail("block index is missing or damaged");
+    return;
+  }
+  if (originalSize != decodedSize) {
+    fail("original size does not match the compressed data");
+  } else if (expectedChecksum != checksum) {
+    fail("checksum mismatch");
+  } else {
+    expect(DONE, 0);
+  }
+}
+
+//
+// fail
+//
+// Function stops the decoder with the given error
+inline void StreamDecoder::fail(const std::string &error) {
+  message = error;
+  expect(FAILED, 0);
+}
+
+//
+// compressStream
+//
+// Function compresses everything that can be read from in into a streamed
+// .hz file written to out, which does not have to be seekable. The input is
+// read and the output written on threads of their own while blocks are
+// encoded in between.
+inline CodecResult compressStream(std::istream &in, std::ostream &out,
+                                  size_t blockSize = DEFAULT_BLOCK_SIZE) {
+  CodecResult result;
+  StreamEncoder encoder(blockSize);
+  StreamPipeline pipeline(in, out);
+  auto pull = [&](unsigned char *output, size_t capacity) {
+    return encoder.pull(output, capacity);
+  };
+  const unsigned char *data;
+  size_t size;
+  while ((size = pipeline.read(data)) > 0) {
+    while (size > 0) {
+      size_t used = encoder.push(data, size);
+      data += used;
+      size -= used;
+      pipeline.drain(pull);
+    }
+  }
+  encoder.finish();
+  pipeline.drain(pull);
+  // the encoder times its own stages, the pipeline reading and writing
+  bool written = pipeline.finish(result.stats);
+  result.stats.merge(encoder.stats());
+  result.stats.finish();
+  result.bytesIn = encoder.bytesIn();
+  result.bytesOut = encoder.bytesOut();
+  if (!written) {
+    result.error = "unable to write output";
+    return result;
+  }
+  result.ok = true;
+  return result;
+}
+
+//
+// decompressStream
+//
+// Function decodes a blocked .hz file read from in and writes the original
+// data to out, reading and writing on threads of their own like
+// compressStream. The output is written as it is decoded, so on an error it
+// holds everything before the damaged block.
+inline CodecResult decompressStream(std::istream &in, std::ostream &out) {
+  CodecResult result;
+  StreamDecoder decoder;
+  StreamPipeline pipeline(in, out);
+  auto pull = [&](unsigned char *output, size_t capacity) {
+    return decoder.pull(output, capacity);
+  };
+  const unsigned char *data;
+  size_t size;
+  while (!decoder.failed() && (size = pipeline.read(data)) > 0) {
+    while (size > 0) {
+      size_t used = decoder.push(data, size);
+      data += used;
+      size -= used;
+      pipeline.drain(pull);
+    }
+  }
+  // the decoder times its own stages, the pipeline reading and writing
+  bool written = pipeline.finish(result.stats);
+  result.stats.merge(decoder.stats());
+  result.stats.finish();
+  result.bytesIn = decoder.bytesIn();
+  result.bytesOut = decoder.bytesOut();
+  // a failed write stops the decoder early, that is not the input's fault
+  if (!written) {
+    result.error = "unable to write output";
+    return result;
+  }
+  if (!decoder.finish()) {
+    result.error = decoder.error();
+    return result;
+  }
+  result.ok = true;
+  return result;
+}
+
+//
+// encodeSingleStream
+//
+// Function writes the mapped input into a single stream .hz file with the
+// given header, which must describe the encoder's table, and fills in the
+// result. The size and checksum of the header are set here. With counts the
+// bytes are counted as well, while they are read for encoding anyway.
+inline void encodeSingleStream(const MappedInput &inputFile,
+                               const std::string &outputFilename,
+                               ContainerHeader &header,
+                               const HuffmanEncoder &encoder,
+                               CodecResult &result,
+                               uint64_t *counts = nullptr) {
+  StageClock clock(&result.stats);
+  std::ofstream outputFile(outputFilename, std::ios::binary);
+  if (!outputFile.is_open()) {
+    result.error = "unable to open output file";
+    return;
+  }
+  header.originalSize = inputFile.size();
+  header.checksum = 0;
+  std::vector<unsigned char> headerBytes(containerHeaderSize(header.flags));
+  serializeContainerHeader(header, headerBytes.data());
+  outputFile.write((char *)headerBytes.data(), headerBytes.size());
+  clock.lap(STAGE_WRITE);
+
+  // The input is read once, a chunk at a time is checksummed, counted and
+  // encoded while it is in the cache, and the header is written again with
+  // the checksum at the end. The bit writer hands its blocks to the file
+  // while encoding, that part of the writing counts as encoding.
+  BitWriter writer(outputFile);
+  const unsigned char *data = inputFile.data();
+  size_t inputSize = inputFile.size();
+  for (size_t start = 0; start < inputSize; start += ENCODE_CHUNK_SIZE) {
+    size_t size = std::min(ENCODE_CHUNK_SIZE, inputSize - start);
+    header.checksum = crc32c(header.checksum, data + start, size);
+    clock.lap(STAGE_CHECKSUM);
+    if (counts != nullptr) {
+      histogram(data + start, size, counts);
+      clock.lap(STAGE_HISTOGRAM);
+    }
+    encoder.encodeBlock(data + start, size, writer);
+    clock.lap(STAGE_ENCODE);
+  }
+  writer.flush();
+  clock.lap(STAGE_ENCODE);
+  serializeContainerHeader(header, headerBytes.data());
+  outputFile.seekp(0);
+  outputFile.write((char *)headerBytes.data(), headerBytes.size());
+  outputFile.close();
+  clock.lap(STAGE_WRITE);
+  result.stats.symbols = header.originalSize;
+  result.stats.codeBits = writer.bytesWritten() * 8;
+  result.stats.finish();
+  if (!outputFile) {
+    result.error = "unable to write output file";
+    return;
+  }
+
+  result.ok = true;
+  result.bytesIn = header.originalSize;
+  result.bytesOut = headerBytes.size() + writer.bytesWritten();
+}
+
+//
+// compressToContainer
+//
+// Function compresses the input file into a .hz file using canonical codes
+// with the given code lengths
+inline CodecResult compressToContainer(const std::string &inputFilename,
+                                       const std::string &outputFilename,
+                                       const std::vector<int> &codeLengths) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  ContainerHeader header;
+  header.codeLengths = codeLengths;
+  std::vector<HuffmanCode> codes;
+  HuffmanEncoder encoder;
+  if (!assignCanonicalCodes(codeLengths, codes) || !encoder.build(codes)) {
+    result.error = "invalid code lengths";
+    return result;
+  }
+  result.stats.addCodeLengths(codeLengths);
+  clock.lap(STAGE_TABLES);
+
+  MappedInput inputFile;
+  if (!inputFile.open(inputFilename)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  encodeSingleStream(inputFile, outputFilename, header, encoder, result);
+  return result;
+}
+
+//
+// compressWithSample
+//
+// Function compresses the input file into a .hz file with a table trained on
+// a sample of it, so large files are read once instead of being counted in
+// full first. Bytes that appear in the parts the sample skipped may be
+// missing from it, so every byte value gets a count of at least one and with
+// it a code of at most SAMPLE_MAX_CODE_LENGTH bits. The bytes are counted
+// while they are encoded, and if the coded data is more than SAMPLE_MAX_LOSS
+// larger than with a table of the whole file, the file is encoded again with
+// that table, which bounds the loss of the sample.
+inline CodecResult compressWithSample(const std::string &inputFilename,
+                                      const std::string &outputFilename,
+                                      const HistogramSample &sample) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  MappedInput inputFile;
+  if (!inputFile.open(inputFilename)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  std::vector<uint64_t> sampled(ALPHABET_SIZE, 0);
+  bool whole = sampleHistogram(inputFile.data(), inputFile.size(), sample,
+                               sampled.data());
+  if (!whole) {
+    for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+      sampled[symbol] = std::max<uint64_t>(sampled[symbol], 1);
+    }
+  }
+  clock.lap(STAGE_HISTOGRAM);
+  ContainerHeader header;
+  optimalCodeLengths(sampled, SAMPLE_MAX_CODE_LENGTH, header.codeLengths);
+  clock.lap(STAGE_TREE);
+  std::vector<HuffmanCode> codes;
+  HuffmanEncoder encoder;
+  assignCanonicalCodes(header.codeLengths, codes);
+  encoder.build(codes);
+  result.stats.addCodeLengths(header.codeLengths);
+  clock.lap(STAGE_TABLES);
+  if (whole) {
+    result.stats.addEntropy(sampled);
+    encodeSingleStream(inputFile, outputFilename, header, encoder, result);
+    return result;
+  }
+
+  std::vector<uint64_t> counts(ALPHABET_SIZE, 0);
+  encodeSingleStream(inputFile, outputFilename, header, encoder, result,
+                     counts.data());
+  if (!result.ok) {
+    return result;
+  }
+  clock.skip();
+  result.stats.addEntropy(counts);
+  std::vector<int> exactLengths;
+  optimalCodeLengths(counts, DEFAULT_MAX_CODE_LENGTH, exactLengths);
+  uint64_t sampledSize = encodedSize(counts, header.codeLengths);
+  uint64_t exactSize = encodedSize(counts, exactLengths);
+  clock.lap(STAGE_TREE);
+  if (sampledSize <= exactSize + exactSize * SAMPLE_MAX_LOSS) {
+    return result;
+  }
+  header.codeLengths = exactLengths;
+  assignCanonicalCodes(header.codeLengths, codes);
+  encoder.build(codes);
+  clock.lap(STAGE_TABLES);
+  result.ok = false;
+  encodeSingleStream(inputFile, outputFilename, header, encoder, result);
+  return result;
+}
+
+//
+// compressWithContext
+//
+// Function compresses the input file into a .hz file coded with an order-1
+// context model. If the model and its tables would not make the file any
+// smaller than one table for all of it, the file gets one table instead.
+inline CodecResult compressWithContext(const std::string &inputFilename,
+                                       const std::string &outputFilename) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  MappedInput inputFile;
+  if (!inputFile.open(inputFilename)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  const unsigned char *data = inputFile.data();
+  size_t size = inputFile.size();
+  std::vector<uint64_t> pairs(CONTEXT_PAIRS, 0);
+  contextHistogram(data, size, 0, pairs.data());
+  std::vector<uint64_t> counts(ALPHABET_SIZE, 0);
+  for (int i = 0; i < CONTEXT_PAIRS; i++) {
+    counts[i % ALPHABET_SIZE] += pairs[i];
+  }
+  result.stats.addEntropy(counts);
+  clock.lap(STAGE_HISTOGRAM);
+
+  ContainerHeader header;
+  ContextModel model;
+  optimalCodeLengths(counts, DEFAULT_MAX_CODE_LENGTH, header.codeLengths);
+  bool context = buildContextModel(pairs, MAX_CONTEXT_CLUSTERS, model);
+  clock.lap(STAGE_TREE);
+  std::vector<unsigned char> headerBytes;
+  if (context) {
+    headerBytes.resize(CONTAINER_CONTEXT_HEADER_SIZE);
+    appendContextModel(model, headerBytes);
+    context = contextCodedBits(pairs, model) / 8 + headerBytes.size() <
+              encodedSize(counts, header.codeLengths) + CONTAINER_HEADER_SIZE;
+  }
+  if (!context) {
+    std::vector<HuffmanCode> codes;
+    HuffmanEncoder encoder;
+    assignCanonicalCodes(header.codeLengths, codes);
+    encoder.build(codes);
+    result.stats.addCodeLengths(header.codeLengths);
+    clock.lap(STAGE_TABLES);
+    encodeSingleStream(inputFile, outputFilename, header, encoder, result);
+    return result;
+  }
+  ContextEncoder encoder;
+  encoder.build(model);
+  for (const std::vector<int> &lengths : model.codeLengths) {
+    result.stats.addCodeLengths(lengths);
+  }
+  clock.lap(STAGE_TABLES);
+
+  header.flags = CONTAINER_CONTEXT;
+  header.originalSize = size;
+  header.checksum = crc32c(0, data, size);
+  serializeContainerHeader(header, headerBytes.data());
+  clock.lap(STAGE_CHECKSUM);
+  std::ofstream outputFile(outputFilename, std::ios::binary);
+  if (!outputFile.is_open()) {
+    result.error = "unable to open output file";
+    return result;
+  }
+  outputFile.write((char *)headerBytes.data(), headerBytes.size());
+  clock.lap(STAGE_WRITE);
+  BitWriter writer(outputFile);
+  encoder.encodeBlock(data, size, 0, writer);
+  writer.flush();
+  clock.lap(STAGE_ENCODE);
+  outputFile.close();
+  clock.lap(STAGE_WRITE);
+  result.stats.symbols = size;
+  result.stats.codeBits = writer.bytesWritten() * 8;
+  result.stats.finish();
+  if (!outputFile) {
+    result.error = "unable to write output file";
+    return result;
+  }
+  result.ok = true;
+  result.bytesIn = size;
+  result.bytesOut = headerBytes.size() + writer.bytesWritten();
+  return result;
+}
+
+//
+// compressWithRunLength
+//
+// Function compresses the input file into a .hz file that codes the
+// run-length form of the data, for data with long runs of the same byte. The
+// input is read twice, once to count the bytes of its run-length form and
+// once to encode it, a chunk at a time so the run-length form is never held
+// in full. If it would not make the file smaller, the file is coded as it is.
+inline CodecResult compressWithRunLength(const std::string &inputFilename,
+                                         const std::string &outputFilename) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  MappedInput inputFile;
+  if (!inputFile.open(inputFilename)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  const unsigned char *data = inputFile.data();
+  size_t size = inputFile.size();
+  std::vector<unsigned char> runs(runLengthBound(ENCODE_CHUNK_SIZE));
+  std::vector<uint64_t> counts(ALPHABET_SIZE, 0);
+  std::vector<uint64_t> runCounts(ALPHABET_SIZE, 0);
+  RunLengthEncoder counter;
+  for (size_t start = 0; start < size; start += ENCODE_CHUNK_SIZE) {
+    size_t chunk = std::min(ENCODE_CHUNK_SIZE, size - start);
+    histogram(data + start, chunk, counts.data());
+    histogram(runs.data(), counter.encode(data + start, chunk, runs.data()),
+              runCounts.data());
+  }
+  histogram(runs.data(), counter.finish(runs.data()), runCounts.data());
+  result.stats.addEntropy(counts);
+  clock.lap(STAGE_HISTOGRAM);
+
+  ContainerHeader header;
+  std::vector<int> runLengths;
+  optimalCodeLengths(counts, DEFAULT_MAX_CODE_LENGTH, header.codeLengths);
+  optimalCodeLengths(runCounts, DEFAULT_MAX_CODE_LENGTH, runLengths);
+  clock.lap(STAGE_TREE);
+  bool runLength = encodedSize(runCounts, runLengths) <
+                   encodedSize(counts, header.codeLengths);
+  std::vector<HuffmanCode> codes;
+  HuffmanEncoder encoder;
+  if (runLength) {
+    header.codeLengths = runLengths;
+  }
+  assignCanonicalCodes(header.codeLengths, codes);
+  encoder.build(codes);
+  result.stats.addCodeLengths(header.codeLengths);
+  clock.lap(STAGE_TABLES);
+  if (!runLength) {
+    encodeSingleStream(inputFile, outputFilename, header, encoder, result);
+    return result;
+  }
+
+  header.flags = CONTAINER_RUN_LENGTH;
+  header.originalSize = size;
+  header.checksum = 0;
+  std::ofstream outputFile(outputFilename, std::ios::binary);
+  if (!outputFile.is_open()) {
+    result.error = "unable to open output file";
+    return result;
+  }
+  std::vector<unsigned char> headerBytes(CONTAINER_HEADER_SIZE);
+  serializeContainerHeader(header, headerBytes.data());
+  outputFile.write((char *)headerBytes.data(), headerBytes.size());
+  clock.lap(STAGE_WRITE);
+  // as in encodeSingleStream, the header is written again with the checksum
+  BitWriter writer(outputFile);
+  RunLengthEncoder encoderRuns;
+  for (size_t start = 0; start < size; start += ENCODE_CHUNK_SIZE) {
+    size_t chunk = std::min(ENCODE_CHUNK_SIZE, size - start);
+    header.checksum = crc32c(header.checksum, data + start, chunk);
+    clock.lap(STAGE_CHECKSUM);
+    size_t used = encoderRuns.encode(data + start, chunk, runs.data());
+    encoder.encodeBlock(runs.data(), used, writer);
+    clock.lap(STAGE_ENCODE);
+  }
+  encoder.encodeBlock(runs.data(), encoderRuns.finish(runs.data()), writer);
+  writer.flush();
+  clock.lap(STAGE_ENCODE);
+  serializeContainerHeader(header, headerBytes.data());
+  outputFile.seekp(0);
+  outputFile.write((char *)headerBytes.data(), headerBytes.size());
+  outputFile.close();
+  clock.lap(STAGE_WRITE);
+  result.stats.symbols = size;
+  result.stats.codeBits = writer.bytesWritten() * 8;
+  result.stats.finish();
+  if (!outputFile) {
+    result.error = "unable to write output file";
+    return result;
+  }
+  result.ok = true;
+  result.bytesIn = size;
+  result.bytesOut = headerBytes.size() + writer.bytesWritten();
+  return result;
+}
+
+//
+// compressToBlockedContainer
+//
+// Function compresses the input file into a .hz file made of independent
+// blocks of blockSize bytes, encoding a batch of blocks at a time on a pool
+// of `threads` threads (0 uses every hardware thread). With adaptive set the
+// code lengths are ignored and every block gets the cheapest of a table of
+// its own, the previous block table or no coding at all. With more than one
+// stream the codes of every block are interleaved over that many bitstreams.
+inline CodecResult
+compressToBlockedContainer(const std::string &inputFilename,
+                           const std::string &outputFilename,
+                           const std::vector<int> &codeLengths,
+                           size_t blockSize, int threads, bool adaptive = false,
+                           int streams = 1) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  ContainerHeader header;
+  header.flags = CONTAINER_BLOCKED;
+  if (streams < 1 || streams > MAX_INTERLEAVED_STREAMS) {
+    result.error = "invalid number of streams";
+    return result;
+  }
+  if (streams > 1) {
+    header.flags |= CONTAINER_INTERLEAVED;
+    header.streams = streams;
+  }
+  std::vector<HuffmanCode> codes;
+  std::shared_ptr<HuffmanEncoder> sharedEncoder(new HuffmanEncoder());
+  if (adaptive) {
+    header.flags |= CONTAINER_ADAPTIVE;
+  } else if (!assignCanonicalCodes(codeLengths, codes) ||
+             !sharedEncoder->build(codes)) {
+    result.error = "invalid code lengths";
+    return result;
+  } else {
+    header.codeLengths = codeLengths;
+    result.stats.addCodeLengths(codeLengths);
+  }
+  if (blockSize == 0 || blockSize > UINT32_MAX) {
+    result.error = "invalid block size";
+    return result;
+  }
+  clock.lap(STAGE_TABLES);
+
+  MappedInput inputFile;
+  if (!inputFile.open(inputFilename)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  std::ofstream outputFile(outputFilename, std::ios::binary);
+  if (!outputFile.is_open()) {
+    result.error = "unable to open output file";
+    return result;
+  }
+
+  // Reserve room for the header, its checksum is known at the end
+  std::vector<unsigned char> headerBytes(CONTAINER_HEADER_SIZE + 4);
+  putLittleEndian(headerBytes.data() + CONTAINER_HEADER_SIZE, blockSize, 4);
+  outputFile.write((char *)headerBytes.data(), headerBytes.size());
+  uint64_t offset = headerBytes.size();
+  clock.lap(STAGE_WRITE);
+
+  ThreadPool pool(threads);
+  size_t batchSize = pool.size() * 2;
+  std::vector<std::vector<unsigned char>> frames(batchSize);
+  std::vector<BlockPlan> plans(batchSize);
+  // every block is timed on its own thread and added up after the batch
+  std::vector<CodecStats> blockStats(batchSize);
+  std::vector<uint64_t> frameOffsets;
+  std::vector<int> previousLengths;
+  std::shared_ptr<const HuffmanEncoder> previousEncoder;
+  uint64_t previousDistance = 0;
+  uint64_t blockCount = (inputFile.size() + blockSize - 1) / blockSize;
+  for (uint64_t first = 0; first < blockCount; first += batchSize) {
+    // The blocks of the next batch are read straight from the mapped input
+    size_t count = std::min<uint64_t>(batchSize, blockCount - first);
+    auto blockData = [&](size_t i) {
+      return inputFile.data() + (first + i) * blockSize;
+    };
+    auto blockLength = [&](size_t i) {
+      return std::min<uint64_t>(blockSize,
+                                inputFile.size() - (first + i) * blockSize);
+    };
+
+    // Plan the coding of every block, the counting runs in parallel but the
+    // choice depends on the table of the block before
+    if (adaptive) {
+      pool.parallelFor(count, [&](size_t i) {
+        planAdaptiveBlock(blockData(i), blockLength(i), plans[i],
+                          &blockStats[i]);
+      });
+      for (size_t i = 0; i < count; i++) {
+        chooseBlockMode(plans[i], blockLength(i), previousLengths,
+                        previousEncoder, previousDistance, &result.stats);
+      }
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        plans[i].mode = BLOCK_SHARED_TABLE;
+        plans[i].encoder = sharedEncoder;
+      }
+    }
+
+    // Encode them in parallel, then write the frames in order
+    pool.parallelFor(count, [&](size_t i) {
+      encodeContainerBlock(plans[i], blockData(i), blockLength(i), frames[i],
+                           header.streams, &blockStats[i]);
+    });
+    for (size_t i = 0; i < count; i++) {
+      result.stats.merge(blockStats[i]);
+      blockStats[i] = CodecStats();
+    }
+    clock.skip();
+    for (size_t i = 0; i < count; i++) {
+      outputFile.write((char *)frames[i].data(), frames[i].size());
+      frameOffsets.push_back(offset);
+      offset += frames[i].size();
+      header.originalSize += blockLength(i);
+      header.checksum = crc32c(header.checksum, frames[i].data() + 12, 4);
+    }
+    clock.lap(STAGE_WRITE);
+  }
+
+  // End frame, block index and footer
+  std::vector<unsigned char> trailer(BLOCK_HEADER_SIZE, 0);
+  trailer[0] = BLOCK_END;
+  uint64_t indexOffset = offset + BLOCK_HEADER_SIZE;
+  for (uint64_t frameOffset : frameOffsets) {
+    unsigned char entry[8];
+    putLittleEndian(entry, frameOffset, 8);
+    trailer.insert(trailer.end(), entry, entry + 8);
+  }
+  unsigned char footer[CONTAINER_FOOTER_SIZE];
+  putLittleEndian(footer, frameOffsets.size(), 4);
+  putLittleEndian(footer + 4, indexOffset, 8);
+  std::copy(INDEX_MAGIC, INDEX_MAGIC + 4, footer + 12);
+  trailer.insert(trailer.end(), footer, footer + CONTAINER_FOOTER_SIZE);
+  outputFile.write((char *)trailer.data(), trailer.size());
+
+  serializeContainerHeader(header, headerBytes.data());
+  outputFile.seekp(0);
+  outputFile.write((char *)headerBytes.data(), CONTAINER_HEADER_SIZE);
+  outputFile.close();
+  clock.lap(STAGE_WRITE);
+  result.stats.finish();
+  if (!outputFile) {
+    result.error = "unable to write output file";
+    return result;
+  }
+
+  result.ok = true;
+  result.bytesIn = header.originalSize;
+  result.bytesOut = offset + trailer.size();
+  return result;
+}
+
+//
+// readBlockIndex
+//
+// Function finds the block size of a mapped blocked .hz file and the offset
+// of every frame from the block index at the end of the file. frameOffsets
+// gets one more entry for the end frame, which closes the last block.
+inline bool readBlockIndex(const unsigned char *file, uint64_t fileSize,
+                           const ContainerHeader &header, uint64_t &blockSize,
+                           std::vector<uint64_t> &frameOffsets,
+                           std::string &error) {
+  error = "block index is missing or damaged";
+  if (fileSize < CONTAINER_HEADER_SIZE + 4 + BLOCK_HEADER_SIZE +
+                     CONTAINER_FOOTER_SIZE) {
+    error = "compressed file is truncated";
+    return false;
+  }
+  const unsigned char *footer = file + fileSize - CONTAINER_FOOTER_SIZE;
+  blockSize = getLittleEndian(file + CONTAINER_HEADER_SIZE, 4);
+  uint64_t blockCount = getLittleEndian(footer, 4);
+  uint64_t indexOffset = getLittleEndian(footer + 4, 8);
+  // the index must fit between the frames and the footer, checked piece by
+  // piece so that a damaged count or offset cannot wrap the sum around
+  if (!std::equal(INDEX_MAGIC, INDEX_MAGIC + 4, footer + 12) ||
+      blockSize == 0 ||
+      blockCount > (fileSize - CONTAINER_FOOTER_SIZE) / 8 ||
+      indexOffset > fileSize - CONTAINER_FOOTER_SIZE - blockCount * 8 ||
+      indexOffset + blockCount * 8 + CONTAINER_FOOTER_SIZE != fileSize ||
+      indexOffset < CONTAINER_HEADER_SIZE + 4 + BLOCK_HEADER_SIZE ||
+      header.originalSize / blockSize +
+              (header.originalSize % blockSize != 0) !=
+          blockCount) {
+    return false;
+  }
+  frameOffsets.assign(blockCount + 1, 0);
+  // the frames follow each other, starting right after the block size
+  uint64_t minimum = CONTAINER_HEADER_SIZE + 4;
+  for (uint64_t i = 0; i < blockCount; i++) {
+    frameOffsets[i] = getLittleEndian(file + indexOffset + i * 8, 8);
+    if (frameOffsets[i] < minimum ||
+        (i == 0 && frameOffsets[i] != minimum)) {
+      return false;
+    }
+    minimum = frameOffsets[i] + BLOCK_HEADER_SIZE;
+  }
+  frameOffsets[blockCount] = indexOffset - BLOCK_HEADER_SIZE;
+  if (frameOffsets[blockCount] < minimum ||
+      (blockCount == 0 && frameOffsets[blockCount] != minimum)) {
+    return false;
+  }
+  error.clear();
+  return true;
+}
+
+//
+// decompressBlockedContainer
+//
+// Function decodes the blocks of a mapped blocked .hz file in parallel, a
+// batch at a time, straight into their place in the mapped output file using
+// the block index at the end of the file. Without an output file name the
+// blocks are only decoded and checked.
+inline CodecResult decompressBlockedContainer(const MappedInput &inputFile,
+                                              const ContainerHeader &header,
+                                              const std::string &outputFilename,
+                                              int threads) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  const unsigned char *file = inputFile.data();
+  uint64_t fileSize = inputFile.size();
+  result.bytesIn = fileSize;
+
+  // Block size, footer and block index
+  uint64_t blockSize;
+  std::vector<uint64_t> frameOffsets;
+  if (!readBlockIndex(file, fileSize, header, blockSize, frameOffsets,
+                      result.error)) {
+    return result;
+  }
+  uint64_t blockCount = frameOffsets.size() - 1;
+
+  // Adaptive files have no shared table, their blocks carry their own
+  std::shared_ptr<const HuffmanDecoder> sharedDecoder;
+  std::shared_ptr<const HuffmanDecoder> previousDecoder;
+  if (!(header.flags & CONTAINER_ADAPTIVE) && header.originalSize > 0) {
+    std::vector<HuffmanCode> codes;
+    std::shared_ptr<HuffmanDecoder> decoder(new HuffmanDecoder());
+    if (!assignCanonicalCodes(header.codeLengths, codes) ||
+        !decoder->build(codes)) {
+      result.error = "invalid code table";
+      return result;
+    }
+    sharedDecoder = decoder;
+  }
+  ThreadPool pool(threads);
+  size_t batchSize = pool.size() * 2;
+  clock.lap(STAGE_TABLES);
+  bool verifyOnly = outputFilename.empty();
+  MappedOutput outputFile;
+  std::vector<unsigned char> scratch;
+  if (verifyOnly) {
+    scratch.resize(std::min<uint64_t>(batchSize * blockSize,
+                                      header.originalSize));
+  } else if (!outputFile.create(outputFilename, header.originalSize)) {
+    outputFile.close(0);
+    std::remove(outputFilename.c_str());
+    result.error = "unable to create output file";
+    return result;
+  }
+  clock.lap(STAGE_WRITE);
+
+  std::vector<std::string> errors(batchSize);
+  std::vector<std::shared_ptr<const HuffmanDecoder>> decoders(batchSize);
+  // every block is timed on its own thread and added up after the batch
+  std::vector<CodecStats> blockStats(batchSize);
+  uint32_t checksum = 0;
+  for (uint64_t first = 0; first < blockCount; first += batchSize) {
+    uint64_t last = std::min<uint64_t>(first + batchSize, blockCount);
+    // Find the table of every block in order, then decode them in parallel
+    for (uint64_t block = first; block < last && result.error.empty();
+         block++) {
+      if (!blockTableDecoder(file + frameOffsets[block],
+                             frameOffsets[block + 1] - frameOffsets[block],
+                             sharedDecoder, previousDecoder,
+                             decoders[block - first], result.error)) {
+        result.error += " in block " + std::to_string(block);
+      }
+    }
+    clock.lap(STAGE_TABLES);
+    if (!result.error.empty()) {
+      break;
+    }
+    pool.parallelFor(last - first, [&](size_t i) {
+      uint64_t block = first + i;
+      uint64_t blockStart = block * blockSize;
+      uint64_t blockEnd = std::min(blockStart + blockSize, header.originalSize);
+      errors[i].clear();
+      unsigned char *output = verifyOnly ? scratch.data() + i * blockSize
+                                         : outputFile.data() + blockStart;
+      decodeContainerBlock(decoders[i].get(), file + frameOffsets[block],
+                           frameOffsets[block + 1] - frameOffsets[block],
+                           output, blockEnd - blockStart, header.streams,
+                           errors[i], &blockStats[i]);
+    });
+    clock.skip();
+    for (uint64_t i = 0; i < last - first && result.error.empty(); i++) {
+      if (!errors[i].empty()) {
+        result.error = errors[i] + " in block " + std::to_string(first + i);
+      } else {
+        checksum = crc32c(checksum, file + frameOffsets[first + i] + 12, 4);
+      }
+    }
+    for (uint64_t i = 0; i < last - first; i++) {
+      result.stats.merge(blockStats[i]);
+      blockStats[i] = CodecStats();
+    }
+    clock.lap(STAGE_CHECKSUM);
+    if (!result.error.empty()) {
+      break;
+    }
+  }
+  if (result.error.empty() && checksum != header.checksum) {
+    result.error = "checksum mismatch";
+  }
+  clock.skip();
+  if (!verifyOnly && !outputFile.close(header.originalSize) &&
+      result.error.empty()) {
+    result.error = "unable to write output file";
+  }
+  clock.lap(STAGE_WRITE);
+  result.stats.finish();
+  if (!result.error.empty()) {
+    if (!verifyOnly) {
+      std::remove(outputFilename.c_str());
+    }
+    return result;
+  }
+  result.ok = true;
+  result.bytesOut = header.originalSize;
+  return result;
+}
+
+//
+// singleStreamDecoder
+//
+// Function returns the decoder of a single stream file, building it into
+// ownDecoder from the header or looking up the cached table the header
+// refers to. Returns null with the error in result if there is none.
+inline const HuffmanDecoder *singleStreamDecoder(const ContainerHeader &header,
+                                                 const TableLookup &findTable,
+                                                 HuffmanDecoder &ownDecoder,
+                                                 CodecResult &result) {
+  const HuffmanDecoder *decoder = &ownDecoder;
+  if (header.flags & CONTAINER_TABLE_ID) {
+    // cached tables are built once when the cache is loaded
+    decoder = findTable ? findTable(header.tableId) : nullptr;
+    if (decoder == nullptr) {
+      result.error = "table " + tableIdString(header.tableId) +
+                     " is not in the table cache";
+      return nullptr;
+    }
+  } else if (header.originalSize > 0) {
+    std::vector<HuffmanCode> codes;
+    if (!assignCanonicalCodes(header.codeLengths, codes) ||
+        !ownDecoder.build(codes)) {
+      result.error = "invalid code table";
+      return nullptr;
+    }
+  }
+  result.stats.maxCodeLength =
+      std::max(result.stats.maxCodeLength, decoder->maxCodeLength());
+  return decoder;
+}
+
+// Returns false if a single stream of payloadSize bytes cannot hold the
+// original size of the header. Every byte takes at least one bit, and a bit
+// of the run-length form stands for at most a whole run, so anything larger
+// is a damaged header that must not be allocated.
+inline bool singleStreamSizeFits(const ContainerHeader &header,
+                                 size_t payloadSize) {
+  uint64_t bytesPerBit =
+      header.flags & CONTAINER_RUN_LENGTH ? RUN_LENGTH_MAX_EXTRA + 1 : 1;
+  return header.originalSize / bytesPerBit <= (uint64_t)payloadSize * 8;
+}
+
+//
+// decodeSingleStream
+//
+// Function decodes the first `count` original bytes of a single stream file
+// from the payload after its header into output, building the table or the
+// context tables the header calls for. Returns false with an error in
+// result.
+inline bool decodeSingleStream(const ContainerHeader &header,
+                               const unsigned char *payload, size_t payloadSize,
+                               const TableLookup &findTable,
+                               unsigned char *output, uint64_t count,
+                               CodecResult &result) {
+  StageClock clock(&result.stats);
+  bool decoded;
+  if (header.flags & CONTAINER_CONTEXT) {
+    ContextModel model;
+    ContextDecoder decoder;
+    size_t used;
+    if (!parseContextModel(payload, payloadSize, model, used) ||
+        !decoder.build(model)) {
+      result.error = "invalid context tables";
+      return false;
+    }
+    result.stats.maxCodeLength =
+        std::max(result.stats.maxCodeLength, decoder.maxCodeLength());
+    clock.lap(STAGE_TABLES);
+    decoded = decoder.decodeBuffer(payload + used, payloadSize - used, output,
+                                   count);
+  } else {
+    HuffmanDecoder ownDecoder;
+    const HuffmanDecoder *decoder =
+        singleStreamDecoder(header, findTable, ownDecoder, result);
+    if (decoder == nullptr) {
+      return false;
+    }
+    clock.lap(STAGE_TABLES);
+    if (header.flags & CONTAINER_RUN_LENGTH) {
+      decoded = decodeRunLength(*decoder, payload, payloadSize, output, count);
+    } else {
+      decoded = decoder->decodeBuffer(payload, payloadSize, output, count);
+    }
+  }
+  clock.lap(STAGE_DECODE);
+  if (!decoded) {
+    result.error = "compressed data is truncated or corrupt";
+  }
+  return decoded;
+}
+
+// DiscardBuffer is a stream buffer that drops everything written to it, for
+// checking a file without writing it anywhere.
+struct DiscardBuffer : std::streambuf {
+  int overflow(int c) override { return traits_type::not_eof(c); }
+  std::streamsize xsputn(const char *, std::streamsize size) override {
+    return size;
+  }
+};
+
+//
+// decompressContainer
+//
+// Function maps a whole .hz file, decodes exactly the original number of
+// bytes into a mapped output file of that size and checks them against the
+// stored checksum. Blocked files are decoded a batch of blocks at a time on
+// `threads` threads. With an empty output file name the file is only decoded
+// and checked, nothing is written. Files that refer to a cached table need
+// findTable to look it up.
+inline CodecResult decompressContainer(const std::string &inputFilename,
+                                       const std::string &outputFilename,
+                                       int threads = 0,
+                                       const TableLookup &findTable = nullptr) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  MappedInput inputFile;
+  if (!inputFile.open(inputFilename)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  ContainerHeader header;
+  if (!parseContainerHeader(inputFile.data(), inputFile.size(), header,
+                            result.error)) {
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  if (header.flags & CONTAINER_STREAMED) {
+    // streamed files have no block index, decode them front to back
+    inputFile.close();
+    CodecStats outer = result.stats;
+    std::ifstream streamFile(inputFilename, std::ios::binary);
+    if (outputFilename.empty()) {
+      DiscardBuffer discard;
+      std::ostream nowhere(&discard);
+      result = decompressStream(streamFile, nowhere);
+      mergeOuterStats(outer, result);
+      return result;
+    }
+    std::ofstream outputFile(outputFilename, std::ios::binary);
+    if (!outputFile.is_open()) {
+      result.error = "unable to open output file";
+      return result;
+    }
+    result = decompressStream(streamFile, outputFile);
+    outputFile.close();
+    if (!result.ok) {
+      std::remove(outputFilename.c_str());
+    }
+    mergeOuterStats(outer, result);
+    return result;
+  }
+  if (header.flags & CONTAINER_BLOCKED) {
+    CodecStats outer = result.stats;
+    result = decompressBlockedContainer(inputFile, header, outputFilename,
+                                        threads);
+    mergeOuterStats(outer, result);
+    return result;
+  }
+
+  // The rest of the file is one bitstream
+  result.bytesIn = inputFile.size();
+  size_t headerSize = containerHeaderSize(header.flags);
+  const unsigned char *payload = inputFile.data() + headerSize;
+  size_t payloadSize = inputFile.size() - headerSize;
+  if (!singleStreamSizeFits(header, payloadSize)) {
+    result.error = "original size does not match the compressed data";
+    return result;
+  }
+  bool verifyOnly = outputFilename.empty();
+  MappedOutput outputFile;
+  std::vector<unsigned char> scratch;
+  unsigned char *output = nullptr;
+  if (verifyOnly) {
+    scratch.resize(header.originalSize);
+    output = scratch.data();
+  } else if (outputFile.create(outputFilename, header.originalSize)) {
+    output = outputFile.data();
+  } else {
+    result.error = "unable to create output file";
+  }
+  clock.lap(STAGE_WRITE);
+  if (result.error.empty()) {
+    decodeSingleStream(header, payload, payloadSize, findTable, output,
+                       header.originalSize, result);
+  }
+  clock.skip();
+  if (result.error.empty() &&
+      crc32c(0, output, header.originalSize) != header.checksum) {
+    result.error = "checksum mismatch";
+  }
+  clock.lap(STAGE_CHECKSUM);
+  if (!verifyOnly && !outputFile.close(header.originalSize) &&
+      result.error.empty()) {
+    result.error = "unable to write output file";
+  }
+  clock.lap(STAGE_WRITE);
+  result.stats.symbols = header.originalSize;
+  result.stats.codeBits = (uint64_t)payloadSize * 8;
+  result.stats.finish();
+  if (!result.error.empty()) {
+    if (!verifyOnly) {
+      std::remove(outputFilename.c_str());
+    }
+    return result;
+  }
+  result.ok = true;
+  result.bytesOut = header.originalSize;
+  return result;
+}
+
+//
+// readBlockRange
+//
+// Function decodes the original bytes from offset up to end of a mapped
+// blocked file into output, decoding only the blocks that hold them. A block
+// that reuses the previous table gets it from the block its header points
+// back to, or from the last block with a table of its own in files written
+// before blocks recorded that.
+inline void readBlockRange(const MappedInput &inputFile,
+                           const ContainerHeader &header, uint64_t offset,
+                           uint64_t end, std::vector<unsigned char> &output,
+                           CodecResult &result) {
+  StageClock clock(&result.stats);
+  const unsigned char *file = inputFile.data();
+  uint64_t blockSize;
+  std::vector<uint64_t> frameOffsets;
+  if (!readBlockIndex(file, inputFile.size(), header, blockSize, frameOffsets,
+                      result.error)) {
+    return;
+  }
+  auto frameSize = [&](uint64_t block) {
+    return frameOffsets[block + 1] - frameOffsets[block];
+  };
+  std::shared_ptr<const HuffmanDecoder> sharedDecoder;
+  std::shared_ptr<const HuffmanDecoder> previousDecoder;
+  std::shared_ptr<const HuffmanDecoder> decoder;
+  if (!(header.flags & CONTAINER_ADAPTIVE)) {
+    std::shared_ptr<HuffmanDecoder> headerDecoder(new HuffmanDecoder());
+    if (!singleStreamDecoder(header, nullptr, *headerDecoder, result)) {
+      return;
+    }
+    sharedDecoder = headerDecoder;
+  }
+  uint64_t first = offset / blockSize;
+  uint64_t last = (end - 1) / blockSize;
+  BlockHeader firstHeader = parseBlockHeader(file + frameOffsets[first]);
+  if (firstHeader.mode == BLOCK_PREVIOUS_TABLE) {
+    uint64_t tableBlock = first;
+    if (firstHeader.tableDistance > 0 && firstHeader.tableDistance <= first) {
+      tableBlock = first - firstHeader.tableDistance;
+    } else {
+      while (tableBlock > 0 &&
+             (tableBlock == first ||
+              file[frameOffsets[tableBlock]] != BLOCK_OWN_TABLE)) {
+        tableBlock--;
+      }
+    }
+    if (file[frameOffsets[tableBlock]] != BLOCK_OWN_TABLE ||
+        tableBlock == first) {
+      result.error = "block refers to a code table that does not exist";
+      return;
+    }
+    if (!blockTableDecoder(file + frameOffsets[tableBlock],
+                           frameSize(tableBlock), sharedDecoder,
+                           previousDecoder, decoder, result.error)) {
+      result.error += " in block " + std::to_string(tableBlock);
+      return;
+    }
+  }
+  clock.lap(STAGE_TABLES);
+
+  std::vector<unsigned char> block(blockSize);
+  for (uint64_t i = first; i <= last; i++) {
+    uint64_t blockStart = i * blockSize;
+    uint64_t blockEnd = std::min(blockStart + blockSize, header.originalSize);
+    if (!blockTableDecoder(file + frameOffsets[i], frameSize(i), sharedDecoder,
+                           previousDecoder, decoder, result.error) ||
+        !decodeContainerBlock(decoder.get(), file + frameOffsets[i],
+                              frameSize(i), block.data(),
+                              blockEnd - blockStart, header.streams,
+                              result.error, &result.stats)) {
+      result.error += " in block " + std::to_string(i);
+      return;
+    }
+    clock.skip();
+    uint64_t from = std::max(offset, blockStart) - blockStart;
+    uint64_t to = std::min(end, blockEnd) - blockStart;
+    output.insert(output.end(), block.data() + from, block.data() + to);
+    result.bytesIn += frameSize(i);
+    clock.lap(STAGE_WRITE);
+  }
+}
+
+//
+// readRange
+//
+// Function decodes `length` bytes of the original data of a .hz file from
+// `offset` on into output, fewer if the file ends first, in time that grows
+// with the range instead of the file. Blocked files only decode the blocks
+// that hold the range and check them against their checksums. Single stream
+// files have no points to start decoding at but the beginning, so they are
+// decoded up to the end of the range and cannot be checked. Streamed files
+// have no block index and are not supported.
+inline CodecResult readRange(const std::string &inputFilename, uint64_t offset,
+                             uint64_t length,
+                             std::vector<unsigned char> &output,
+                             const TableLookup &findTable = nullptr) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  output.clear();
+  MappedInput inputFile;
+  if (!inputFile.open(inputFilename)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  ContainerHeader header;
+  if (!parseContainerHeader(inputFile.data(), inputFile.size(), header,
+                            result.error)) {
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  if (header.flags & CONTAINER_STREAMED) {
+    result.error = "streamed files cannot be read at random, decompress them";
+    return result;
+  }
+  uint64_t end = offset + std::min(length, UINT64_MAX - offset);
+  end = std::min(end, header.originalSize);
+  if (offset >= end) {
+    result.ok = true;
+    return result;
+  }
+  if (header.flags & CONTAINER_BLOCKED) {
+    readBlockRange(inputFile, header, offset, end, output, result);
+  } else {
+    size_t headerSize = containerHeaderSize(header.flags);
+    size_t payloadSize = inputFile.size() - headerSize;
+    if (!singleStreamSizeFits(header, payloadSize)) {
+      result.error = "original size does not match the compressed data";
+      return result;
+    }
+    std::vector<unsigned char> prefix(end);
+    decodeSingleStream(header, inputFile.data() + headerSize, payloadSize,
+                       findTable, prefix.data(), end, result);
+    clock.skip();
+    output.assign(prefix.begin() + offset, prefix.end());
+    result.bytesIn = inputFile.size();
+    result.stats.symbols = end;
+  }
+  clock.skip();
+  result.stats.finish();
+  if (!result.error.empty()) {
+    output.clear();
+    return result;
+  }
+  result.ok = true;
+  result.bytesOut = output.size();
+  return result;
+}
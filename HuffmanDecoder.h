@@ -0,0 +1,405 @@
+// Adam Shaar
+// ashaar2
+//
+// HuffmanDecoder.h
+//
+// table-driven Huffman decoder that resolves a whole symbol per table lookup
+// instead of walking the Huffman tree one bit at a time
+#pragma once
+
+#include "FlatHuffmanTree.h"
+#include "HuffmanCode.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Width of the primary lookup table, codes longer than this continue in
+// smaller subtables
+const int DECODER_ROOT_BITS = 11;
+// Maximum width of a secondary lookup table
+const int DECODER_SUB_BITS = 8;
+// Number of decoded bytes buffered before they are written out
+const size_t DECODE_OUTPUT_SIZE = 1 << 20;
+
+// decodeSymbol results that are not symbols
+const int DECODE_END = -1;
+const int DECODE_ERROR = -2;
+
+// DecodeEntry is a single slot of a lookup table. Leaves give the symbol and
+// the number of bits it takes from this level, links point at a subtable, and
+// entries with neither are code paths that do not exist.
+struct DecodeEntry {
+  uint32_t value;  // symbol for leaves, subtable offset for links
+  uint8_t length;  // bits consumed by a leaf
+  uint8_t subBits; // width of the linked subtable, 0 for leaves
+};
+
+// BitReader keeps up to 64 upcoming bits of the input, most significant bit
+// first, so the decoder can look at many bits at once.
+struct BitReader {
+  const unsigned char *next;
+  const unsigned char *end;
+  uint64_t buffer;
+  int count;
+
+  BitReader() {
+    next = end = nullptr;
+    buffer = 0;
+    count = 0;
+  }
+
+  // Tops the bit buffer up to at least 56 bits, or to whatever is left of
+  // the input near its end
+  void refill() {
+    if (end - next >= 8) {
+      uint64_t word = (uint64_t)next[0] << 56 | (uint64_t)next[1] << 48 |
+                      (uint64_t)next[2] << 40 | (uint64_t)next[3] << 32 |
+                      (uint64_t)next[4] << 24 | (uint64_t)next[5] << 16 |
+                      (uint64_t)next[6] << 8 | (uint64_t)next[7];
+      buffer |= word >> count;
+      next += (63 - count) >> 3;
+      count |= 56;
+    } else {
+      while (count <= 56 && next < end) {
+        buffer |= (uint64_t)*next++ << (56 - count);
+        count += 8;
+      }
+    }
+  }
+
+  // Returns the next `bits` bits without consuming them
+  uint32_t peek(int bits) const { return buffer >> (64 - bits); }
+
+  // Drops `bits` bits from the front of the buffer
+  void consume(int bits) {
+    buffer <<= bits;
+    count -= bits;
+  }
+
+  // Returns true if the bits left are no more than the padding of the last
+  // byte, false if a whole byte or more was not decoded
+  bool padding() const { return count + (end - next) * 8 < 8; }
+};
+
+class HuffmanDecoder {
+public:
+  HuffmanDecoder();
+  bool build(const std::vector<HuffmanCode> &codes);
+  bool build(const std::vector<std::string> &huffmanCodes);
+  bool build(const FlatHuffmanTree &tree);
+  int decodeSymbol(BitReader &reader) const;
+  bool decodeBuffer(const unsigned char *data, size_t size,
+                    unsigned char *output, size_t count) const;
+  bool decodeInterleaved(const unsigned char *const *streams,
+                         const size_t *sizes, int streamCount,
+                         unsigned char *output, size_t count) const;
+  bool decodeSpan(const unsigned char *data, size_t size, std::ostream &out,
+                  uint64_t &bytesOut) const;
+  int maxCodeLength() const;
+
+private:
+  std::vector<DecodeEntry> table;
+  int rootBits;
+  int maxLength;
+  int buildTable(const FlatHuffmanTree &tree, uint16_t node, int bits);
+  template <int N>
+  bool decodeLanes(BitReader *readers, unsigned char *output,
+                   size_t count) const;
+};
+
+// Default constructor creates a decoder without any codes.
+inline HuffmanDecoder::HuffmanDecoder() {
+  rootBits = 0;
+  maxLength = 0;
+}
+
+//
+// build
+//
+// Function builds the lookup tables for the given integer codes, returns
+// false if the codes do not form a valid prefix code
+inline bool HuffmanDecoder::build(const std::vector<HuffmanCode> &codes) {
+  std::vector<std::string> huffmanCodes(codes.size(), "");
+  for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+    huffmanCodes[symbol] = codeString(codes[symbol]);
+  }
+  return build(huffmanCodes);
+}
+
+//
+// build
+//
+// Function builds the lookup tables for the "0"/"1" code strings of a .hi
+// file, which may be longer than an integer code can hold
+inline bool
+HuffmanDecoder::build(const std::vector<std::string> &huffmanCodes) {
+  // Put every code into a flat tree so the tables can be filled level by level
+  FlatHuffmanTree tree;
+  if (!tree.rebuild(huffmanCodes)) {
+    std::cout << "Error: Huffman codes do not form a valid prefix code"
+              << std::endl;
+    table.clear();
+    rootBits = maxLength = 0;
+    return false;
+  }
+  return build(tree);
+}
+
+// Returns the length of the longest code, 0 without codes.
+inline int HuffmanDecoder::maxCodeLength() const { return maxLength; }
+
+//
+// build
+//
+// Function replaces the lookup tables with the ones for the codes in a
+// Huffman tree
+inline bool HuffmanDecoder::build(const FlatHuffmanTree &tree) {
+  table.clear();
+  maxLength = tree.empty() ? 0 : tree.node(tree.root()).height;
+  if (maxLength == 0) {
+    rootBits = 0;
+    return false;
+  }
+  rootBits = std::min(DECODER_ROOT_BITS, maxLength);
+  buildTable(tree, tree.root(), rootBits);
+  return true;
+}
+
+//
+// buildTable
+//
+// Function appends the lookup table for the subtree at node and returns its
+// offset, recursing into subtables for codes that continue past `bits`
+inline int HuffmanDecoder::buildTable(const FlatHuffmanTree &tree,
+                                      uint16_t node, int bits) {
+  int offset = table.size();
+  table.resize(offset + (1 << bits), DecodeEntry{0, 0, 0});
+
+  for (int pattern = 0; pattern < (1 << bits); ++pattern) {
+    // Walk down the tree following the bits of this pattern
+    uint16_t current = node;
+    int depth = 0;
+    while (depth < bits) {
+      int bit = (pattern >> (bits - 1 - depth)) & 1;
+      current = tree.node(current).child[bit];
+      ++depth;
+      if (current == FlatHuffmanTree::NO_NODE || tree.isLeaf(current)) {
+        break;
+      }
+    }
+    if (current == FlatHuffmanTree::NO_NODE) {
+      // code path that does not exist, left as an invalid entry
+      continue;
+    }
+    if (tree.isLeaf(current)) {
+      table[offset + pattern] =
+          DecodeEntry{tree.node(current).symbol, (uint8_t)depth, 0};
+    } else {
+      // every internal node at this depth is reached by exactly one pattern
+      int subBits = std::min<int>(DECODER_SUB_BITS, tree.node(current).height);
+      int subOffset = buildTable(tree, current, subBits);
+      table[offset + pattern] =
+          DecodeEntry{(uint32_t)subOffset, 0, (uint8_t)subBits};
+    }
+  }
+  return offset;
+}
+
+//
+// decodeSymbol
+//
+// Function decodes the next symbol from the reader, returns DECODE_END when
+// the remaining bits do not hold a whole code and DECODE_ERROR on a code path
+// that does not exist. Input that ends inside a code longer than the root
+// table is an error too: its end is more than a byte of padding.
+inline int HuffmanDecoder::decodeSymbol(BitReader &reader) const {
+  reader.refill();
+  int bits = rootBits;
+  int end = DECODE_END;
+  DecodeEntry entry = table[reader.peek(bits)];
+  // Follow links into subtables for codes longer than the current level
+  while (entry.subBits != 0) {
+    if (reader.count < bits) {
+      return end;
+    }
+    reader.consume(bits);
+    reader.refill();
+    end = DECODE_ERROR;
+    bits = entry.subBits;
+    entry = table[entry.value + reader.peek(bits)];
+  }
+  if (entry.length == 0) {
+    return reader.count < bits ? end : DECODE_ERROR;
+  }
+  // The last byte of the input is padded with zeros, so a code may only be
+  // accepted if all of its bits were actually read
+  if (entry.length > reader.count) {
+    return end;
+  }
+  reader.consume(entry.length);
+  return entry.value;
+}
+
+//
+// decodeBuffer
+//
+// Function decodes exactly `count` symbols from the bitstream in data,
+// returns false if the bitstream ends early or holds an invalid code
+inline bool HuffmanDecoder::decodeBuffer(const unsigned char *data,
+                                         size_t size, unsigned char *output,
+                                         size_t count) const {
+  if (count == 0) {
+    return true;
+  }
+  if (rootBits == 0) {
+    return false;
+  }
+  BitReader reader;
+  reader.next = data;
+  reader.end = data + size;
+  for (size_t i = 0; i < count; ++i) {
+    int symbol = decodeSymbol(reader);
+    if (symbol < 0) {
+      return false;
+    }
+    output[i] = symbol;
+  }
+  return true;
+}
+
+//
+// decodeInterleaved
+//
+// Function decodes exactly `count` symbols from streamCount bitstreams that
+// take turns, symbol i coming from stream i % streamCount, as written by
+// HuffmanEncoder::encodeInterleaved. Returns false if a stream ends early or
+// holds an invalid code.
+inline bool
+HuffmanDecoder::decodeInterleaved(const unsigned char *const *streams,
+                                  const size_t *sizes, int streamCount,
+                                  unsigned char *output, size_t count) const {
+  if (count == 0) {
+    return true;
+  }
+  if (rootBits == 0) {
+    return false;
+  }
+  BitReader readers[MAX_INTERLEAVED_STREAMS];
+  for (int k = 0; k < streamCount; k++) {
+    readers[k].next = streams[k];
+    readers[k].end = streams[k] + sizes[k];
+  }
+  // a fixed number of lanes lets the compiler keep every reader in registers
+  switch (streamCount) {
+  case 1:
+    return decodeLanes<1>(readers, output, count);
+  case 2:
+    return decodeLanes<2>(readers, output, count);
+  case 3:
+    return decodeLanes<3>(readers, output, count);
+  case 4:
+    return decodeLanes<4>(readers, output, count);
+  case 5:
+    return decodeLanes<5>(readers, output, count);
+  case 6:
+    return decodeLanes<6>(readers, output, count);
+  case 7:
+    return decodeLanes<7>(readers, output, count);
+  case 8:
+    return decodeLanes<8>(readers, output, count);
+  }
+  return false;
+}
+
+//
+// decodeLanes
+//
+// Function decodes a symbol from each of the N readers in turn. The readers
+// do not depend on each other, so the processor overlaps their lookups
+// instead of waiting for one code to end before the next can be found.
+template <int N>
+bool HuffmanDecoder::decodeLanes(BitReader *readers, unsigned char *output,
+                                 size_t count) const {
+  size_t i = 0;
+  while (count - i >= N) {
+    // while every stream has 8 bytes left a refill holds at least 56 bits,
+    // enough for any code of the root table
+    bool room = true;
+    for (int k = 0; k < N; k++) {
+      room = room && readers[k].end - readers[k].next >= 8;
+    }
+    if (!room) {
+      break;
+    }
+    for (int k = 0; k < N; k++) {
+      BitReader &reader = readers[k];
+      reader.refill();
+      DecodeEntry entry = table[reader.peek(rootBits)];
+      if (entry.subBits == 0 && entry.length != 0) {
+        reader.consume(entry.length);
+        output[i + k] = entry.value;
+        continue;
+      }
+      // long codes and invalid ones take the careful path
+      int symbol = decodeSymbol(reader);
+      if (symbol < 0) {
+        return false;
+      }
+      output[i + k] = symbol;
+    }
+    i += N;
+  }
+  // the ends of the streams one symbol at a time
+  for (; i < count; i++) {
+    int symbol = decodeSymbol(readers[i % N]);
+    if (symbol < 0) {
+      return false;
+    }
+    output[i] = symbol;
+  }
+  return true;
+}
+
+//
+// decodeSpan
+//
+// Function decodes every code in a bitstream that is already in memory, such
+// as a mapped file, and writes the symbols to the output stream in large
+// chunks, returns false if it runs into an invalid code or the bits after the
+// last code are more than the padding of the last byte
+inline bool HuffmanDecoder::decodeSpan(const unsigned char *data, size_t size,
+                                       std::ostream &out,
+                                       uint64_t &bytesOut) const {
+  bytesOut = 0;
+  if (rootBits == 0) {
+    return false;
+  }
+  std::vector<char> output(DECODE_OUTPUT_SIZE);
+  size_t outputCount = 0;
+  BitReader reader;
+  reader.next = data;
+  reader.end = data + size;
+  bool ok = true;
+  while (true) {
+    int symbol = decodeSymbol(reader);
+    if (symbol == DECODE_END) {
+      ok = reader.padding();
+      break;
+    }
+    if (symbol == DECODE_ERROR) {
+      ok = false;
+      break;
+    }
+    output[outputCount++] = symbol;
+    if (outputCount == output.size()) {
+      out.write(output.data(), outputCount);
+      bytesOut += outputCount;
+      outputCount = 0;
+    }
+  }
+  out.write(output.data(), outputCount);
+  bytesOut += outputCount;
+  return ok;
+}
@@ -0,0 +1,254 @@
+// Adam Shaar
+// ashaar2
+//
+// HuffmanEncoder.h
+//
+// Huffman encoder that packs integer codes into a 64-bit accumulator and
+// writes the compressed bits out in large blocks
+#pragma once
+
+#include "HuffmanCode.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Number of input bytes encoded at a time
+const size_t ENCODE_CHUNK_SIZE = 1 << 20;
+// Number of compressed bytes buffered before they are written out
+const size_t ENCODE_OUTPUT_SIZE = 1 << 20;
+// Number of compressed bytes buffered before they are appended to memory
+const size_t ENCODE_MEMORY_OUTPUT_SIZE = 1 << 16;
+
+// BitWriter packs bits most significant bit first into a 64-bit accumulator
+// and moves them to the output stream, or appends them to a byte vector, a
+// block at a time.
+class BitWriter {
+public:
+  BitWriter(std::ostream &out);
+  BitWriter(std::vector<unsigned char> &memory);
+  void write(uint64_t bits, int length);
+  void flush();
+  uint64_t bytesWritten() const;
+
+private:
+  std::ostream *out;
+  std::vector<unsigned char> *memory;
+  std::vector<char> block;
+  size_t blockCount;
+  uint64_t accumulator;
+  int count;
+  uint64_t written;
+  void writeBits(uint32_t bits, int length);
+  void flushBlock();
+};
+
+// Constructor creates an empty writer for the given output stream.
+inline BitWriter::BitWriter(std::ostream &out)
+    : out(&out), memory(nullptr), block(ENCODE_OUTPUT_SIZE + 8) {
+  blockCount = 0;
+  accumulator = 0;
+  count = 0;
+  written = 0;
+}
+
+// Constructor creates an empty writer that appends to the given vector.
+inline BitWriter::BitWriter(std::vector<unsigned char> &memory)
+    : out(nullptr), memory(&memory), block(ENCODE_MEMORY_OUTPUT_SIZE + 8) {
+  blockCount = 0;
+  accumulator = 0;
+  count = 0;
+  written = 0;
+}
+
+//
+// write
+//
+// Function appends the lowest `length` bits of `bits` (at most 64)
+inline void BitWriter::write(uint64_t bits, int length) {
+  if (length > 32) {
+    writeBits(bits >> 32, length - 32);
+    length = 32;
+  }
+  writeBits(bits, length);
+}
+
+//
+// writeBits
+//
+// Function appends up to 32 bits to the accumulator and moves every complete
+// 32-bit word into the output block
+inline void BitWriter::writeBits(uint32_t bits, int length) {
+  if (length == 0) {
+    return;
+  }
+  if (length < 32) {
+    bits &= (1u << length) - 1;
+  }
+  // the accumulator holds fewer than 32 pending bits, so the shift never
+  // pushes pending bits out of the top
+  accumulator = (accumulator << length) | bits;
+  count += length;
+  if (count >= 32) {
+    count -= 32;
+    uint32_t word = accumulator >> count;
+    block[blockCount] = word >> 24;
+    block[blockCount + 1] = word >> 16;
+    block[blockCount + 2] = word >> 8;
+    block[blockCount + 3] = word;
+    blockCount += 4;
+    if (blockCount >= block.size() - 8) {
+      flushBlock();
+    }
+  }
+}
+
+//
+// flush
+//
+// Function writes out the pending bits, padding the last byte with zeros, and
+// empties the output block
+inline void BitWriter::flush() {
+  while (count >= 8) {
+    count -= 8;
+    block[blockCount++] = accumulator >> count;
+  }
+  if (count > 0) {
+    block[blockCount++] = accumulator << (8 - count);
+    count = 0;
+  }
+  flushBlock();
+}
+
+// Returns the number of bytes handed to the output stream so far.
+inline uint64_t BitWriter::bytesWritten() const { return written; }
+
+//
+// flushBlock
+//
+// Function writes the buffered output block to the output stream or memory
+inline void BitWriter::flushBlock() {
+  if (out != nullptr) {
+    out->write(block.data(), blockCount);
+  } else {
+    memory->insert(memory->end(), block.begin(), block.begin() + blockCount);
+  }
+  written += blockCount;
+  blockCount = 0;
+}
+
+class HuffmanEncoder {
+public:
+  HuffmanEncoder();
+  bool build(const std::vector<HuffmanCode> &huffmanCodes);
+  bool build(const std::vector<std::string> &huffmanCodes);
+  void encodeBlock(const unsigned char *data, size_t size,
+                   BitWriter &writer) const;
+  void
+  encodeInterleaved(const unsigned char *data, size_t size,
+                    std::vector<std::vector<unsigned char>> &streams) const;
+
+private:
+  std::vector<HuffmanCode> codes;
+  // codes longer than MAX_CODE_LENGTH bits, split into 64-bit pieces
+  std::vector<std::vector<HuffmanCode>> longCodes;
+  void encodeSymbol(unsigned char symbol, BitWriter &writer) const;
+};
+
+// Default constructor creates an encoder without any codes.
+inline HuffmanEncoder::HuffmanEncoder() {}
+
+//
+// build
+//
+// Function stores the integer codes used by encodeBlock
+inline bool
+HuffmanEncoder::build(const std::vector<HuffmanCode> &huffmanCodes) {
+  // one entry for every byte value, bytes without a code write nothing
+  codes.assign(ALPHABET_SIZE, HuffmanCode());
+  std::copy(huffmanCodes.begin(), huffmanCodes.end(), codes.begin());
+  longCodes.assign(codes.size(), std::vector<HuffmanCode>());
+  return true;
+}
+
+//
+// build
+//
+// Function converts the "0"/"1" code strings of a .hi file into integer codes,
+// keeping codes too long for one integer as a list of pieces
+inline bool
+HuffmanEncoder::build(const std::vector<std::string> &huffmanCodes) {
+  std::vector<HuffmanCode> integerCodes;
+  if (!codesFromStrings(huffmanCodes, integerCodes, true)) {
+    return false;
+  }
+  build(integerCodes);
+  // split the codes that do not fit in one integer into 64-bit pieces
+  for (size_t symbol = 0; symbol < huffmanCodes.size(); ++symbol) {
+    const std::string &code = huffmanCodes[symbol];
+    if (code.size() <= MAX_CODE_LENGTH) {
+      continue;
+    }
+    for (size_t start = 0; start < code.size(); start += MAX_CODE_LENGTH) {
+      int length = std::min<size_t>(MAX_CODE_LENGTH, code.size() - start);
+      uint64_t bits = 0;
+      for (size_t i = start; i < start + length; ++i) {
+        bits = (bits << 1) | (code[i] == '1');
+      }
+      longCodes[symbol].push_back(HuffmanCode(bits, length));
+    }
+  }
+  return true;
+}
+
+//
+// encodeBlock
+//
+// Function writes the code of every byte in the block to the bit writer
+inline void HuffmanEncoder::encodeBlock(const unsigned char *data, size_t size,
+                                        BitWriter &writer) const {
+  for (size_t i = 0; i < size; ++i) {
+    encodeSymbol(data[i], writer);
+  }
+}
+
+//
+// encodeInterleaved
+//
+// Function splits the block into streams.size() bitstreams, byte i going to
+// stream i % streams.size(), so that a decoder can work on every stream at
+// once. Every stream is padded to whole bytes on its own.
+inline void HuffmanEncoder::encodeInterleaved(
+    const unsigned char *data, size_t size,
+    std::vector<std::vector<unsigned char>> &streams) const {
+  std::vector<BitWriter> writers;
+  writers.reserve(streams.size());
+  for (std::vector<unsigned char> &stream : streams) {
+    stream.clear();
+    writers.emplace_back(stream);
+  }
+  size_t lane = 0;
+  for (size_t i = 0; i < size; ++i) {
+    encodeSymbol(data[i], writers[lane]);
+    if (++lane == writers.size()) {
+      lane = 0;
+    }
+  }
+  for (BitWriter &writer : writers) {
+    writer.flush();
+  }
+}
+
+// Writes the code of one byte, in pieces if it is too long for one integer.
+inline void HuffmanEncoder::encodeSymbol(unsigned char symbol,
+                                         BitWriter &writer) const {
+  const HuffmanCode &code = codes[symbol];
+  if (code.length <= MAX_CODE_LENGTH) {
+    writer.write(code.bits, code.length);
+  } else {
+    for (const HuffmanCode &piece : longCodes[symbol]) {
+      writer.write(piece.bits, piece.length);
+    }
+  }
+}
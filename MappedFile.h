@@ -0,0 +1,244 @@
+// Adam Shaar
+// ashaar2
+//
+// MappedFile.h
+//
+// whole files mapped into memory, so the codecs work on the file contents in
+// place instead of copying them through streams. Systems without mmap read
+// the input into memory and write the output when it is closed.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define MAPPED_FILE_MMAP 0
+#endif
+
+// MappedInput is a read-only view of a whole file.
+class MappedInput {
+public:
+  MappedInput();
+  ~MappedInput();
+  MappedInput(const MappedInput &other) = delete;
+  MappedInput &operator=(const MappedInput &other) = delete;
+
+  bool open(const std::string &filename);
+  void close();
+  const unsigned char *data() const;
+  size_t size() const;
+
+private:
+  const unsigned char *address;
+  size_t length;
+  std::vector<unsigned char> copy;
+};
+
+// MappedOutput is a writable view of a new file of a size fixed up front,
+// which can be cut down to the bytes actually written when it is closed.
+class MappedOutput {
+public:
+  MappedOutput();
+  ~MappedOutput();
+  MappedOutput(const MappedOutput &other) = delete;
+  MappedOutput &operator=(const MappedOutput &other) = delete;
+
+  bool create(const std::string &filename, size_t size);
+  bool close(size_t finalSize);
+  unsigned char *data();
+  size_t size() const;
+
+private:
+  unsigned char *address;
+  size_t length;
+  std::string filename;
+  int descriptor;
+  std::vector<unsigned char> copy;
+};
+
+// Default constructor creates an empty view.
+inline MappedInput::MappedInput() {
+  address = nullptr;
+  length = 0;
+}
+
+// Destructor unmaps the file.
+inline MappedInput::~MappedInput() { close(); }
+
+//
+// open
+//
+// Function maps the whole file and tells the system it is read front to
+// back, returns false if the file cannot be opened or mapped
+inline bool MappedInput::open(const std::string &filename) {
+  close();
+#if MAPPED_FILE_MMAP
+  int descriptor = ::open(filename.c_str(), O_RDONLY);
+  if (descriptor < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(descriptor, &status) != 0 || !S_ISREG(status.st_mode)) {
+    ::close(descriptor);
+    return false;
+  }
+  length = status.st_size;
+  // an empty file cannot be mapped, but then there is nothing to read either
+  if (length > 0) {
+    void *mapping =
+        mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (mapping == MAP_FAILED) {
+      ::close(descriptor);
+      length = 0;
+      return false;
+    }
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    address = (const unsigned char *)mapping;
+  }
+  // the mapping stays valid after the descriptor is closed
+  ::close(descriptor);
+  return true;
+#else
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  copy.resize(file.tellg());
+  file.seekg(0);
+  file.read((char *)copy.data(), copy.size());
+  if (file.gcount() != copy.size()) {
+    copy.clear();
+    return false;
+  }
+  address = copy.data();
+  length = copy.size();
+  return true;
+#endif
+}
+
+//
+// close
+//
+// Function unmaps the file, the view is empty afterwards
+inline void MappedInput::close() {
+#if MAPPED_FILE_MMAP
+  if (address != nullptr) {
+    munmap((void *)address, length);
+  }
+#endif
+  copy.clear();
+  address = nullptr;
+  length = 0;
+}
+
+// Returns the first byte of the file, null for an empty file.
+inline const unsigned char *MappedInput::data() const { return address; }
+
+// Returns the size of the file in bytes.
+inline size_t MappedInput::size() const { return length; }
+
+// Default constructor creates an empty view.
+inline MappedOutput::MappedOutput() {
+  address = nullptr;
+  length = 0;
+  descriptor = -1;
+}
+
+// Destructor unmaps the file, keeping whatever was written to it.
+inline MappedOutput::~MappedOutput() { close(length); }
+
+//
+// create
+//
+// Function creates (or truncates) the file, reserves `size` bytes of disk
+// space for it and maps them, returns false if any of that fails
+inline bool MappedOutput::create(const std::string &filename, size_t size) {
+  close(length);
+  this->filename = filename;
+#if MAPPED_FILE_MMAP
+  descriptor = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (descriptor < 0) {
+    return false;
+  }
+  if (size > 0) {
+    // reserve the blocks up front so the file does not grow a page at a time,
+    // falling back to a sparse file where that is not supported
+#if defined(__linux__)
+    if (posix_fallocate(descriptor, 0, size) != 0 &&
+        ftruncate(descriptor, size) != 0) {
+#else
+    if (ftruncate(descriptor, size) != 0) {
+#endif
+      ::close(descriptor);
+      descriptor = -1;
+      return false;
+    }
+    void *mapping =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    if (mapping == MAP_FAILED) {
+      ::close(descriptor);
+      descriptor = -1;
+      return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    address = (unsigned char *)mapping;
+  }
+  length = size;
+  return true;
+#else
+  std::ofstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  copy.resize(size);
+  address = copy.data();
+  length = size;
+  return true;
+#endif
+}
+
+//
+// close
+//
+// Function unmaps the file and cuts it down to finalSize bytes, returns false
+// if the data could not be written
+inline bool MappedOutput::close(size_t finalSize) {
+  bool ok = true;
+#if MAPPED_FILE_MMAP
+  if (address != nullptr) {
+    ok = munmap(address, length) == 0;
+  }
+  if (descriptor >= 0) {
+    ok = ftruncate(descriptor, finalSize) == 0 && ok;
+    ok = ::close(descriptor) == 0 && ok;
+  }
+#else
+  if (!filename.empty()) {
+    std::ofstream file(filename, std::ios::binary);
+    file.write((char *)copy.data(), std::min(finalSize, copy.size()));
+    ok = (bool)file;
+  }
+  copy.clear();
+#endif
+  address = nullptr;
+  length = 0;
+  descriptor = -1;
+  filename.clear();
+  return ok;
+}
+
+// Returns the first byte of the mapping, null for an empty file.
+inline unsigned char *MappedOutput::data() { return address; }
+
+// Returns the size of the mapping in bytes.
+inline size_t MappedOutput::size() const { return length; }
@@ -0,0 +1,156 @@
+// Adam Shaar
+// ashaar2
+//
+// RunLength.h
+//
+// reversible run-length preprocessing in front of the Huffman coder. A
+// Huffman code takes at least one bit per byte, so a long run of the same
+// byte costs a bit per byte for nothing. Here every run of RUN_LENGTH_MIN or
+// more equal bytes is written as RUN_LENGTH_MIN copies of the byte followed
+// by a count byte of how many more copies follow (0 to RUN_LENGTH_MAX_EXTRA);
+// longer runs start again after that. Data without runs grows by at most a
+// quarter, only for runs of exactly RUN_LENGTH_MIN bytes.
+//
+// Both directions work on a piece of data at a time and carry the run in
+// progress over to the next piece, so neither needs the whole transformed
+// data in memory.
+#pragma once
+
+#include "HuffmanCode.h"
+#include "HuffmanDecoder.h"
+#include <algorithm>
+#include <cstdint>
+
+// Equal bytes written out before a count byte
+const int RUN_LENGTH_MIN = 4;
+// Most copies a count byte can add
+const int RUN_LENGTH_MAX_EXTRA = 255;
+
+// Returns the most bytes RunLengthEncoder::encode writes for size bytes.
+inline size_t runLengthBound(size_t size) {
+  return size + size / RUN_LENGTH_MIN + 2;
+}
+
+// RunLengthEncoder turns pieces of data into their run-length form.
+class RunLengthEncoder {
+public:
+  RunLengthEncoder();
+  size_t encode(const unsigned char *data, size_t size, unsigned char *out);
+  size_t finish(unsigned char *out);
+
+private:
+  int last;  // previous byte, -1 before the first
+  int run;   // equal bytes written in a row, up to RUN_LENGTH_MIN
+  int extra; // copies counted after RUN_LENGTH_MIN written ones
+};
+
+// RunLengthDecoder turns run-length symbols back into the original bytes.
+class RunLengthDecoder {
+public:
+  RunLengthDecoder();
+  void put(unsigned char symbol, unsigned char *output, size_t &produced,
+           size_t capacity);
+
+private:
+  int last;
+  int run;
+};
+
+// Constructor starts without a run.
+inline RunLengthEncoder::RunLengthEncoder() {
+  last = -1;
+  run = 0;
+  extra = 0;
+}
+
+//
+// encode
+//
+// Function writes the run-length form of the next piece of the data to out,
+// which must have room for runLengthBound(size) bytes, and returns the number
+// of bytes written. A run still going at the end of the piece is only
+// counted, its count byte is written once it ends.
+inline size_t RunLengthEncoder::encode(const unsigned char *data, size_t size,
+                                       unsigned char *out) {
+  unsigned char *next = out;
+  for (size_t i = 0; i < size; i++) {
+    unsigned char byte = data[i];
+    if (run == RUN_LENGTH_MIN) {
+      if (byte == last && extra < RUN_LENGTH_MAX_EXTRA) {
+        extra++;
+        continue;
+      }
+      *next++ = extra;
+      run = 0;
+      extra = 0;
+    }
+    run = byte == last ? run + 1 : 1;
+    last = byte;
+    *next++ = byte;
+  }
+  return next - out;
+}
+
+// Writes the count byte of a run still going at the end of the data to out,
+// returns the number of bytes written.
+inline size_t RunLengthEncoder::finish(unsigned char *out) {
+  if (run != RUN_LENGTH_MIN) {
+    return 0;
+  }
+  out[0] = extra;
+  run = 0;
+  extra = 0;
+  return 1;
+}
+
+// Constructor starts without a run.
+inline RunLengthDecoder::RunLengthDecoder() {
+  last = -1;
+  run = 0;
+}
+
+//
+// put
+//
+// Function writes the bytes the next symbol stands for to output at
+// produced, which must be below capacity, but no more than fit in capacity
+// bytes. A run cut short there is where a prefix of the data ends, a damaged
+// file fails its checksum.
+inline void RunLengthDecoder::put(unsigned char symbol, unsigned char *output,
+                                  size_t &produced, size_t capacity) {
+  if (run == RUN_LENGTH_MIN) {
+    size_t copies = std::min<size_t>(symbol, capacity - produced);
+    std::fill(output + produced, output + produced + copies, last);
+    produced += copies;
+    run = 0;
+    return;
+  }
+  run = symbol == last ? run + 1 : 1;
+  last = symbol;
+  output[produced++] = symbol;
+}
+
+//
+// decodeRunLength
+//
+// Function decodes run-length symbols from the bitstream in data and undoes
+// the run-length form as it goes, until exactly `count` original bytes are
+// in output. Returns false if the bitstream ends early or holds an invalid
+// code.
+inline bool decodeRunLength(const HuffmanDecoder &decoder,
+                            const unsigned char *data, size_t size,
+                            unsigned char *output, size_t count) {
+  BitReader reader;
+  reader.next = data;
+  reader.end = data + size;
+  RunLengthDecoder runs;
+  size_t produced = 0;
+  while (produced < count) {
+    int symbol = decoder.decodeSymbol(reader);
+    if (symbol < 0) {
+      return false;
+    }
+    runs.put(symbol, output, produced, count);
+  }
+  return true;
+}
@@ -0,0 +1,328 @@
+// Adam Shaar
+// ashaar2
+//
+// StreamPipeline.h
+//
+// reading, coding and writing of streams on three threads at once. A reader
+// thread fills blocks of input, the codec works on them on the calling
+// thread and a writer thread writes its output, so waiting on slow storage
+// on one side does not hold up the other two.
+#pragma once
+
+#include "CodecStats.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Size of the blocks passed between the threads of a pipeline
+const size_t PIPELINE_BLOCK_SIZE = 1 << 20;
+// Blocks in each ring, reading and writing can run this far ahead
+const size_t PIPELINE_DEPTH = 4;
+// Times a thread checks a ring again before it goes to sleep on it
+const int PIPELINE_SPINS = 64;
+
+// PipelineBlock is one reusable buffer of a ring and the bytes it holds.
+struct PipelineBlock {
+  std::vector<unsigned char> data;
+  size_t size;
+};
+
+// BlockRing passes blocks from one producer thread to one consumer thread.
+// The blocks are allocated once and handed back and forth through two
+// counters, which both sides update without a lock. A side only takes the
+// lock to sleep when the ring is full or empty, and the other side only
+// takes it to wake a sleeper.
+class BlockRing {
+public:
+  BlockRing(size_t depth, size_t blockSize);
+  BlockRing(const BlockRing &other) = delete;
+  BlockRing &operator=(const BlockRing &other) = delete;
+
+  PipelineBlock *beginWrite();
+  void endWrite();
+  PipelineBlock *beginRead();
+  void endRead();
+  void close();
+  void cancel();
+  bool cancelled() const;
+
+private:
+  std::vector<PipelineBlock> blocks;
+  std::atomic<uint64_t> head; // blocks read so far
+  std::atomic<uint64_t> tail; // blocks written so far
+  std::atomic<bool> closed;   // the producer has no more blocks
+  std::atomic<bool> stopped;  // the consumer wants no more blocks
+  std::atomic<int> sleepers;
+  std::mutex mutex;
+  std::condition_variable changed;
+  template <class Ready> void wait(Ready ready);
+  void wake();
+};
+
+// StreamPipeline reads an input stream and writes an output stream on
+// threads of its own while the caller codes the blocks in between.
+class StreamPipeline {
+public:
+  StreamPipeline(std::istream &in, std::ostream &out);
+  ~StreamPipeline();
+  StreamPipeline(const StreamPipeline &other) = delete;
+  StreamPipeline &operator=(const StreamPipeline &other) = delete;
+
+  size_t read(const unsigned char *&data);
+  template <class Pull> void drain(Pull pull);
+  bool finish(CodecStats &stats);
+
+private:
+  std::istream &in;
+  std::ostream &out;
+  std::ostream *tied;
+  BlockRing input;
+  BlockRing output;
+  bool reading; // a block of input is held by the caller
+  bool joined;
+  CodecStats readStats;
+  CodecStats writeStats;
+  std::thread reader;
+  std::thread writer;
+  void readLoop();
+  void writeLoop();
+};
+
+// Constructor allocates depth blocks of blockSize bytes.
+inline BlockRing::BlockRing(size_t depth, size_t blockSize) : blocks(depth) {
+  for (PipelineBlock &block : blocks) {
+    block.data.resize(blockSize);
+    block.size = 0;
+  }
+  head = 0;
+  tail = 0;
+  closed = false;
+  stopped = false;
+  sleepers = 0;
+}
+
+//
+// beginWrite
+//
+// Function waits for a free block and returns it for the producer to fill,
+// or returns null if the consumer has cancelled the ring
+inline PipelineBlock *BlockRing::beginWrite() {
+  wait([this]() { return stopped || tail - head < blocks.size(); });
+  if (stopped) {
+    return nullptr;
+  }
+  return &blocks[tail % blocks.size()];
+}
+
+// Hands the block from beginWrite to the consumer.
+inline void BlockRing::endWrite() {
+  tail.fetch_add(1);
+  wake();
+}
+
+//
+// beginRead
+//
+// Function waits for the next block written by the producer and returns it,
+// or returns null once the ring is closed and every block has been read
+inline PipelineBlock *BlockRing::beginRead() {
+  wait([this]() { return head != tail || closed; });
+  if (head == tail) {
+    return nullptr;
+  }
+  return &blocks[head % blocks.size()];
+}
+
+// Gives the block from beginRead back to the producer.
+inline void BlockRing::endRead() {
+  head.fetch_add(1);
+  wake();
+}
+
+// Tells the consumer that no more blocks will be written.
+inline void BlockRing::close() {
+  closed = true;
+  wake();
+}
+
+// Tells the producer that no more blocks will be read.
+inline void BlockRing::cancel() {
+  stopped = true;
+  wake();
+}
+
+// Returns true if the consumer has cancelled the ring.
+inline bool BlockRing::cancelled() const { return stopped; }
+
+//
+// wait
+//
+// Function returns once ready() is true, checking it a few times before
+// sleeping until the other side changes the ring. The sleeper count is
+// raised before the last check, so a change made after it is seen by wake.
+template <class Ready> void BlockRing::wait(Ready ready) {
+  for (int spin = 0; spin < PIPELINE_SPINS; spin++) {
+    if (ready()) {
+      return;
+    }
+    std::this_thread::yield();
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  sleepers.fetch_add(1);
+  changed.wait(lock, ready);
+  sleepers.fetch_sub(1);
+}
+
+// Wakes the other side if it is asleep.
+inline void BlockRing::wake() {
+  if (sleepers.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex);
+    changed.notify_all();
+  }
+}
+
+// Constructor starts the reader and writer threads. The input stream is
+// untied from any output stream while they run, so that reading does not
+// flush a stream the writer thread is writing.
+inline StreamPipeline::StreamPipeline(std::istream &in, std::ostream &out)
+    : in(in), out(out), input(PIPELINE_DEPTH, PIPELINE_BLOCK_SIZE),
+      output(PIPELINE_DEPTH, PIPELINE_BLOCK_SIZE) {
+  tied = in.tie(nullptr);
+  reading = false;
+  joined = false;
+  reader = std::thread(&StreamPipeline::readLoop, this);
+  writer = std::thread(&StreamPipeline::writeLoop, this);
+}
+
+// Destructor stops and joins the threads if finish was not called.
+inline StreamPipeline::~StreamPipeline() {
+  if (!joined) {
+    CodecStats ignored;
+    finish(ignored);
+  }
+}
+
+//
+// read
+//
+// Function gives the block of input read before back to the reader and
+// points data at the next one, returns its size or 0 at the end of the input
+// or once the output can no longer be written
+inline size_t StreamPipeline::read(const unsigned char *&data) {
+  if (reading) {
+    input.endRead();
+    reading = false;
+  }
+  PipelineBlock *block = output.cancelled() ? nullptr : input.beginRead();
+  if (block == nullptr) {
+    return 0;
+  }
+  reading = true;
+  data = block->data.data();
+  return block->size;
+}
+
+//
+// drain
+//
+// Function fills blocks of output with pull(buffer, capacity) until it
+// returns 0 and hands every filled block to the writer
+template <class Pull> void StreamPipeline::drain(Pull pull) {
+  while (true) {
+    PipelineBlock *block = output.beginWrite();
+    if (block == nullptr) {
+      // the writer failed, what is left is thrown away
+      unsigned char discard[4096];
+      while (pull(discard, sizeof(discard)) > 0) {
+      }
+      return;
+    }
+    block->size = 0;
+    size_t got;
+    while (block->size < block->data.size() &&
+           (got = pull(block->data.data() + block->size,
+                       block->data.size() - block->size)) > 0) {
+      block->size += got;
+    }
+    if (block->size == 0) {
+      return;
+    }
+    bool full = block->size == block->data.size();
+    output.endWrite();
+    if (!full) {
+      return;
+    }
+  }
+}
+
+//
+// finish
+//
+// Function stops reading, waits until the writer has written every block,
+// adds the time both threads spent to stats and returns false if the output
+// could not be written. A read the reader thread is already waiting on still
+// has to finish.
+inline bool StreamPipeline::finish(CodecStats &stats) {
+  if (!joined) {
+    input.cancel();
+    output.close();
+    reader.join();
+    writer.join();
+    in.tie(tied);
+    joined = true;
+  }
+  stats.merge(readStats);
+  stats.merge(writeStats);
+  return !output.cancelled();
+}
+
+//
+// readLoop
+//
+// Function runs on the reader thread, filling blocks of input until the
+// stream ends or the caller stops reading
+inline void StreamPipeline::readLoop() {
+  StageClock clock(&readStats);
+  PipelineBlock *block;
+  while (in && (block = input.beginWrite()) != nullptr) {
+    clock.skip();
+    in.read((char *)block->data.data(), block->data.size());
+    block->size = in.gcount();
+    clock.lap(STAGE_READ);
+    if (block->size == 0) {
+      break;
+    }
+    input.endWrite();
+  }
+  input.close();
+}
+
+//
+// writeLoop
+//
+// Function runs on the writer thread, writing every block of output in
+// order and cancelling the output if the stream fails
+inline void StreamPipeline::writeLoop() {
+  StageClock clock(&writeStats);
+  PipelineBlock *block;
+  while ((block = output.beginRead()) != nullptr) {
+    clock.skip();
+    out.write((const char *)block->data.data(), block->size);
+    clock.lap(STAGE_WRITE);
+    output.endRead();
+    if (!out) {
+      output.cancel();
+      return;
+    }
+  }
+  clock.skip();
+  out.flush();
+  clock.lap(STAGE_WRITE);
+  if (!out) {
+    output.cancel();
+  }
+}
@@ -0,0 +1,314 @@
+// Adam Shaar
+// ashaar2
+//
+// TableCache.h
+//
+// a file of code tables shared by a family of similar files, such as the logs
+// of one service. Every file of the family is compressed with a table of the
+// cache and refers to it by its ID, so small files do not carry a table of
+// their own and are not counted twice to build one.
+//
+// .htc format, all integers little-endian:
+//   4 bytes   magic "HZTC"
+//   1 byte    format version
+//   3 bytes   reserved, 0
+//   4 bytes   number of tables
+// every table, once for each name it was added under:
+//   4 bytes   table ID
+//   1 byte    name length
+//   ...       name
+//   ...       code lengths in the compact block table form
+// and at the end:
+//   4 bytes   CRC-32C of everything before it
+//
+// The ID of a table is the CRC-32C of its 256 code lengths, so the same table
+// has the same ID in every cache. A name refers to the table added last under
+// it, older tables of the name stay in the cache for the files that use them.
+#pragma once
+
+#include "HuffmanContainer.h"
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+const unsigned char TABLE_CACHE_MAGIC[4] = {'H', 'Z', 'T', 'C'};
+const int TABLE_CACHE_VERSION = 1;
+const size_t TABLE_CACHE_HEADER_SIZE = 12;
+const size_t MAX_TABLE_NAME_LENGTH = 255;
+
+// CachedTable is one table of a cache with its encoder and decoder, which are
+// built once when the table is loaded or added.
+struct CachedTable {
+  uint32_t id;
+  std::string name;
+  std::vector<int> codeLengths;
+  HuffmanEncoder encoder;
+  HuffmanDecoder decoder;
+};
+
+// TableCache holds the tables of a .htc file. Looking tables up does not
+// change the cache, so once it is loaded any number of threads may share it.
+class TableCache {
+public:
+  bool load(const std::string &filename, std::string &error);
+  bool save(const std::string &filename, std::string &error) const;
+  std::shared_ptr<const CachedTable> add(const std::string &name,
+                                         const std::vector<int> &codeLengths,
+                                         std::string &error);
+  std::shared_ptr<const CachedTable> find(uint32_t id) const;
+  std::shared_ptr<const CachedTable> findName(const std::string &name) const;
+  const HuffmanDecoder *decoder(uint32_t id) const;
+  TableLookup lookup() const;
+  size_t size() const;
+
+private:
+  std::vector<std::shared_ptr<const CachedTable>> tables;
+  std::map<uint32_t, std::shared_ptr<const CachedTable>> byId;
+  std::map<std::string, std::shared_ptr<const CachedTable>> byName;
+};
+
+// Returns the ID of a table of code lengths.
+inline uint32_t tableId(const std::vector<int> &codeLengths) {
+  unsigned char lengths[ALPHABET_SIZE];
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    lengths[i] = codeLengths[i];
+  }
+  return crc32c(0, lengths, ALPHABET_SIZE);
+}
+
+//
+// load
+//
+// Function adds the tables of a .htc file to the cache, returns false with
+// an error if the file cannot be read or is damaged
+inline bool TableCache::load(const std::string &filename, std::string &error) {
+  MappedInput file;
+  if (!file.open(filename)) {
+    error = "unable to open table cache " + filename;
+    return false;
+  }
+  const unsigned char *data = file.data();
+  size_t size = file.size();
+  if (size < TABLE_CACHE_HEADER_SIZE + 4 ||
+      !std::equal(TABLE_CACHE_MAGIC, TABLE_CACHE_MAGIC + 4, data)) {
+    error = filename + " is not a table cache";
+    return false;
+  }
+  if (data[4] != TABLE_CACHE_VERSION) {
+    error = "unsupported table cache version " + std::to_string(data[4]);
+    return false;
+  }
+  size -= 4;
+  if (crc32c(0, data, size) != getLittleEndian(data + size, 4)) {
+    error = "table cache checksum mismatch";
+    return false;
+  }
+  uint64_t count = getLittleEndian(data + 8, 4);
+  size_t offset = TABLE_CACHE_HEADER_SIZE;
+  for (uint64_t i = 0; i < count; i++) {
+    if (size - offset < 5 || size - offset - 5 < data[offset + 4]) {
+      error = "table cache is truncated";
+      return false;
+    }
+    uint32_t id = getLittleEndian(data + offset, 4);
+    std::string name((const char *)data + offset + 5, data[offset + 4]);
+    offset += 5 + name.size();
+    std::vector<int> codeLengths;
+    size_t used = 0;
+    if (!parseCodeLengths(data + offset, size - offset, codeLengths, used)) {
+      error = "invalid table " + name + " in the table cache";
+      return false;
+    }
+    offset += used;
+    if (tableId(codeLengths) != id) {
+      error = "table " + name + " does not match its ID";
+      return false;
+    }
+    if (!add(name, codeLengths, error)) {
+      return false;
+    }
+  }
+  if (offset != size) {
+    error = "table cache has trailing data";
+    return false;
+  }
+  return true;
+}
+
+//
+// save
+//
+// Function writes every table of the cache to a .htc file. The file is
+// written under a temporary name and renamed, so a process loading the cache
+// at the same time sees either the old or the new tables.
+inline bool TableCache::save(const std::string &filename,
+                             std::string &error) const {
+  std::vector<unsigned char> bytes(TABLE_CACHE_HEADER_SIZE, 0);
+  std::copy(TABLE_CACHE_MAGIC, TABLE_CACHE_MAGIC + 4, bytes.begin());
+  bytes[4] = TABLE_CACHE_VERSION;
+  putLittleEndian(bytes.data() + 8, tables.size(), 4);
+  for (const std::shared_ptr<const CachedTable> &table : tables) {
+    size_t offset = bytes.size();
+    bytes.resize(offset + 5);
+    putLittleEndian(bytes.data() + offset, table->id, 4);
+    bytes[offset + 4] = table->name.size();
+    bytes.insert(bytes.end(), table->name.begin(), table->name.end());
+    appendCodeLengths(table->codeLengths, bytes);
+  }
+  size_t offset = bytes.size();
+  bytes.resize(offset + 4);
+  putLittleEndian(bytes.data() + offset, crc32c(0, bytes.data(), offset), 4);
+
+  std::string temporary = filename + ".tmp";
+  std::ofstream file(temporary, std::ios::binary);
+  if (!file.is_open()) {
+    error = "unable to create " + temporary;
+    return false;
+  }
+  file.write((const char *)bytes.data(), bytes.size());
+  file.close();
+  if (!file || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    error = "unable to write table cache " + filename;
+    return false;
+  }
+  return true;
+}
+
+//
+// add
+//
+// Function builds the encoder and decoder of a table and adds it to the
+// cache under the given name, returns the table or null with an error. The
+// lengths must fit the compact table form, DEFAULT_MAX_CODE_LENGTH bits at
+// most. A table the cache already has may be added under another name.
+inline std::shared_ptr<const CachedTable>
+TableCache::add(const std::string &name, const std::vector<int> &codeLengths,
+                std::string &error) {
+  if (name.empty() || name.size() > MAX_TABLE_NAME_LENGTH) {
+    error = "table names take 1 to 255 characters";
+    return nullptr;
+  }
+  std::shared_ptr<CachedTable> table(new CachedTable());
+  table->name = name;
+  table->codeLengths = codeLengths;
+  std::vector<HuffmanCode> codes;
+  bool valid = codeLengths.size() == ALPHABET_SIZE;
+  for (int i = 0; valid && i < ALPHABET_SIZE; i++) {
+    valid = codeLengths[i] >= 0 && codeLengths[i] <= DEFAULT_MAX_CODE_LENGTH;
+  }
+  if (!valid || !assignCanonicalCodes(codeLengths, codes) ||
+      !table->encoder.build(codes) || !table->decoder.build(codes)) {
+    error = "invalid code lengths for table " + name;
+    return nullptr;
+  }
+  table->id = tableId(codeLengths);
+  auto existing = byId.find(table->id);
+  if (existing != byId.end() && existing->second->codeLengths != codeLengths) {
+    error = "table " + name + " has the ID of table " + existing->second->name;
+    return nullptr;
+  }
+  auto named = byName.find(name);
+  if (named != byName.end() && named->second->id == table->id) {
+    return named->second;
+  }
+  tables.push_back(table);
+  byId.insert(std::make_pair(table->id, table));
+  byName[name] = table;
+  return table;
+}
+
+// Returns the table with the given ID, or null.
+inline std::shared_ptr<const CachedTable> TableCache::find(uint32_t id) const {
+  auto table = byId.find(id);
+  return table == byId.end() ? nullptr : table->second;
+}
+
+// Returns the table added last under the given name, or null.
+inline std::shared_ptr<const CachedTable>
+TableCache::findName(const std::string &name) const {
+  auto table = byName.find(name);
+  return table == byName.end() ? nullptr : table->second;
+}
+
+// Returns the decoder of the table with the given ID, or null. It lives as
+// long as the cache.
+inline const HuffmanDecoder *TableCache::decoder(uint32_t id) const {
+  auto table = byId.find(id);
+  return table == byId.end() ? nullptr : &table->second->decoder;
+}
+
+// Returns a lookup of the cache's decoders for decompressContainer.
+inline TableLookup TableCache::lookup() const {
+  return [this](uint32_t id) { return decoder(id); };
+}
+
+// Returns the number of tables in the cache, counting a table added under
+// several names once for each.
+inline size_t TableCache::size() const { return tables.size(); }
+
+//
+// trainTableLengths
+//
+// Function finds the code lengths of a table for a family of files from the
+// sum of their byte frequencies, returns false if there are no bytes
+inline bool trainTableLengths(const std::vector<uint64_t> &frequencies,
+                              std::vector<int> &codeLengths) {
+  uint64_t total = 0;
+  for (uint64_t count : frequencies) {
+    total += count;
+  }
+  return total > 0 && optimalCodeLengths(frequencies, DEFAULT_MAX_CODE_LENGTH,
+                                         codeLengths);
+}
+
+//
+// compressWithTable
+//
+// Function compresses the input file into a .hz file that refers to a cached
+// table. A file with bytes the table has no code for gets a table of its own
+// instead, so it can still be compressed, and can be told apart by its flags.
+inline CodecResult compressWithTable(const std::string &inputFilename,
+                                     const std::string &outputFilename,
+                                     const CachedTable &table) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  MappedInput inputFile;
+  if (!inputFile.open(inputFilename)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  std::vector<uint64_t> counts(ALPHABET_SIZE, 0);
+  histogram(inputFile.data(), inputFile.size(), counts.data());
+  result.stats.addEntropy(counts);
+  clock.lap(STAGE_HISTOGRAM);
+
+  bool covered = true;
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    covered = covered && (counts[i] == 0 || table.codeLengths[i] > 0);
+  }
+  ContainerHeader header;
+  if (covered) {
+    header.flags = CONTAINER_TABLE_ID;
+    header.tableId = table.id;
+    result.stats.addCodeLengths(table.codeLengths);
+    encodeSingleStream(inputFile, outputFilename, header, table.encoder,
+                       result);
+    return result;
+  }
+
+  optimalCodeLengths(counts, DEFAULT_MAX_CODE_LENGTH, header.codeLengths);
+  clock.lap(STAGE_TREE);
+  std::vector<HuffmanCode> codes;
+  HuffmanEncoder encoder;
+  assignCanonicalCodes(header.codeLengths, codes);
+  encoder.build(codes);
+  result.stats.addCodeLengths(header.codeLengths);
+  clock.lap(STAGE_TABLES);
+  encodeSingleStream(inputFile, outputFilename, header, encoder, result);
+  return result;
+}
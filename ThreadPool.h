@@ -0,0 +1,131 @@
+// Adam Shaar
+// ashaar2
+//
+// ThreadPool.h
+//
+// fixed set of worker threads that run the iterations of a loop in parallel
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+  ThreadPool(int threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &other) = delete;
+  ThreadPool &operator=(const ThreadPool &other) = delete;
+
+  int size() const;
+  void parallelFor(size_t count, const std::function<void(size_t)> &task);
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(size_t)> *task;
+  size_t taskCount;
+  size_t nextIndex;
+  size_t finished;
+  uint64_t generation;
+  bool stopping;
+  void workerLoop();
+  void runTasks(std::unique_lock<std::mutex> &lock);
+};
+
+//
+// defaultThreadCount
+//
+// Function returns the number of hardware threads, or 1 if it is unknown
+inline int defaultThreadCount() {
+  int threads = std::thread::hardware_concurrency();
+  return threads > 0 ? threads : 1;
+}
+
+// Constructor starts threads - 1 workers, the thread calling parallelFor
+// does its share of the work as well. A count of 0 uses every hardware thread.
+inline ThreadPool::ThreadPool(int threads) {
+  task = nullptr;
+  taskCount = nextIndex = finished = 0;
+  generation = 0;
+  stopping = false;
+  if (threads <= 0) {
+    threads = defaultThreadCount();
+  }
+  for (int i = 1; i < threads; i++) {
+    workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+  }
+}
+
+// Destructor wakes and joins all the workers.
+inline ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+// Returns the number of threads that run tasks, including the caller.
+inline int ThreadPool::size() const { return workers.size() + 1; }
+
+//
+// parallelFor
+//
+// Function calls task(i) for every i below count spread over the pool and
+// returns once all of them have finished
+inline void
+ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &task) {
+  std::unique_lock<std::mutex> lock(mutex);
+  this->task = &task;
+  taskCount = count;
+  nextIndex = 0;
+  finished = 0;
+  generation++;
+  wake.notify_all();
+  runTasks(lock);
+  done.wait(lock, [this] { return finished == taskCount; });
+  this->task = nullptr;
+}
+
+//
+// workerLoop
+//
+// Function waits for each new loop handed to the pool and helps to run it
+inline void ThreadPool::workerLoop() {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [&] { return stopping || generation != seen; });
+    if (stopping) {
+      return;
+    }
+    seen = generation;
+    runTasks(lock);
+  }
+}
+
+//
+// runTasks
+//
+// Function claims and runs iterations of the current loop until none are left
+inline void ThreadPool::runTasks(std::unique_lock<std::mutex> &lock) {
+  while (task != nullptr && nextIndex < taskCount) {
+    size_t index = nextIndex++;
+    const std::function<void(size_t)> &current = *task;
+    lock.unlock();
+    current(index);
+    lock.lock();
+    if (++finished == taskCount) {
+      done.notify_all();
+    }
+  }
+}
@@ -0,0 +1,555 @@
+// Adam Shaar
+// ashaar2
+//
+// benchmark.cpp
+//
+// throughput benchmark of every stage of the codec on generated corpora
+// g++ -O2 benchmark.cpp -pthread -o benchmark + ./benchmark to run
+// ./benchmark [-s MiB] [-r repetitions] [-c corpus] [-f file] [-t]
+// every corpus is generated from a fixed seed, so runs on different machines
+// (and different versions of the code) measure exactly the same data
+
+#include "BenchmarkLogTable.h"
+#include "ContextModel.h"
+#include "FixedHuffman.h"
+#include "FlatHuffmanTree.h"
+#include "Histogram.h"
+#include "HuffmanBuffer.h"
+#include "HuffmanCode.h"
+#include "HuffmanDecoder.h"
+#include "HuffmanEncoder.h"
+#include "MappedFile.h"
+#include "RunLength.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Shortest time a single measurement runs for, fast stages are repeated
+// until they take at least this long
+const double BENCHMARK_MIN_SECONDS = 0.02;
+// Bitstreams of the interleaved encode and decode stages
+const int BENCHMARK_STREAMS = 4;
+// Payload size of the buffer API stages
+const size_t BENCHMARK_PAYLOAD_SIZE = 4096;
+
+// Corpus is a named block of benchmark input.
+struct Corpus {
+  string name;
+  vector<unsigned char> data;
+};
+
+// StageResult is the best time of one stage on one corpus, and for stages
+// that encode or decode the size of their bitstream.
+struct StageResult {
+  string stage;
+  double seconds;
+  size_t codedSize; // 0 for stages without a bitstream
+};
+
+// CorpusRandom is a xorshift64* generator, used instead of the standard
+// distributions so that the corpora are the same with every library.
+class CorpusRandom {
+public:
+  CorpusRandom(uint64_t seed) { state = seed; }
+
+  // Returns the next 64 random bits.
+  uint64_t next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+  }
+
+  // Returns a random number below limit.
+  uint32_t below(uint32_t limit) { return (next() >> 32) % limit; }
+
+private:
+  uint64_t state;
+};
+
+// function declarations
+void generateSkewedText(vector<unsigned char> &data, size_t size);
+void generateUniformRandom(vector<unsigned char> &data, size_t size);
+void generateRuns(vector<unsigned char> &data, size_t size);
+void generateLogLines(vector<unsigned char> &data, size_t size);
+double timeStage(const function<void()> &stage, int repetitions);
+bool benchmarkCorpus(const Corpus &corpus, int repetitions,
+                     vector<StageResult> &results);
+void printResults(const Corpus &corpus, const vector<StageResult> &results,
+                  bool tabs);
+
+//
+// generateSkewedText
+//
+// Function fills data with English-like text, words drawn from a small
+// vocabulary with a roughly Zipfian distribution
+void generateSkewedText(vector<unsigned char> &data, size_t size) {
+  static const char *words[] = {
+      "the",     "of",       "and",      "to",      "a",        "in",
+      "is",      "it",       "that",     "was",     "for",      "on",
+      "with",    "as",       "be",       "at",      "by",       "this",
+      "from",    "or",       "have",     "an",      "they",     "which",
+      "one",     "you",      "were",     "her",     "all",      "she",
+      "there",   "would",    "their",    "will",    "when",     "who",
+      "him",     "been",     "has",      "more",    "if",       "no",
+      "out",     "so",       "said",     "what",    "up",       "its",
+      "about",   "into",     "than",     "them",    "can",      "only",
+      "other",   "new",      "some",     "could",   "time",     "these",
+      "two",     "may",      "then",     "do",      "first",    "any",
+      "my",      "now",      "such",     "like",    "our",      "over",
+      "man",     "me",       "even",     "most",    "made",     "after",
+      "also",    "did",      "many",     "before",  "must",     "through",
+      "years",   "where",    "much",     "your",    "way",      "well",
+      "down",    "should",   "because",  "each",    "just",     "those",
+      "people",  "Huffman",  "compress", "table",   "symbol",   "frequency",
+      "encoder", "decoder",  "bits",     "stream",  "quickly",  "zebra",
+      "jukebox", "xylophone"};
+  const int wordCount = sizeof(words) / sizeof(words[0]);
+  CorpusRandom random(1);
+  data.clear();
+  data.reserve(size);
+  int sentence = 0;
+  while (data.size() < size) {
+    // squaring a uniform number makes the first words far more common
+    uint32_t pick = random.below(1 << 16);
+    const char *word = words[(uint64_t)pick * pick * wordCount >> 32];
+    if (sentence == 0) {
+      data.push_back(toupper(word[0]));
+      word++;
+    }
+    data.insert(data.end(), word, word + strlen(word));
+    sentence++;
+    if (sentence > 6 && random.below(8) == 0) {
+      data.push_back('.');
+      data.push_back(random.below(6) == 0 ? '\n' : ' ');
+      sentence = 0;
+    } else {
+      data.push_back(random.below(12) == 0 ? ',' : ' ');
+      if (data.back() == ',') {
+        data.push_back(' ');
+      }
+    }
+  }
+  data.resize(size);
+}
+
+//
+// generateUniformRandom
+//
+// Function fills data with uniformly random bytes, which do not compress
+void generateUniformRandom(vector<unsigned char> &data, size_t size) {
+  CorpusRandom random(2);
+  data.resize(size);
+  for (size_t i = 0; i < size; i += 8) {
+    uint64_t bits = random.next();
+    memcpy(data.data() + i, &bits, min<size_t>(8, size - i));
+  }
+}
+
+//
+// generateRuns
+//
+// Function fills data with runs of repeated bytes from a small alphabet,
+// like bitmaps or sparse tables, where a few symbols get 1-2 bit codes
+void generateRuns(vector<unsigned char> &data, size_t size) {
+  CorpusRandom random(3);
+  data.clear();
+  data.reserve(size);
+  while (data.size() < size) {
+    // mostly zeros, with the odd run of a handful of other values
+    unsigned char value = random.below(4) != 0 ? 0 : 1 + random.below(7);
+    size_t length = 1 + random.below(value == 0 ? 256 : 32);
+    data.insert(data.end(), min(length, size - data.size()), value);
+  }
+}
+
+//
+// generateLogLines
+//
+// Function fills data with lines like a server log: timestamps, levels,
+// component names, ids and numbers
+void generateLogLines(vector<unsigned char> &data, size_t size) {
+  static const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN",
+                                 "ERROR"};
+  static const char *components[] = {"http", "db", "cache", "auth",
+                                     "scheduler"};
+  static const char *messages[] = {"request completed",
+                                   "query executed",
+                                   "cache miss for key",
+                                   "token refreshed",
+                                   "job finished",
+                                   "connection reset by peer"};
+  CorpusRandom random(4);
+  data.clear();
+  data.reserve(size + 256);
+  uint64_t milliseconds = 0;
+  char line[256];
+  while (data.size() < size) {
+    milliseconds += random.below(50);
+    uint64_t seconds = milliseconds / 1000;
+    int length = snprintf(
+        line, sizeof(line),
+        "2026-10-18T%02d:%02d:%02d.%03dZ %-5s [%s-%u] %s id=%08x took=%ums "
+        "status=%d\n",
+        (int)(seconds / 3600 % 24), (int)(seconds / 60 % 60),
+        (int)(seconds % 60), (int)(milliseconds % 1000),
+        levels[random.below(6)], components[random.below(5)],
+        random.below(16), messages[random.below(6)],
+        (unsigned)random.next(), random.below(2000),
+        random.below(10) == 0 ? 500 : 200);
+    data.insert(data.end(), line, line + length);
+  }
+  data.resize(size);
+}
+
+//
+// timeStage
+//
+// Function runs a stage `repetitions` times and returns the best time of a
+// single run in seconds. Each measurement repeats the stage until it takes
+// BENCHMARK_MIN_SECONDS, so that stages far below the clock resolution can
+// still be timed.
+double timeStage(const function<void()> &stage, int repetitions) {
+  double best = 0;
+  for (int repetition = 0; repetition < repetitions; repetition++) {
+    int runs = 0;
+    auto start = chrono::steady_clock::now();
+    chrono::duration<double> elapsed(0);
+    while (elapsed.count() < BENCHMARK_MIN_SECONDS) {
+      stage();
+      runs++;
+      elapsed = chrono::steady_clock::now() - start;
+    }
+    double seconds = elapsed.count() / runs;
+    if (repetition == 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+  return best;
+}
+
+//
+// benchmarkCorpus
+//
+// Function times the histogram, the code length computation, the building
+// of the code tables, encoding and decoding of a corpus. Encoding and
+// decoding are timed again with the codes interleaved over BENCHMARK_STREAMS
+// bitstreams, with an order-1 context model, on the run-length form of the
+// corpus and as payloads of BENCHMARK_PAYLOAD_SIZE bytes through the buffer
+// API. Corpora that only hold bytes of the compiled-in log table are also
+// coded with its fixed kernels. Every encode and decode stage records the
+// size of its own bitstream. Returns false if the decoded data does not
+// match the corpus.
+bool benchmarkCorpus(const Corpus &corpus, int repetitions,
+                     vector<StageResult> &results) {
+  const unsigned char *data = corpus.data.data();
+  size_t size = corpus.data.size();
+  vector<uint64_t> frequencies(ALPHABET_SIZE);
+  vector<int> codeLengths;
+  vector<HuffmanCode> codes;
+  HuffmanEncoder encoder;
+  HuffmanDecoder decoder;
+  vector<unsigned char> encoded;
+  vector<unsigned char> decoded(size);
+  results.clear();
+
+  results.push_back({"histogram", timeStage([&]() {
+                       fill(frequencies.begin(), frequencies.end(), 0);
+                       histogram(data, size, frequencies.data());
+                     }, repetitions)});
+  results.push_back({"tree", timeStage([&]() {
+                       optimalCodeLengths(frequencies, DEFAULT_MAX_CODE_LENGTH,
+                                          codeLengths);
+                     }, repetitions)});
+  results.push_back({"codes", timeStage([&]() {
+                       assignCanonicalCodes(codeLengths, codes);
+                       encoder.build(codes);
+                       decoder.build(codes);
+                     }, repetitions)});
+  results.push_back({"encode", timeStage([&]() {
+                       encoded.clear();
+                       BitWriter writer(encoded);
+                       encoder.encodeBlock(data, size, writer);
+                       writer.flush();
+                     }, repetitions)});
+  results.back().codedSize = encoded.size();
+  bool ok = true;
+  results.push_back({"decode", timeStage([&]() {
+                       ok = decoder.decodeBuffer(encoded.data(), encoded.size(),
+                                                 decoded.data(), size) && ok;
+                     }, repetitions)});
+  results.back().codedSize = encoded.size();
+  ok = ok && decoded == corpus.data;
+
+  // the same codes in BENCHMARK_STREAMS interleaved bitstreams
+  vector<vector<unsigned char>> streams(BENCHMARK_STREAMS);
+  results.push_back({"encode" + to_string(BENCHMARK_STREAMS), timeStage([&]() {
+                       encoder.encodeInterleaved(data, size, streams);
+                     }, repetitions)});
+  const unsigned char *starts[BENCHMARK_STREAMS];
+  size_t sizes[BENCHMARK_STREAMS];
+  size_t streamsSize = 0;
+  for (int k = 0; k < BENCHMARK_STREAMS; k++) {
+    starts[k] = streams[k].data();
+    sizes[k] = streams[k].size();
+    streamsSize += sizes[k];
+  }
+  results.back().codedSize = streamsSize;
+  fill(decoded.begin(), decoded.end(), 0);
+  results.push_back({"decode" + to_string(BENCHMARK_STREAMS), timeStage([&]() {
+                       ok = decoder.decodeInterleaved(starts, sizes,
+                                                      BENCHMARK_STREAMS,
+                                                      decoded.data(), size) &&
+                            ok;
+                     }, repetitions)});
+  results.back().codedSize = streamsSize;
+  ok = ok && decoded == corpus.data;
+
+  // order-1 coding, each byte with the table of its context's cluster
+  vector<uint64_t> pairs(CONTEXT_PAIRS);
+  ContextModel model;
+  ContextEncoder contextEncoder;
+  ContextDecoder contextDecoder;
+  results.push_back({"context", timeStage([&]() {
+                       fill(pairs.begin(), pairs.end(), 0);
+                       contextHistogram(data, size, 0, pairs.data());
+                       buildContextModel(pairs, MAX_CONTEXT_CLUSTERS, model);
+                       contextEncoder.build(model);
+                       contextDecoder.build(model);
+                     }, repetitions)});
+  results.push_back({"encode-o1", timeStage([&]() {
+                       encoded.clear();
+                       BitWriter writer(encoded);
+                       contextEncoder.encodeBlock(data, size, 0, writer);
+                       writer.flush();
+                     }, repetitions)});
+  results.back().codedSize = encoded.size();
+  fill(decoded.begin(), decoded.end(), 0);
+  results.push_back({"decode-o1", timeStage([&]() {
+                       ok = contextDecoder.decodeBuffer(encoded.data(),
+                                                        encoded.size(),
+                                                        decoded.data(), size) &&
+                            ok;
+                     }, repetitions)});
+  results.back().codedSize = encoded.size();
+  ok = ok && decoded == corpus.data;
+
+  // the run-length form, the table stage includes the transform
+  vector<unsigned char> runs(runLengthBound(size));
+  size_t runsSize = 0;
+  HuffmanEncoder runEncoder;
+  HuffmanDecoder runDecoder;
+  results.push_back({"runlength", timeStage([&]() {
+                       RunLengthEncoder transform;
+                       runsSize = transform.encode(data, size, runs.data());
+                       runsSize += transform.finish(runs.data() + runsSize);
+                       fill(frequencies.begin(), frequencies.end(), 0);
+                       histogram(runs.data(), runsSize, frequencies.data());
+                       optimalCodeLengths(frequencies, DEFAULT_MAX_CODE_LENGTH,
+                                          codeLengths);
+                       assignCanonicalCodes(codeLengths, codes);
+                       runEncoder.build(codes);
+                       runDecoder.build(codes);
+                     }, repetitions)});
+  results.push_back({"encode-rl", timeStage([&]() {
+                       RunLengthEncoder transform;
+                       runsSize = transform.encode(data, size, runs.data());
+                       runsSize += transform.finish(runs.data() + runsSize);
+                       encoded.clear();
+                       BitWriter writer(encoded);
+                       runEncoder.encodeBlock(runs.data(), runsSize, writer);
+                       writer.flush();
+                     }, repetitions)});
+  results.back().codedSize = encoded.size();
+  fill(decoded.begin(), decoded.end(), 0);
+  results.push_back({"decode-rl", timeStage([&]() {
+                       ok = decodeRunLength(runDecoder, encoded.data(),
+                                            encoded.size(), decoded.data(),
+                                            size) &&
+                            ok;
+                     }, repetitions)});
+  results.back().codedSize = encoded.size();
+  ok = ok && decoded == corpus.data;
+
+  // small payloads one after the other through reused buffer contexts
+  size_t payloads =
+      (size + BENCHMARK_PAYLOAD_SIZE - 1) / BENCHMARK_PAYLOAD_SIZE;
+  size_t slot = huffman::compressBound(BENCHMARK_PAYLOAD_SIZE);
+  vector<unsigned char> packed(payloads * slot);
+  vector<size_t> packedSizes(payloads);
+  huffman::BufferContext compressContext;
+  huffman::BufferContext decompressContext;
+  results.push_back({"encode-buf", timeStage([&]() {
+                       for (size_t i = 0; i < payloads; i++) {
+                         size_t start = i * BENCHMARK_PAYLOAD_SIZE;
+                         packedSizes[i] = huffman::compress(
+                             data + start,
+                             min(BENCHMARK_PAYLOAD_SIZE, size - start),
+                             packed.data() + i * slot, slot, compressContext);
+                       }
+                     }, repetitions)});
+  size_t packedSize = 0;
+  for (size_t i = 0; i < payloads; i++) {
+    packedSize += packedSizes[i];
+  }
+  results.back().codedSize = packedSize;
+  fill(decoded.begin(), decoded.end(), 0);
+  results.push_back({"decode-buf", timeStage([&]() {
+                       for (size_t i = 0; i < payloads; i++) {
+                         size_t start = i * BENCHMARK_PAYLOAD_SIZE;
+                         ok = huffman::decompress(
+                                  packed.data() + i * slot, packedSizes[i],
+                                  decoded.data() + start, size - start,
+                                  decompressContext) != huffman::BUFFER_ERROR &&
+                              ok;
+                       }
+                     }, repetitions)});
+  results.back().codedSize = packedSize;
+  ok = ok && decoded == corpus.data;
+
+  // the fixed kernels of a table compiled into the benchmark
+  fill(frequencies.begin(), frequencies.end(), 0);
+  histogram(data, size, frequencies.data());
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    if (frequencies[symbol] > 0 && BenchmarkLogTable::lengths[symbol] == 0) {
+      return ok;
+    }
+  }
+  results.push_back({"encode-fx", timeStage([&]() {
+                       encoded.clear();
+                       BitWriter writer(encoded);
+                       FixedHuffmanEncoder<BenchmarkLogTable>::encodeBlock(
+                           data, size, writer);
+                       writer.flush();
+                     }, repetitions)});
+  results.back().codedSize = encoded.size();
+  fill(decoded.begin(), decoded.end(), 0);
+  results.push_back({"decode-fx", timeStage([&]() {
+                       ok = FixedHuffmanDecoder<BenchmarkLogTable>::
+                                decodeBuffer(encoded.data(), encoded.size(),
+                                             decoded.data(), size) &&
+                            ok;
+                     }, repetitions)});
+  results.back().codedSize = encoded.size();
+  return ok && decoded == corpus.data;
+}
+
+//
+// printResults
+//
+// Function prints the time of a run of every stage, and its MB/s and
+// ns/symbol relative to the size of the corpus, as a table or as
+// tab-separated lines. The tree and code stages only depend on the alphabet,
+// for them the time of a run is the number to compare. The ratio of a stage
+// is the size of the corpus over the size of its own bitstream, 0 for stages
+// without one.
+void printResults(const Corpus &corpus, const vector<StageResult> &results,
+                  bool tabs) {
+  double size = corpus.data.size();
+  for (const StageResult &result : results) {
+    double megabytesPerSecond = size / result.seconds / 1e6;
+    double nanosecondsPerSymbol = result.seconds * 1e9 / size;
+    double ratio = result.codedSize > 0 ? size / result.codedSize : 0;
+    if (tabs) {
+      cout << corpus.name << '\t' << result.stage << '\t' << fixed
+           << setprecision(3) << result.seconds * 1e6 << '\t'
+           << setprecision(2) << megabytesPerSecond << '\t' << setprecision(4)
+           << nanosecondsPerSymbol << '\t' << setprecision(5) << ratio << '\t'
+           << (uint64_t)size << '\n';
+      continue;
+    }
+    cout << left << setw(10) << corpus.name << setw(11) << result.stage
+         << right << fixed << setprecision(3) << setw(14)
+         << result.seconds * 1e6 << setprecision(2) << setw(12)
+         << megabytesPerSecond << setprecision(4) << setw(12)
+         << nanosecondsPerSymbol << setprecision(5) << setw(10) << ratio
+         << '\n';
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t size = 16 << 20;
+  int repetitions = 5;
+  string only;
+  string inputFilename;
+  bool tabs = false;
+  for (int i = 1; i < argc; i++) {
+    string argument = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (argument == "-s" && hasValue && atoi(argv[i + 1]) > 0) {
+      size = (size_t)atoi(argv[++i]) << 20;
+    } else if (argument == "-r" && hasValue && atoi(argv[i + 1]) > 0) {
+      repetitions = atoi(argv[++i]);
+    } else if (argument == "-c" && hasValue) {
+      only = argv[++i];
+    } else if (argument == "-f" && hasValue) {
+      inputFilename = argv[++i];
+    } else if (argument == "-t") {
+      tabs = true;
+    } else {
+      cerr << "usage: benchmark [-s MiB] [-r repetitions] [-c corpus] "
+              "[-f file] [-t]\n"
+              "  -s MiB          size of every generated corpus (default 16)\n"
+              "  -r repetitions  best of this many runs per stage (default "
+              "5)\n"
+              "  -c corpus       only text, random, runs, log or file\n"
+              "  -f file         also benchmark the contents of a file\n"
+              "  -t              print tab-separated lines\n";
+      return 2;
+    }
+  }
+
+  vector<Corpus> corpora;
+  void (*generators[])(vector<unsigned char> &, size_t) = {
+      generateSkewedText, generateUniformRandom, generateRuns,
+      generateLogLines};
+  const char *names[] = {"text", "random", "runs", "log"};
+  for (int i = 0; i < 4; i++) {
+    if (only.empty() || only == names[i]) {
+      corpora.push_back({names[i], {}});
+      generators[i](corpora.back().data, size);
+    }
+  }
+  if (!inputFilename.empty() && (only.empty() || only == "file")) {
+    MappedInput inputFile;
+    if (!inputFile.open(inputFilename) || inputFile.size() == 0) {
+      cerr << "Error: unable to read " << inputFilename << endl;
+      return 1;
+    }
+    corpora.push_back({"file", vector<unsigned char>(
+                                   inputFile.data(),
+                                   inputFile.data() + inputFile.size())});
+  }
+  if (corpora.empty()) {
+    cerr << "Error: unknown corpus " << only << endl;
+    return 2;
+  }
+
+  if (tabs) {
+    cout << "corpus\tstage\tmicroseconds\tmb_per_s\tns_per_symbol\tratio\t"
+            "bytes\n";
+  } else {
+    cout << left << setw(10) << "corpus" << setw(11) << "stage" << right
+         << setw(14) << "us/run" << setw(12) << "MB/s" << setw(12)
+         << "ns/symbol" << setw(10) << "ratio" << '\n';
+  }
+  int status = 0;
+  for (const Corpus &corpus : corpora) {
+    vector<StageResult> results;
+    if (!benchmarkCorpus(corpus, repetitions, results)) {
+      cerr << "Error: " << corpus.name << " did not decode to its input"
+           << endl;
+      status = 1;
+    }
+    printResults(corpus, results, tabs);
+  }
+  return status;
+}
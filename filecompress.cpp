@@ -4,12 +4,13 @@
 // filecompress.cpp
 //
 // the main file of the program 
-// g++ filecompress.cpp + ./a.out to run
+// g++ filecompress.cpp -pthread + ./a.out to run
+// ./a.out -c|-d|-t|-a [options] files... for batch use, see printBatchUsage
+// HUFFMAN_STATS=json prints the timing and coding statistics of every call
+// as one line of JSON on standard error
 // create Huffman information files, load Huffman information files, compress files with Huffman information, and decompress files with Huffman information
 
 #include "filecompress.h"
-#include "BinaryTree.h"
-#include "PriorityQueue.h"
 #include <bitset>
 #include <cctype>
 #include <cstring>
@@ -28,19 +29,40 @@ using std::string;
 //
 // Display each of the function operations and take a filename as an input
 void displayCommands() {
-  cout << "\nOperation are given by digits 1 through 5\n\n";
-  cout << "  1 <filename> - create a new Huffman Information file from an "
-          "original file\n";
+  cout << "\nOperation are given by digits 1 through 9\n\n";
+  cout << "  1 <filename> [maxbits] - create a new Huffman Information file "
+          "from an original file,\n"
+          "                 canonical codes of at most maxbits bits if given\n";
   cout << "  2 <filename> - load a Huffman Information file \n";
   cout << "  3 <filename> - compress a file using the current Huffman "
           "Information file\n";
   cout << "  4 <filename> - decompress a file using the current Huffman "
           "Information file\n";
-  cout << "  5            - quit the program\n\n";
+  cout << "  5            - quit the program\n";
+  cout << "  6 <filename> [maxbits] - compress a file into a self-contained "
+          ".hz file\n";
+  cout << "  7 <filename> - decompress a .hz file\n";
+  cout << "  8 <filename> [blockKiB] [threads] [streams] - compress a file "
+          "into a .hz file\n"
+          "                 of independent blocks that are compressed and "
+          "decompressed in parallel\n";
+  cout << "  9 <filename> [blockKiB] [threads] [streams] - like 8, but every "
+          "block gets its own\n"
+          "                 Huffman table\n";
+  cout << "                 with streams every block of 8 or 9 is coded in "
+          "that many\n"
+          "                 interleaved bitstreams (1 to 8)\n\n";
 }
 
 int main(int argc, char **argv) {
 
+  // with -c, -d or -t the files (or standard input) on the command line are
+  // handled instead of reading commands, e.g. ./a.out -c -j 8 dir or
+  // tar c dir | ./a.out -c > dir.hz
+  if (argc >= 2 && argv[1][0] == '-') {
+    return batchMain(argc, argv);
+  }
+
   cout << "Welcome to File Compression program\n";
 
   displayCommands();
@@ -49,8 +71,9 @@ int main(int argc, char **argv) {
   string line;
   string input;
 
-  std::vector<std::string> huffmanCodes(128, "");
-  BinaryTree *huffmanTree = nullptr;
+  std::vector<std::string> huffmanCodes(ALPHABET_SIZE, "");
+  FlatHuffmanTree huffmanTree;
+  bool huffmanTreeLoaded = false;
 
   do {
     cout << "cmd> ";
@@ -71,22 +94,27 @@ int main(int argc, char **argv) {
     if (command == '1') {
       ss >> input;
       // create a .hi file that contains:
-      //   - 128 lines of information
-      //   - decimal value of ASCII characters in sorted order from 0 to 127
-      //   - binary string representing ASCII characters with Huffman encoding
-      createHuffmanInfoFile(input);
+      //   - one line of information per byte value that occurs in the file
+      //   - decimal value of the byte in sorted order from 0 to 255
+      //   - binary string representing the byte with Huffman encoding
+      // with a maximum code length the file instead starts with "canonical"
+      // and stores the length of each canonical code
+      int maxCodeLength = 0;
+      ss >> maxCodeLength;
+      createHuffmanInfoFile(input, maxCodeLength);
     }
 
     if (command == '2') {
       ss >> input;
       // store Huffman code information into the huffmanCodes vector
-      // store Huffman tree into huffmanTree BinaryTree Structure
-      loadHuffmanInfoFile(input, huffmanCodes, huffmanTree);
+      // store Huffman tree into the huffmanTree node array
+      huffmanTreeLoaded =
+          loadHuffmanInfoFile(input, huffmanCodes, huffmanTree);
     }
 
     if (command == '3') {
       // verifying that operation 2 was performed
-      if (huffmanTree == nullptr) {
+      if (!huffmanTreeLoaded) {
         std::cout << "Error: Huffman Information file not loaded. Please load "
                      "a .hi file using operation 2."
                   << std::endl;
@@ -100,13 +128,13 @@ int main(int argc, char **argv) {
         //   - # of bytes in the compressed file
         //   - The compression ratio printed out to 5 decimal places
         //   - % of saved space printed out to 5 decimal places
-        compressFile(input, huffmanTree, huffmanCodes);
+        compressFile(input, huffmanCodes);
       }
     }
 
     if (command == '4') {
       // verifying that operation 2 was performed
-      if (huffmanTree == nullptr) {
+      if (!huffmanTreeLoaded) {
         std::cout << "Error: Huffman Information file not loaded. Please load "
                      "a .hi file using operation 2."
                   << std::endl;
@@ -114,12 +142,57 @@ int main(int argc, char **argv) {
         ss >> input;
         // Read-in file bit-by-bit and traverse down the HuffmanTree structure one level for each bit
         // If the bit is 0, traverse to the left child. If the bit is a 1, traverse to the right child.
-        // When a leaf node is encountered, output the ASCII character associated with the leaf node and begin the next traversal from the top of the tree
+        // When a leaf node is encountered, output the byte associated with the leaf node and begin the next traversal from the top of the tree
         // creates the src of the original file that created the .hc
         decompressFile(input, huffmanTree);
       }
     }
 
+    if (command == '6') {
+      ss >> input;
+      // create a .hz file that holds everything needed to decompress it:
+      //   - the original size and a checksum of the original file
+      //   - the canonical Huffman code length of every byte value
+      //   - the bit string of the Huffman codes of the file
+      int maxCodeLength;
+      if (!(ss >> maxCodeLength)) {
+        maxCodeLength = DEFAULT_MAX_CODE_LENGTH;
+      }
+      compressContainerFile(input, maxCodeLength);
+    }
+
+    if (command == '7') {
+      ss >> input;
+      // decode a .hz file using the code table stored inside it, stopping at
+      // exactly the original size and verifying the checksum
+      decompressContainerFile(input);
+    }
+
+    if (command == '8' || command == '9') {
+      ss >> input;
+      // create a .hz file of independent blocks (1024 KiB unless given),
+      // each block is encoded on its own thread and can be decoded on its own
+      // thread through the block index at the end of the file
+      // with 9 each block is coded with a table of its own, the table of the
+      // block before or stored raw, whichever is smallest
+      // with streams > 1 the codes of every block take turns between that
+      // many bitstreams, so decoding one block is not a single long chain
+      size_t blockKiB;
+      int threads;
+      int streams;
+      if (!(ss >> blockKiB) || blockKiB == 0) {
+        blockKiB = DEFAULT_BLOCK_SIZE / 1024;
+      }
+      if (!(ss >> threads)) {
+        threads = 0;
+      }
+      if (!(ss >> streams)) {
+        streams = 1;
+      }
+      compressBlockedContainerFile(input, blockKiB * 1024, threads,
+                                   command == '9', streams);
+    }
+
     if (command == '5' || command == 'q') {
       // end program
       done = true;
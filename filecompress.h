@@ -5,17 +5,31 @@
 //
 // the declaration and implementation of functions(and the helper functions)
 // called in filecompress.cpp
+// unlike the codec headers it includes, its functions are not inline, so it
+// is included by a single source file of each program
 
 #pragma once
 
-#include "BinaryTree.h"
-#include "PriorityQueue.h"
+#include "FixedTables.h"
+#include "FlatHuffmanTree.h"
+#include "Histogram.h"
+#include "HuffmanCode.h"
+#include "HuffmanContainer.h"
+#include "HuffmanDecoder.h"
+#include "HuffmanEncoder.h"
+#include "MappedFile.h"
+#include "TableCache.h"
+#include <algorithm>
 #include <bitset>
+#include <chrono>
 #include <cctype>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -25,114 +39,105 @@ using std::cout;
 using std::string;
 
 // function declarations
-void readFileFrequencies(std::string input, std::vector<int> &frequencies);
-BinaryTree *createHuffmanTree(std::vector<int> frequencies);
-void generateHuffmanCodes(const TreeNode *node, std::vector<std::string> &codes,
+void readFileFrequencies(std::string input, std::vector<uint64_t> &frequencies,
+                         int threads = 1, CodecStats *stats = nullptr);
+void createHuffmanTree(const std::vector<uint64_t> &frequencies,
+                       FlatHuffmanTree &huffmanTree);
+void generateHuffmanCodes(const FlatHuffmanTree &huffmanTree, uint16_t node,
+                          std::vector<std::string> &codes,
                           std::string currentCode);
 void readHuffmanCodesFromFile(const std::string &filename,
                               std::vector<std::string> &huffmanCodes);
-TreeNode *rebuildHuffmanTree(const std::vector<std::string> &huffmanCodes);
+bool parseHuffmanInfoFile(const std::string &filename,
+                          std::vector<std::string> &huffmanCodes,
+                          std::string &error);
+bool rebuildHuffmanTree(const std::vector<std::string> &huffmanCodes,
+                        FlatHuffmanTree &huffmanTree);
 int writeBit(std::ofstream &outputFile, bool bit, int &bitBuffer,
              int &bitCount);
 int flushBitBuffer(std::ofstream &outputFile, int &bitBuffer, int &bitCount);
 void readBit(std::istream &in, bool &bit, int &bitBuffer, int &bitCount);
 void decompressFile(const std::string &inputFilename,
                     const std::string &outputFilename,
-                    const BinaryTree *huffmanTree);
-void createHuffmanInfoFile(const std::string &input);
-void loadHuffmanInfoFile(const std::string &input,
+                    const FlatHuffmanTree &huffmanTree);
+bool canonicalCodeLengths(const std::vector<uint64_t> &frequencies,
+                          int maxCodeLength, std::vector<int> &codeLengths);
+void createHuffmanInfoFile(const std::string &input, int maxCodeLength = 0);
+bool writeHuffmanInfoFile(const std::string &hiFilename,
+                          const std::vector<std::string> &huffmanCodes,
+                          const std::vector<int> &codeLengths);
+bool loadHuffmanInfoFile(const std::string &input,
                          std::vector<std::string> &huffmanCodes,
-                         BinaryTree *&huffmanTree);
-void compressFile(const std::string &input, const BinaryTree *huffmanTree,
-                  const std::vector<std::string> huffmanCodes);
-void decompressFile(const std::string &input, const BinaryTree *huffmanTree);
+                         FlatHuffmanTree &huffmanTree);
+void compressFile(const std::string &input,
+                  const std::vector<std::string> &huffmanCodes);
+void decompressFile(const std::string &input,
+                    const FlatHuffmanTree &huffmanTree);
+void printCompressionStatistics(uint64_t inputSize, uint64_t outputSize);
+void compressContainerFile(const std::string &input,
+                           int maxCodeLength = DEFAULT_MAX_CODE_LENGTH);
+void compressBlockedContainerFile(const std::string &input, size_t blockSize,
+                                  int threads, bool adaptive = false,
+                                  int streams = 1);
+void decompressContainerFile(const std::string &input);
+int streamStandardIO(bool compress);
+int batchMain(int argc, char **argv);
+bool statsJsonEnabled();
+void printStatsJson(const std::string &operation, const std::string &input,
+                    const std::string &output, const CodecResult &result);
+
+// Set by the -s option, HUFFMAN_STATS=json in the environment does the same
+bool statsJsonRequested = false;
 
 //
 //  readFileFrequencies
 //
-//  Function finds the frequency of each ASCII character and returns a frequency
-void readFileFrequencies(string fname, std::vector<int> &freq) {
-  // Initialize the frequency vector with 128 0's (0 frequency = default)
-  for (int i = 0; i < 128; i++) {
-    freq.push_back(0);
-  }
-  // unsigned char ch to store current character from file
-  unsigned char ch;
-  std::fstream infile;
-  infile.open(fname, std::fstream::in);
+//  Function finds the frequency of each byte value and returns a frequency,
+//  counting on `threads` threads (0 uses every hardware thread)
+void readFileFrequencies(string fname, std::vector<uint64_t> &freq,
+                         int threads, CodecStats *stats) {
+  // count the whole file in large buffers with the histogram kernel
   // returns error message if original file DNE
-  if (!infile.is_open()) {
+  if (!fileHistogram(fname, freq, threads, stats)) {
     cout << "could not open file: " << fname << std::endl;
     exit(0);
   }
-  // total characters in file
-  int charCount;
-  // read the file character by character
-  while (infile >> std::noskipws >> ch) {
-    charCount++;
-    // convert char to int ASCII Value
-    int chint = ch;
-    // check to see if char is an ASCII char
-    if (chint > 127)
-      cout << "Non ASCII Character: " << chint << std::endl;
-    else
-      // adds to freq vector
-      freq[chint]++;
-  }
 }
 
 //
 // createHuffmanTree
 //
 // Function builds a Huffman Tree based on the algorithm from 10.4.1 of CS351
-// Zybooks
-BinaryTree *createHuffmanTree(std::vector<int> frequencies) {
-  PriorityQueue Q;
-  // Initialize a priority queue Q.
-  for (int i = 0; i < 128; i++) {
-    unsigned char c = i;
-    TreeNode *TN = new TreeNode(c, frequencies[i]);
-    BinaryTree *T = new BinaryTree(TN);
-    // a single node TN with f(c)
-    // Insert T and freq[i] in Q
-    Q.insert(T, frequencies[i]);
-  }
-  while (Q.size() > 1) {
-    int F1 = Q.min();
-    BinaryTree *T1(Q.removeMin());
-    int F2 = Q.min();
-    BinaryTree *T2(Q.removeMin());
-    // Create a new binary tree T with left subtree T1 and right subtree T2
-    TreeNode *mergedNode = new TreeNode('\0', F1 + F2);
-    mergedNode->left = T1->getRoot();
-    mergedNode->right = T2->getRoot();
-    BinaryTree *mergedTree = new BinaryTree(mergedNode);
-    // insert T into Q with key F1 + F2
-    Q.insert(mergedTree, F1 + F2);
-  }
-  // return the last remaining tree in the Q (the Huffman Tree)
-  return Q.removeMin();
+// Zybooks, in place in the node array of huffmanTree. The 64-bit counts do
+// not overflow on files larger than 2 GB.
+void createHuffmanTree(const std::vector<uint64_t> &frequencies,
+                       FlatHuffmanTree &huffmanTree) {
+  huffmanTree.build(frequencies);
 }
 
 //
 // generateHuffmanCodes
 //
-// Function generates Huffman codes for each ASCII character by depth-first
+// Function generates Huffman codes for each byte value by depth-first
 // traversal through Huffman tree
-void generateHuffmanCodes(const TreeNode *node, std::vector<std::string> &codes,
+void generateHuffmanCodes(const FlatHuffmanTree &huffmanTree, uint16_t node,
+                          std::vector<std::string> &codes,
                           std::string currentCode) {
-  // return if node is null
-  if (node == nullptr) {
+  // return if node does not exist
+  if (node == FlatHuffmanTree::NO_NODE) {
     return;
   }
   // if the current node is a leaf node, store the code in the codes vector at
   // the respective index
-  if (node->left == nullptr && node->right == nullptr) {
-    codes[node->character] = currentCode;
+  if (huffmanTree.isLeaf(node)) {
+    codes[huffmanTree.node(node).symbol] = currentCode;
+    return;
   }
   // recursively generate the code for left and right children
-  generateHuffmanCodes(node->left, codes, currentCode + "0");
-  generateHuffmanCodes(node->right, codes, currentCode + "1");
+  generateHuffmanCodes(huffmanTree, huffmanTree.node(node).child[0], codes,
+                       currentCode + "0");
+  generateHuffmanCodes(huffmanTree, huffmanTree.node(node).child[1], codes,
+                       currentCode + "1");
 }
 
 //
@@ -142,75 +147,88 @@ void generateHuffmanCodes(const TreeNode *node, std::vector<std::string> &codes,
 // strings
 void readHuffmanCodesFromFile(const std::string &filename,
                               std::vector<std::string> &huffmanCodes) {
+  std::string error;
+  if (!parseHuffmanInfoFile(filename, huffmanCodes, error)) {
+    std::cout << "Error: " << error << std::endl;
+  }
+}
+
+//
+// parseHuffmanInfoFile
+//
+// Function reads the Huffman Codes of a .hi file without printing anything,
+// returns false with a message in error if the file cannot be used. The codes
+// are all empty after an error.
+bool parseHuffmanInfoFile(const std::string &filename,
+                          std::vector<std::string> &huffmanCodes,
+                          std::string &error) {
+  // Forget the codes of any previously loaded file
+  huffmanCodes.assign(ALPHABET_SIZE, "");
   // opening .hi file for reading
   std::ifstream hiFile(filename);
 
   if (!hiFile.is_open()) {
-    std::cout << "Error: Unable to open Huffman Information file." << std::endl;
-    return;
+    error = "Unable to open Huffman Information file.";
+    return false;
   }
 
   std::string line;
-  // Skip the first line
+  // The first line is blank, or "canonical" for files that only store the
+  // length of each code
   std::getline(hiFile, line);
+  bool canonical = line.compare(0, 9, "canonical") == 0;
 
-  int asciiValue;
+  int byteValue;
   std::string code;
-  // Read the file line by line, extract the ascii value and code and store it
+  // Read the file line by line, extract the byte value and code and store it
   // in the huffmanCodes vector
-  while (hiFile >> asciiValue >> code) {
-    huffmanCodes[asciiValue] = code;
+  while (hiFile >> byteValue >> code) {
+    if (byteValue < 0 || byteValue >= ALPHABET_SIZE) {
+      error = "Invalid byte value in Huffman Information file: " +
+              std::to_string(byteValue);
+      huffmanCodes.assign(ALPHABET_SIZE, "");
+      return false;
+    }
+    huffmanCodes[byteValue] = code;
   }
   // close file
   hiFile.close();
+
+  // Rebuild the canonical codes from the code lengths
+  if (canonical) {
+    std::vector<int> codeLengths(ALPHABET_SIZE, 0);
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+      if (!huffmanCodes[i].empty()) {
+        codeLengths[i] = std::atoi(huffmanCodes[i].c_str());
+      }
+    }
+    std::vector<HuffmanCode> codes;
+    if (!assignCanonicalCodes(codeLengths, codes)) {
+      error = "Invalid code lengths in Huffman Information file.";
+      huffmanCodes.assign(ALPHABET_SIZE, "");
+      return false;
+    }
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+      huffmanCodes[i] = codeString(codes[i]);
+    }
+  }
+  return true;
 }
 
 //
 // rebuildHuffmanTree
 //
-// Function rebuilds Huffman Tree from the huffmanCodes vector and returns a
-// vpointer to the root node of the treew
-TreeNode *rebuildHuffmanTree(const std::vector<std::string> &huffmanCodes) {
-  // Create a new root node with null character and 0 frequency
-  TreeNode *root = new TreeNode('\0', 0);
-  // Iterate through the huffmanCodes Vector
-  for (int index = 0; index < huffmanCodes.size(); ++index) {
-    // get the character at the current index
-    unsigned char character = index;
-    // Get the Huffman code for the index
-    const std::string &code = huffmanCodes[index];
-    // if the Huffman code is blank, continue to the next character
-    if (code.empty()) {
-      continue;
-    }
-    // iterate through the huffman code, creating the tree as needed
-    TreeNode *currentNode = root;
-    for (const char c : code) {
-      if (c == '0') {
-        // if there isn't a left child, create a new node with a null character
-        if (currentNode->left == nullptr) {
-          currentNode->left = new TreeNode('\0', 0);
-        }
-        // Move left
-        currentNode = currentNode->left;
-      } else if (c == '1') {
-        // If there isn't a right child, create a new node with a null character
-        if (currentNode->right == nullptr) {
-          currentNode->right = new TreeNode('\0', 0);
-        }
-        // Move right
-        currentNode = currentNode->right;
-      } else {
-        // If character is invalid, exit with error
-        cout << "Invalid character in Huffman code" << std::endl;
-        exit(0);
-      }
-    }
-    // Set the character of the current node to charcter correstponding
-    currentNode->character = character;
+// Function rebuilds Huffman Tree from the huffmanCodes vector in place,
+// returns false and leaves the tree empty if the codes are not a valid prefix
+// code
+bool rebuildHuffmanTree(const std::vector<std::string> &huffmanCodes,
+                        FlatHuffmanTree &huffmanTree) {
+  if (!huffmanTree.rebuild(huffmanCodes)) {
+    cout << "Error: Huffman codes do not form a valid prefix code"
+         << std::endl;
+    return false;
   }
-  // Return root of the rebuilt Huffman tree
-  return root;
+  return true;
 }
 
 //
@@ -256,7 +274,7 @@ int flushBitBuffer(std::ofstream &outputFile, int &bitBuffer, int &bitCount) {
 unsigned char
 findLongHuffmanCode(const std::vector<std::string> &huffmanCodes) {
   // Iterate through the huffmanCodes vector
-  for (int i = 0; i < huffmanCodes.size(); ++i) {
+  for (size_t i = 0; i < huffmanCodes.size(); ++i) {
     // If the current Huffman code has a length greater than 8, return the
     // corresponding character
     if (huffmanCodes[i].length() > 8) {
@@ -290,12 +308,12 @@ void readBit(std::istream &in, bool &bit, int &bitBuffer, int &bitCount) {
 // Function decompresses a .hc file and writes the new contents to a file
 void decompressFile(const std::string &inputFilename,
                     const std::string &outputFilename,
-                    const BinaryTree *huffmanTree) {
-  // Open input and output files in binary mode
-  std::ifstream inputFile(inputFilename, std::ios::binary);
+                    const FlatHuffmanTree &huffmanTree) {
+  // Map the input file and open the output file in binary mode
+  MappedInput inputFile;
   std::ofstream outputFile(outputFilename, std::ios::binary);
   // Check if input and output files are open
-  if (!inputFile.is_open()) {
+  if (!inputFile.open(inputFilename)) {
     std::cout << "Error: Unable to open input file." << std::endl;
     return;
   }
@@ -305,145 +323,221 @@ void decompressFile(const std::string &inputFilename,
     return;
   }
 
-  int bitBuffer = 0;
-  int bitCount = 0;
-  bool bit;
-  TreeNode *currentNode = huffmanTree->getRoot();
-  // Continue reading bits from the input file until EOF is reached
-  while (inputFile.peek() != std::ifstream::traits_type::eof()) {
-    readBit(inputFile, bit, bitBuffer, bitCount);
-    // Move to the right child if bit is 1, otherwise move to the left child
-    if (bit) {
-      currentNode = currentNode->right;
-    } else {
-      currentNode = currentNode->left;
-    }
-    // If currentNode is a leaf node, we have found a character
-    if (currentNode->left == nullptr && currentNode->right == nullptr) {
-      outputFile.put(currentNode->character);
-      currentNode = huffmanTree->getRoot();
-    }
+  // Build the lookup tables of the table-driven decoder from the Huffman tree
+  HuffmanDecoder decoder;
+  if (!decoder.build(huffmanTree)) {
+    std::cout << "Error: Unable to build Huffman decoding tables." << std::endl;
+    return;
+  }
+
+  // Decode the whole mapped input a symbol at a time and time the throughput
+  uint64_t bytesOut = 0;
+  auto start = std::chrono::steady_clock::now();
+  if (!decoder.decodeSpan(inputFile.data(), inputFile.size(), outputFile,
+                          bytesOut)) {
+    std::cout << "Error: invalid Huffman code or truncated input" << std::endl;
   }
+  outputFile.flush();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
   // Close input and output files
   inputFile.close();
   outputFile.close();
+
+  double seconds = std::max(elapsed.count(), 1e-9);
+  std::cout << "Decompressed " << bytesOut << " bytes in " << std::fixed
+            << std::setprecision(5) << seconds << " s ("
+            << bytesOut / seconds / 1e6 << " MB/s)" << std::endl;
+}
+
+//
+// canonicalCodeLengths
+//
+// Function finds the code length of every byte value with no code longer than
+// maxCodeLength bits, returns false if the limit is too small for the number
+// of distinct bytes
+bool canonicalCodeLengths(const std::vector<uint64_t> &frequencies,
+                          int maxCodeLength, std::vector<int> &codeLengths) {
+  if (!optimalCodeLengths(frequencies, maxCodeLength, codeLengths)) {
+    std::cout << "Error: " << maxCodeLength
+              << " bits are too few for the bytes in this file." << std::endl;
+    return false;
+  }
+  return true;
 }
 
 //
 // createHuffmanInfoFile
 //
-// Function creates a .hi files containing huffman codes from input file
-void createHuffmanInfoFile(const string &input) {
+// Function creates a .hi files containing huffman codes from input file. With
+// a maxCodeLength the codes are canonical, no longer than maxCodeLength bits,
+// and the file only stores the length of each code.
+void createHuffmanInfoFile(const string &input, int maxCodeLength) {
   // build a new .hi file using the information in the file: input
-  std::vector<int> frequencies;
+  std::vector<uint64_t> frequencies;
   readFileFrequencies(input, frequencies);
 
-  // Generate the Huffman codes for the characters using the temporary Huffman
-  // tree
-  BinaryTree *huffmanTreeTemp = createHuffmanTree(frequencies);
-  std::vector<std::string> huffmanCodesTemp(128, "");
-  generateHuffmanCodes(huffmanTreeTemp->getRoot(), huffmanCodesTemp, "");
+  std::vector<std::string> huffmanCodesTemp(ALPHABET_SIZE, "");
+  std::vector<int> codeLengths;
+  if (maxCodeLength > 0) {
+    if (!canonicalCodeLengths(frequencies, maxCodeLength, codeLengths)) {
+      return;
+    }
+  } else {
+    // Generate the Huffman codes for the characters using the temporary
+    // Huffman tree
+    FlatHuffmanTree huffmanTreeTemp;
+    createHuffmanTree(frequencies, huffmanTreeTemp);
+    generateHuffmanCodes(huffmanTreeTemp, huffmanTreeTemp.root(),
+                         huffmanCodesTemp, "");
+  }
 
   // Save the frequency information to a .hi file
   std::string hiFilename = input + ".hi";
+  if (writeHuffmanInfoFile(hiFilename, huffmanCodesTemp, codeLengths)) {
+    cout << "Huffman Information file created: " << hiFilename << std::endl;
+  } else {
+    cout << "Error: Unable to create Huffman Information file." << std::endl;
+  }
+}
+
+//
+// writeHuffmanInfoFile
+//
+// Function writes a .hi file. Given code lengths it is a canonical file that
+// only stores the length of each code, otherwise it stores every code.
+// Returns false if the file cannot be written.
+bool writeHuffmanInfoFile(const std::string &hiFilename,
+                          const std::vector<std::string> &huffmanCodes,
+                          const std::vector<int> &codeLengths) {
   std::ofstream hiFile(hiFilename);
   // Check if the .hi file is open and ready for writing
-  if (hiFile.is_open()) {
-    hiFile << std::endl;
-    // Write the Huffman codes for each character to the .hi file
-    for (int i = 0; i < 128; i++) {
-      hiFile << i << "    " << huffmanCodesTemp[i] << std::endl;
+  if (!hiFile.is_open()) {
+    return false;
+  }
+  if (!codeLengths.empty()) {
+    // Write the code length of each byte value that occurs in the input
+    hiFile << "canonical" << std::endl;
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+      if (codeLengths[i] > 0) {
+        hiFile << i << "    " << codeLengths[i] << std::endl;
+      }
     }
-    // Write the Huffman codes for each character to the .hi file
-    hiFile.close();
-    cout << "Huffman Information file created: " << hiFilename << std::endl;
   } else {
-    cout << "Error: Unable to create Huffman Information file." << std::endl;
+    hiFile << std::endl;
+    // Write the Huffman codes for each byte value that occurs in the input
+    // to the .hi file
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+      if (!huffmanCodes[i].empty()) {
+        hiFile << i << "    " << huffmanCodes[i] << std::endl;
+      }
+    }
   }
+  hiFile.close();
+  return (bool)hiFile;
 }
 
 //
 // loadHuffmanInfoFile
 //
 // Function loads the Huffman codes from a .hi file and creates a Huffman tree
-// from the loadedd codes
-void loadHuffmanInfoFile(const string &input,
+// from the loadedd codes, returns false if the codes do not form a tree
+bool loadHuffmanInfoFile(const string &input,
                          std::vector<std::string> &huffmanCodes,
-                         BinaryTree *&huffmanTree) {
+                         FlatHuffmanTree &huffmanTree) {
   // Load a .hi file to later perform compression and decompression
   readHuffmanCodesFromFile(input, huffmanCodes);
-  // If there is an existing Huffman tree, delete it to avoid memory leaks
-  if (huffmanTree != nullptr) {
-    delete huffmanTree;
+  // Rebuild the Huffman tree using the loaded Huffman codes, reusing the node
+  // array of any previously loaded tree
+  if (!rebuildHuffmanTree(huffmanCodes, huffmanTree)) {
+    huffmanCodes.assign(ALPHABET_SIZE, "");
+    return false;
   }
-  // Rebuild the Huffman tree using the loaded Huffman codes
-  TreeNode *root = rebuildHuffmanTree(huffmanCodes);
-  huffmanTree = new BinaryTree(root);
 
   std::cout << "Huffman Information file loaded: " << input << std::endl;
+  return true;
 }
 
 //
 // compressFile
 //
-// Function compresses the input file with saved HuffmanTree and Codes, and
+// Function compresses the input file with the saved Huffman codes, and
 // creates a .hc file with the new data
-void compressFile(const string &input, const BinaryTree *huffmanTree,
-                  const std::vector<std::string> huffmanCodes) {
+void compressFile(const string &input,
+                  const std::vector<std::string> &huffmanCodes) {
   // Create the output file name by appending the ".hc" extension to the input
   // file name
   std::string outputFilename = input + ".hc";
-  // Open the input and output files
-  std::ifstream inputFile(input, std::ios::binary);
+  // Map the input file
+  MappedInput inputFile;
+  if (!inputFile.open(input)) {
+    std::cout << "Error: Unable to open input file." << std::endl;
+    return;
+  }
+  // Every byte of the input needs a code, a byte without one would silently
+  // be left out of the .hc file
+  std::vector<uint64_t> frequencies(ALPHABET_SIZE, 0);
+  histogram(inputFile.data(), inputFile.size(), frequencies.data());
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    if (frequencies[i] > 0 &&
+        ((size_t)i >= huffmanCodes.size() || huffmanCodes[i].empty())) {
+      std::cout << "Error: byte value " << i << " has no code" << std::endl;
+      return;
+    }
+  }
+  // Open the output file
   std::ofstream outputFile(outputFilename, std::ios::binary);
 
-  if (!inputFile.is_open()) {
-    std::cout << "Error: Unable to open input file." << std::endl;
-  } else if (!outputFile.is_open()) {
+  if (!outputFile.is_open()) {
     std::cout << "Error: Unable to open output file." << std::endl;
   } else {
-    // Initialize the bit buffer, bit count, input file size, and output file
-    // size
-    int bitBuffer = 0;
-    int bitCount = 0;
-    int inputSize = 0;
-    int outputSize = 0;
-    // Read the input file byte by byte
-    unsigned char byte;
-    while (inputFile.read((char *)&byte, 1)) {
-      inputSize++;
-      // Write the Huffman code for each byte to the output file using the
-      // writeBit function
-      for (char bit : huffmanCodes[byte]) {
-        outputSize += writeBit(outputFile, bit == '1', bitBuffer, bitCount);
-      }
+    // Pack the integer Huffman codes of the input into large output blocks
+    HuffmanEncoder encoder;
+    if (!encoder.build(huffmanCodes)) {
+      std::cout << "Error: Unable to build Huffman encoding tables."
+                << std::endl;
+      return;
     }
-
-    // Flush any remaining bits in the bit buffer to the output file
-    outputSize += flushBitBuffer(outputFile, bitBuffer, bitCount);
+    // Encode the mapped input in place, the bit writer hands the output to
+    // the file in large blocks
+    BitWriter writer(outputFile);
+    encoder.encodeBlock(inputFile.data(), inputFile.size(), writer);
+    writer.flush();
+    uint64_t inputSize = inputFile.size();
+    uint64_t outputSize = writer.bytesWritten();
     // Close the input and output files
     inputFile.close();
     outputFile.close();
     // Calculate and display the compression statistics
-    double compressionRatio = (double)(inputSize) / outputSize;
-    double spaceSaving = (1.0 - (double)(outputSize) / inputSize) * 100.0;
-
-    std::cout << "Input file size: " << inputSize << " bytes" << std::endl;
-    std::cout << "Compressed file size: " << outputSize << " bytes"
-              << std::endl;
-    std::cout << "Compression ratio: " << std::fixed << std::setprecision(5)
-              << compressionRatio << std::endl;
-    std::cout << "Space saving: " << std::fixed << std::setprecision(5)
-              << spaceSaving << " %" << std::endl;
+    printCompressionStatistics(inputSize, outputSize);
   }
 }
 
+//
+// printCompressionStatistics
+//
+// Function displays the sizes, compression ratio and space saving of a
+// compressed file
+void printCompressionStatistics(uint64_t inputSize, uint64_t outputSize) {
+  double compressionRatio = (double)(inputSize) / outputSize;
+  double spaceSaving = (1.0 - (double)(outputSize) / inputSize) * 100.0;
+
+  std::cout << "Input file size: " << inputSize << " bytes" << std::endl;
+  std::cout << "Compressed file size: " << outputSize << " bytes"
+            << std::endl;
+  std::cout << "Compression ratio: " << std::fixed << std::setprecision(5)
+            << compressionRatio << std::endl;
+  std::cout << "Space saving: " << std::fixed << std::setprecision(5)
+            << spaceSaving << " %" << std::endl;
+}
+
 //
 // decompressFile
 //
 // Function decompresses the input file with the saved huffmanTree and makes a
 // decompressed file with the next data
-void decompressFile(const string &input, const BinaryTree *huffmanTree) {
+void decompressFile(const string &input,
+                    const FlatHuffmanTree &huffmanTree) {
   // Create the output file name by removing the ".hc" extension from the input
   // file name
   std::string outputFilename = input.substr(0, input.size() - 3);
@@ -451,4 +545,970 @@ void decompressFile(const string &input, const BinaryTree *huffmanTree) {
   // the Huffman tree
   decompressFile(input, outputFilename, huffmanTree);
   std::cout << "Decompressed file: " << outputFilename << std::endl;
-}
\ No newline at end of file
+}
+//
+// compressContainerFile
+//
+// Function compresses the input file into a self-contained .hz file that
+// carries its own canonical code table, size and checksum, using codes of at
+// most maxCodeLength bits
+void compressContainerFile(const string &input, int maxCodeLength) {
+  // Only the code lengths are stored, the canonical codes are rebuilt from
+  // them on both sides
+  CodecStats stats;
+  std::vector<uint64_t> frequencies;
+  readFileFrequencies(input, frequencies, 1, &stats);
+  StageClock clock(&stats);
+  std::vector<int> codeLengths;
+  if (!canonicalCodeLengths(frequencies, maxCodeLength, codeLengths)) {
+    return;
+  }
+  clock.lap(STAGE_TREE);
+  stats.addEntropy(frequencies);
+
+  std::string outputFilename = input + ".hz";
+  CodecResult result = compressToContainer(input, outputFilename, codeLengths);
+  mergeOuterStats(stats, result);
+  printStatsJson("compress", input, outputFilename, result);
+  if (!result.ok) {
+    std::cout << "Error: " << result.error << std::endl;
+    return;
+  }
+  std::cout << "Compressed file: " << outputFilename << std::endl;
+  printCompressionStatistics(result.bytesIn, result.bytesOut);
+}
+
+//
+// compressBlockedContainerFile
+//
+// Function compresses the input file into a .hz file of independent blocks of
+// blockSize bytes that are encoded and decoded in parallel on `threads`
+// threads (0 uses every hardware thread). Adaptive files give every block its
+// own Huffman table instead of one table for the whole file. With more than
+// one stream every block is coded in that many interleaved bitstreams.
+void compressBlockedContainerFile(const string &input, size_t blockSize,
+                                  int threads, bool adaptive, int streams) {
+  CodecStats stats;
+  std::vector<int> codeLengths;
+  if (!adaptive) {
+    std::vector<uint64_t> frequencies;
+    readFileFrequencies(input, frequencies, threads, &stats);
+    StageClock clock(&stats);
+    if (!canonicalCodeLengths(frequencies, DEFAULT_MAX_CODE_LENGTH,
+                              codeLengths)) {
+      return;
+    }
+    clock.lap(STAGE_TREE);
+    stats.addEntropy(frequencies);
+  }
+
+  std::string outputFilename = input + ".hz";
+  CodecResult result = compressToBlockedContainer(input, outputFilename,
+                                                  codeLengths, blockSize,
+                                                  threads, adaptive, streams);
+  mergeOuterStats(stats, result);
+  printStatsJson("compress", input, outputFilename, result);
+  if (!result.ok) {
+    std::cout << "Error: " << result.error << std::endl;
+    return;
+  }
+  std::cout << "Compressed file: " << outputFilename << std::endl;
+  printCompressionStatistics(result.bytesIn, result.bytesOut);
+}
+
+//
+// decompressContainerFile
+//
+// Function decompresses a .hz file without needing a .hi file, the output
+// file name is the input file name without the ".hz" extension
+void decompressContainerFile(const string &input) {
+  std::string outputFilename = input.substr(0, input.size() - 3);
+  CodecResult result = decompressContainer(input, outputFilename);
+  printStatsJson("decompress", input, outputFilename, result);
+  if (!result.ok) {
+    std::cout << "Error: " << result.error << std::endl;
+    return;
+  }
+  std::cout << "Decompressed file: " << outputFilename << " ("
+            << result.bytesOut << " bytes)" << std::endl;
+}
+
+//
+// streamStandardIO
+//
+// Function compresses standard input into a streamed .hz file on standard
+// output, or decompresses it back, so the program works in pipelines. Returns
+// the exit status of the program.
+int streamStandardIO(bool compress) {
+  std::ios::sync_with_stdio(false);
+  std::cin.tie(nullptr);
+  CodecResult result = compress ? compressStream(std::cin, std::cout)
+                                : decompressStream(std::cin, std::cout);
+  std::cout.flush();
+  printStatsJson(compress ? "compress" : "decompress", "-", "-", result);
+  if (!result.ok) {
+    std::cerr << "Error: " << result.error << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+//
+// statsJsonEnabled
+//
+// Function returns true if the statistics of every call should be printed,
+// with the -s option or HUFFMAN_STATS=json in the environment
+bool statsJsonEnabled() {
+  const char *setting = std::getenv("HUFFMAN_STATS");
+  return statsJsonRequested ||
+         (setting != nullptr && std::string(setting) == "json");
+}
+
+//
+// printStatsJson
+//
+// Function prints the result and statistics of a call as one line of JSON on
+// standard error, if they were asked for
+void printStatsJson(const std::string &operation, const std::string &input,
+                    const std::string &output, const CodecResult &result) {
+  if (statsJsonEnabled()) {
+    std::cerr << codecResultJson(operation, input, output, result) << '\n';
+  }
+}
+
+// BatchOptions holds the command line of a non-interactive run.
+struct BatchOptions {
+  char mode;               // 'c' compress, 'd' decompress, 't' test,
+                           // 'a' add a table to the table cache, 'r' read
+                           // a range of a compressed file, 'g' generate a
+                           // fixed table
+  int threads;             // files handled at once, 0 for every hardware thread
+  size_t blockSize;        // adaptive blocks of this size, 0 for one stream
+  int streams;             // interleaved bitstreams per block
+  bool context;            // code every byte by the byte before it
+  bool runLength;          // code runs of the same byte as counts
+  bool perFileTables;      // keep a .hi file next to every .hc file
+  std::string sharedTable; // .hi file used for every .hc file
+  std::string tableCache;  // .htc file of tables the .hz files refer to
+  std::string tableName;   // table of the cache to compress with or add
+  std::string fixedName;   // name of the fixed table written by -g
+  uint64_t sampleBytes;    // train tables on samples of this size, 0 for all
+  uint64_t rangeOffset;    // first original byte read by -r
+  uint64_t rangeLength;    // number of bytes read by -r
+  std::vector<std::string> paths;
+
+  BatchOptions() {
+    mode = 0;
+    threads = 0;
+    blockSize = 0;
+    streams = 1;
+    context = false;
+    runLength = false;
+    perFileTables = false;
+    sampleBytes = 0;
+    rangeOffset = 0;
+    rangeLength = 0;
+  }
+};
+
+//
+// printBatchUsage
+//
+// Function displays the command line options of a non-interactive run
+void printBatchUsage() {
+  std::cerr
+      << "usage: filecompress -c|-d|-t|-a [options] [file or directory "
+         "...]\n"
+         "       filecompress -r offset:length [-T cache] file.hz\n"
+         "       filecompress -g Name table.hi > Name.h\n"
+         "  -c        compress every file into <file>.hz\n"
+         "  -d        decompress every .hz file\n"
+         "  -t        decode and check every .hz file without writing it, "
+         "or every\n"
+         "            .hc file for invalid codes with -h or -H\n"
+         "  -a        add a table made from all the files to the table cache\n"
+         "  -r o:l    write l bytes of the original data from byte o on to "
+         "standard\n"
+         "            output, decoding only the blocks that hold them in "
+         "files\n"
+         "            compressed with -b\n"
+         "  -g Name   write a C++ header of the codes of a .hi file as the "
+         "fixed\n"
+         "            table Name, to compile into the program (see "
+         "FixedTables.h)\n"
+         "  -j N      handle N files at once (default: every hardware "
+         "thread), or\n"
+         "            the blocks of a single file compressed with -b\n"
+         "  -b KiB    use adaptive blocks of KiB KiB instead of one stream\n"
+         "  -i N      code every block in N interleaved bitstreams (1 to 8), "
+         "which\n"
+         "            are decoded side by side\n"
+         "  -o        code every byte with a table chosen by the byte before "
+         "it,\n"
+         "            smaller for text but slower to decode\n"
+         "  -l        code runs of the same byte as counts, smaller and "
+         "faster for\n"
+         "            data with long runs\n"
+         "  -h        use a .hi table per file: <file>.hi and <file>.hc\n"
+         "  -H table  use one .hi table for every file (<file>.hc)\n"
+         "  -T cache  use the tables of a .htc table cache, needed to "
+         "decompress\n"
+         "            files compressed with one\n"
+         "  -n name   the table of the cache to compress with or to add\n"
+         "  -S MiB    train the table of -c or -a on a sample of MiB MiB of "
+         "every\n"
+         "            file, coding at most 1% worse than a table of the whole "
+         "file\n"
+         "  -s        print the statistics of every file as JSON on standard "
+         "error,\n"
+         "            like HUFFMAN_STATS=json in the environment\n"
+         "directories are searched recursively. Without any file -c and -d "
+         "read\n"
+         "standard input and write standard output. One line of "
+         "tab-separated\n"
+         "statistics is printed per file, the ratio is original size / "
+         "compressed size.\n";
+}
+
+//
+// parseBatchOptions
+//
+// Function reads the command line into options, returns false with a
+// message in error if it is not valid
+bool parseBatchOptions(int argc, char **argv, BatchOptions &options,
+                       std::string &error) {
+  bool endOfOptions = false;
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (endOfOptions || argument.size() < 2 || argument[0] != '-') {
+      options.paths.push_back(argument);
+    } else if (argument == "--") {
+      endOfOptions = true;
+    } else if (argument == "-c" || argument == "-d" || argument == "-t" ||
+               argument == "-a") {
+      if (options.mode != 0 && options.mode != argument[1]) {
+        error = "only one of -c, -d, -t, -a, -r and -g can be given";
+        return false;
+      }
+      options.mode = argument[1];
+    } else if (argument == "-h") {
+      options.perFileTables = true;
+    } else if (argument == "-o") {
+      options.context = true;
+    } else if (argument == "-l") {
+      options.runLength = true;
+    } else if (argument == "-s") {
+      statsJsonRequested = true;
+    } else if (argument == "-j" || argument == "-b" || argument == "-H" ||
+               argument == "-T" || argument == "-n" || argument == "-S" ||
+               argument == "-r" || argument == "-i" || argument == "-g") {
+      if (i + 1 == argc) {
+        error = "missing value after " + argument;
+        return false;
+      }
+      std::string value = argv[++i];
+      if (argument == "-g") {
+        if (options.mode != 0 && options.mode != 'g') {
+          error = "-g cannot be used with -c, -d, -t, -a or -r";
+          return false;
+        }
+        bool identifier = !std::isdigit((unsigned char)value[0]);
+        for (char c : value) {
+          identifier =
+              identifier && (std::isalnum((unsigned char)c) || c == '_');
+        }
+        if (!identifier) {
+          error = "invalid value for -g: " + value;
+          return false;
+        }
+        options.mode = 'g';
+        options.fixedName = value;
+        continue;
+      }
+      if (argument == "-r") {
+        if (options.mode != 0 && options.mode != 'r') {
+          error = "-r cannot be used with -c, -d, -t, -a or -g";
+          return false;
+        }
+        options.mode = 'r';
+        char *end;
+        options.rangeOffset = std::strtoull(value.c_str(), &end, 10);
+        if (*end == ':' && std::isdigit((unsigned char)end[1])) {
+          options.rangeLength = std::strtoull(end + 1, &end, 10);
+        }
+        if (*end != '\0' || !std::isdigit((unsigned char)value[0])) {
+          error = "invalid value for -r: " + value;
+          return false;
+        }
+        continue;
+      }
+      if (argument == "-H" || argument == "-T" || argument == "-n") {
+        std::string &text = argument == "-H"   ? options.sharedTable
+                             : argument == "-T" ? options.tableCache
+                                                : options.tableName;
+        text = value;
+        continue;
+      }
+      char *end;
+      long number = std::strtol(value.c_str(), &end, 10);
+      if (*end != '\0' || number < (argument == "-j" ? 0 : 1) ||
+          (argument == "-b" && (uint64_t)number * 1024 > UINT32_MAX) ||
+          (argument == "-S" && number > (1 << 20)) ||
+          (argument == "-i" && number > MAX_INTERLEAVED_STREAMS)) {
+        error = "invalid value for " + argument + ": " + value;
+        return false;
+      }
+      if (argument == "-j") {
+        options.threads = number;
+      } else if (argument == "-b") {
+        options.blockSize = number * 1024;
+      } else if (argument == "-i") {
+        options.streams = number;
+      } else {
+        options.sampleBytes = (uint64_t)number << 20;
+      }
+    } else {
+      error = "unknown option " + argument;
+      return false;
+    }
+  }
+  if (options.mode == 0) {
+    error = "one of -c, -d, -t, -a, -r or -g is required";
+    return false;
+  }
+  bool cached = !options.tableCache.empty();
+  if (options.mode == 'r' &&
+      (options.paths.size() != 1 || options.perFileTables ||
+       !options.sharedTable.empty() || options.blockSize > 0 ||
+       options.sampleBytes > 0 || !options.tableName.empty())) {
+    error = "-r reads one .hz file and only takes -T and -s";
+    return false;
+  }
+  if (options.mode == 'g' &&
+      (options.paths.size() != 1 || options.perFileTables ||
+       !options.sharedTable.empty() || cached || options.blockSize > 0 ||
+       options.sampleBytes > 0 || !options.tableName.empty() ||
+       options.context || options.runLength)) {
+    error = "-g reads one .hi file and takes no other options";
+    return false;
+  }
+  if (cached && (options.perFileTables || !options.sharedTable.empty() ||
+                 options.blockSize > 0)) {
+    error = "-T cannot be used with -h, -H or -b";
+    return false;
+  }
+  if ((options.mode == 'a' || (options.mode == 'c' && cached)) &&
+      (!cached || options.tableName.empty())) {
+    error = options.mode == 'a' ? "-a needs -T and -n" : "-T needs -n with -c";
+    return false;
+  }
+  if (!options.tableName.empty() && options.mode != 'a' &&
+      options.mode != 'c') {
+    error = "-n is only used with -c and -a";
+    return false;
+  }
+  if (options.sampleBytes > 0 &&
+      (options.mode == 'd' || options.mode == 't' ||
+       (options.mode == 'c' &&
+        (cached || options.perFileTables || !options.sharedTable.empty() ||
+         options.blockSize > 0)))) {
+    error = "-S only trains the table of -c without -b, -h, -H and -T, or -a";
+    return false;
+  }
+  if ((cached || options.mode == 'a') && options.paths.empty()) {
+    error = "table caches cannot be used on standard input";
+    return false;
+  }
+  if (options.perFileTables && !options.sharedTable.empty()) {
+    error = "-h and -H cannot be used together";
+    return false;
+  }
+  if (options.blockSize > 0 &&
+      (options.perFileTables || !options.sharedTable.empty())) {
+    error = "-b cannot be used with .hi tables";
+    return false;
+  }
+  if (options.context &&
+      (options.mode != 'c' || cached || options.perFileTables ||
+       !options.sharedTable.empty() || options.blockSize > 0 ||
+       options.sampleBytes > 0 || options.paths.empty())) {
+    error = "-o only applies to files given to -c without -b, -h, -H, -S "
+            "and -T";
+    return false;
+  }
+  if (options.runLength &&
+      (options.mode != 'c' || cached || options.perFileTables ||
+       !options.sharedTable.empty() || options.blockSize > 0 ||
+       options.sampleBytes > 0 || options.context || options.paths.empty())) {
+    error = "-l only applies to files given to -c without -b, -h, -H, -o, -S "
+            "and -T";
+    return false;
+  }
+  if (options.streams > 1 &&
+      (options.mode != 'c' || options.blockSize == 0)) {
+    error = "-i only applies to -c with -b";
+    return false;
+  }
+  return true;
+}
+
+//
+// hasSuffix
+//
+// Function returns true if text ends with suffix
+bool hasSuffix(const std::string &text, const std::string &suffix) {
+  return text.size() >= suffix.size() &&
+         text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+//
+// collectBatchFiles
+//
+// Function lists the files a batch works on. Files named on the command line
+// are taken as they are, directories are searched recursively for the files
+// the mode applies to: files that are not compressed yet for -c and -a, and
+// compressed files for -d and -t.
+bool collectBatchFiles(const BatchOptions &options,
+                       std::vector<std::string> &files, std::string &error) {
+  bool tables = options.perFileTables || !options.sharedTable.empty();
+  std::string compressedSuffix = tables ? ".hc" : ".hz";
+  for (const std::string &path : options.paths) {
+    std::error_code status;
+    if (!std::filesystem::is_directory(path, status)) {
+      files.push_back(path);
+      continue;
+    }
+    std::vector<std::string> found;
+    std::filesystem::recursive_directory_iterator entries(path, status);
+    std::filesystem::recursive_directory_iterator end;
+    for (; !status && entries != end; entries.increment(status)) {
+      if (!entries->is_regular_file(status)) {
+        continue;
+      }
+      std::string name = entries->path().string();
+      bool compressed = hasSuffix(name, ".hz") || hasSuffix(name, ".hc") ||
+                        hasSuffix(name, ".hi");
+      bool original = options.mode == 'c' || options.mode == 'a';
+      if (original ? !compressed : hasSuffix(name, compressedSuffix)) {
+        found.push_back(name);
+      }
+    }
+    if (status) {
+      error = "unable to read directory " + path + ": " + status.message();
+      return false;
+    }
+    // directory order is arbitrary, keep runs repeatable
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+  }
+  return true;
+}
+
+//
+// compressWithCodes
+//
+// Function compresses a file into a .hc bitstream with the given codes,
+// refusing files that hold a byte value without a code. A .hc file does not
+// store its length, so the last byte is padded with the start of the longest
+// code, which never decodes to a symbol. Files whose padding is as long as
+// every code cannot be stored exactly and are refused as well.
+CodecResult compressWithCodes(const std::string &input,
+                              const std::string &outputFilename,
+                              const std::vector<std::string> &huffmanCodes) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  // a table compiled into the program needs nothing built
+  int fixedTable = BuiltinFixedTables::find(huffmanCodes);
+  HuffmanEncoder encoder;
+  if (fixedTable < 0 && !encoder.build(huffmanCodes)) {
+    result.error = "unable to build Huffman encoding tables";
+    return result;
+  }
+  clock.lap(STAGE_TABLES);
+  MappedInput inputFile;
+  if (!inputFile.open(input)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  std::vector<uint64_t> counts(ALPHABET_SIZE, 0);
+  histogram(inputFile.data(), inputFile.size(), counts.data());
+  clock.lap(STAGE_HISTOGRAM);
+  result.stats.addEntropy(counts);
+  uint64_t bits = 0;
+  std::string longest;
+  for (int i = 0; i < ALPHABET_SIZE; i++) {
+    if (counts[i] > 0 && huffmanCodes[i].empty()) {
+      result.error = "byte value " + std::to_string(i) + " has no code";
+      return result;
+    }
+    bits += counts[i] * huffmanCodes[i].size();
+    if (huffmanCodes[i].size() > longest.size()) {
+      longest = huffmanCodes[i];
+    }
+  }
+  result.stats.maxCodeLength = longest.size();
+  int padding = (8 - bits % 8) % 8;
+  if (padding > 0 && longest.size() <= (size_t)padding) {
+    result.error = "codes are too short to pad the last byte, use .hz";
+    return result;
+  }
+  std::ofstream outputFile(outputFilename, std::ios::binary);
+  if (!outputFile.is_open()) {
+    result.error = "unable to open output file";
+    return result;
+  }
+  clock.lap(STAGE_WRITE);
+  BitWriter writer(outputFile);
+  if (fixedTable >= 0) {
+    BuiltinFixedTables::encodeBlock(fixedTable, inputFile.data(),
+                                    inputFile.size(), writer);
+  } else {
+    encoder.encodeBlock(inputFile.data(), inputFile.size(), writer);
+  }
+  if (padding > 0) {
+    writer.write(std::stoull(longest.substr(0, padding), nullptr, 2), padding);
+  }
+  writer.flush();
+  clock.lap(STAGE_ENCODE);
+  outputFile.close();
+  clock.lap(STAGE_WRITE);
+  result.stats.symbols = inputFile.size();
+  result.stats.codeBits = bits;
+  result.stats.finish();
+  if (!outputFile) {
+    result.error = "unable to write output file";
+    return result;
+  }
+  result.ok = true;
+  result.bytesIn = inputFile.size();
+  result.bytesOut = writer.bytesWritten();
+  return result;
+}
+
+//
+// decompressWithCodes
+//
+// Function decodes a .hc bitstream with the given codes, with an empty
+// output file name it is only checked for invalid codes
+CodecResult decompressWithCodes(const std::string &input,
+                                const std::string &outputFilename,
+                                const std::vector<std::string> &huffmanCodes) {
+  CodecResult result;
+  StageClock clock(&result.stats);
+  MappedInput inputFile;
+  if (!inputFile.open(input)) {
+    result.error = "unable to open input file";
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  result.bytesIn = inputFile.size();
+  HuffmanDecoder decoder;
+  bool noCodes = std::all_of(huffmanCodes.begin(), huffmanCodes.end(),
+                             [](const std::string &code) {
+                               return code.empty();
+                             });
+  // a table compiled into the program needs nothing built
+  int fixedTable = BuiltinFixedTables::find(huffmanCodes);
+  if (fixedTable >= 0) {
+    for (const std::string &code : huffmanCodes) {
+      result.stats.maxCodeLength =
+          std::max<int>(result.stats.maxCodeLength, code.size());
+    }
+  } else if (!noCodes && !decoder.build(huffmanCodes)) {
+    result.error = "unable to build Huffman decoding tables";
+    return result;
+  } else {
+    result.stats.maxCodeLength = decoder.maxCodeLength();
+  }
+  clock.lap(STAGE_TABLES);
+  DiscardBuffer discard;
+  std::ostream nowhere(&discard);
+  std::ofstream outputFile;
+  if (!outputFilename.empty()) {
+    outputFile.open(outputFilename, std::ios::binary);
+    if (!outputFile.is_open()) {
+      result.error = "unable to open output file";
+      return result;
+    }
+  }
+  std::ostream &out = outputFilename.empty() ? nowhere : outputFile;
+  // the decoded bytes go to the file while decoding, that part of the
+  // writing counts as decoding
+  clock.lap(STAGE_WRITE);
+  if (noCodes) {
+    // a table without codes belongs to an empty file
+    if (inputFile.size() > 0) {
+      result.error = "compressed data does not match the table";
+    }
+  } else if (fixedTable >= 0
+                 ? !BuiltinFixedTables::decodeSpan(fixedTable, inputFile.data(),
+                                                   inputFile.size(), out,
+                                                   result.bytesOut)
+                 : !decoder.decodeSpan(inputFile.data(), inputFile.size(), out,
+                                       result.bytesOut)) {
+    result.error = "invalid Huffman code or truncated input";
+  }
+  clock.lap(STAGE_DECODE);
+  out.flush();
+  clock.lap(STAGE_WRITE);
+  result.stats.symbols = result.bytesOut;
+  result.stats.codeBits = (uint64_t)inputFile.size() * 8;
+  result.stats.finish();
+  if (result.error.empty() && !out) {
+    result.error = "unable to write output file";
+  }
+  if (!result.error.empty()) {
+    if (!outputFilename.empty()) {
+      outputFile.close();
+      std::remove(outputFilename.c_str());
+    }
+    return result;
+  }
+  result.ok = true;
+  return result;
+}
+
+// BatchTables holds the tables a batch loads once and shares between the
+// files it works on.
+struct BatchTables {
+  std::vector<std::string> sharedCodes;     // codes of the -H table
+  TableCache cache;                         // tables of the -T cache
+  std::shared_ptr<const CachedTable> table; // the -n table to compress with
+};
+
+//
+// processBatchFile
+//
+// Function compresses, decompresses or tests one file of a batch and stores
+// the name of the file it wrote in output. The blocks of blocked files are
+// coded on `threads` threads, the others on the calling thread.
+CodecResult processBatchFile(const std::string &input,
+                             const BatchOptions &options,
+                             const BatchTables &loaded, int threads,
+                             std::string &output) {
+  CodecResult result;
+  const std::vector<std::string> &sharedCodes = loaded.sharedCodes;
+  bool tables = options.perFileTables || !options.sharedTable.empty();
+  if (options.mode == 'c' && loaded.table != nullptr) {
+    output = input + ".hz";
+    return compressWithTable(input, output, *loaded.table);
+  }
+  if (options.mode == 'c' && options.context) {
+    output = input + ".hz";
+    return compressWithContext(input, output);
+  }
+  if (options.mode == 'c' && options.runLength) {
+    output = input + ".hz";
+    return compressWithRunLength(input, output);
+  }
+  if (options.mode == 'c' && options.sampleBytes > 0) {
+    output = input + ".hz";
+    return compressWithSample(input, output,
+                              histogramSampleOfSize(options.sampleBytes));
+  }
+  if (options.mode == 'c') {
+    // time spent on the table before the file is coded
+    CodecStats stats;
+    StageClock clock(&stats);
+    std::vector<std::string> huffmanCodes = sharedCodes;
+    std::vector<int> codeLengths;
+    if (options.blockSize == 0 && sharedCodes.empty()) {
+      // one canonical table for the whole file
+      std::vector<uint64_t> frequencies;
+      if (!fileHistogram(input, frequencies, 1, &stats)) {
+        result.error = "unable to open input file";
+        return result;
+      }
+      clock.skip();
+      optimalCodeLengths(frequencies, DEFAULT_MAX_CODE_LENGTH, codeLengths);
+      clock.lap(STAGE_TREE);
+      if (!tables) {
+        // compressWithCodes counts the bytes again for itself
+        stats.addEntropy(frequencies);
+      }
+    }
+    if (options.perFileTables) {
+      std::vector<HuffmanCode> codes;
+      assignCanonicalCodes(codeLengths, codes);
+      huffmanCodes.assign(ALPHABET_SIZE, "");
+      for (int i = 0; i < ALPHABET_SIZE; i++) {
+        huffmanCodes[i] = codeString(codes[i]);
+      }
+      clock.lap(STAGE_TABLES);
+      if (!writeHuffmanInfoFile(input + ".hi", huffmanCodes, codeLengths)) {
+        result.error = "unable to create Huffman Information file";
+        return result;
+      }
+      clock.lap(STAGE_WRITE);
+    }
+    if (tables) {
+      output = input + ".hc";
+      result = compressWithCodes(input, output, huffmanCodes);
+      if (!result.ok && options.perFileTables) {
+        std::remove((input + ".hi").c_str());
+      }
+    } else {
+      output = input + ".hz";
+      result = options.blockSize > 0
+                   ? compressToBlockedContainer(input, output, codeLengths,
+                                                options.blockSize, threads,
+                                                true, options.streams)
+                   : compressToContainer(input, output, codeLengths);
+    }
+    mergeOuterStats(stats, result);
+    return result;
+  }
+
+  std::string suffix = tables ? ".hc" : ".hz";
+  if (!hasSuffix(input, suffix)) {
+    result.error = "file name does not end in " + suffix;
+    return result;
+  }
+  std::string original = input.substr(0, input.size() - suffix.size());
+  output = options.mode == 'd' ? original : "";
+  if (!tables) {
+    return decompressContainer(input, output, threads, loaded.cache.lookup());
+  }
+  if (!options.perFileTables) {
+    return decompressWithCodes(input, output, sharedCodes);
+  }
+  std::vector<std::string> huffmanCodes;
+  StageClock clock(&result.stats);
+  if (!parseHuffmanInfoFile(original + ".hi", huffmanCodes, result.error)) {
+    return result;
+  }
+  clock.lap(STAGE_READ);
+  CodecStats stats = result.stats;
+  result = decompressWithCodes(input, output, huffmanCodes);
+  mergeOuterStats(stats, result);
+  return result;
+}
+
+//
+// addBatchTable
+//
+// Function counts the bytes of every file, options.threads files at a time,
+// adds a table for all of them to the cache under options.tableName and saves
+// the cache. With options.sampleBytes only a sample of every file is counted.
+// Returns the exit status of the program.
+int addBatchTable(const BatchOptions &options,
+                  const std::vector<std::string> &files, TableCache &cache) {
+  std::mutex countMutex;
+  std::vector<uint64_t> frequencies(ALPHABET_SIZE, 0);
+  std::string error;
+  ThreadPool pool(options.threads);
+  pool.parallelFor(files.size(), [&](size_t i) {
+    std::vector<uint64_t> counts(ALPHABET_SIZE, 0);
+    bool read;
+    if (options.sampleBytes > 0) {
+      MappedInput file;
+      read = file.open(files[i]);
+      sampleHistogram(file.data(), file.size(),
+                      histogramSampleOfSize(options.sampleBytes),
+                      counts.data());
+    } else {
+      read = fileHistogram(files[i], counts);
+    }
+    std::lock_guard<std::mutex> lock(countMutex);
+    if (!read) {
+      error = "unable to read " + files[i];
+      return;
+    }
+    for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+      frequencies[symbol] += counts[symbol];
+    }
+  });
+
+  std::vector<int> codeLengths;
+  std::shared_ptr<const CachedTable> table;
+  if (error.empty() && !trainTableLengths(frequencies, codeLengths)) {
+    error = "the files hold no bytes to make a table from";
+  }
+  if (error.empty()) {
+    table = cache.add(options.tableName, codeLengths, error);
+  }
+  if (table == nullptr || !cache.save(options.tableCache, error)) {
+    std::cerr << "Error: " << error << std::endl;
+    return 1;
+  }
+  CodecStats stats;
+  stats.addEntropy(frequencies);
+  stats.addCodeLengths(codeLengths);
+  uint64_t bits = 0;
+  for (int symbol = 0; symbol < ALPHABET_SIZE; symbol++) {
+    bits += frequencies[symbol] * codeLengths[symbol];
+  }
+  std::cout << "table\tid\tfiles\tbytes\taverage_code_length\tentropy\n"
+            << table->name << '\t' << tableIdString(table->id) << '\t'
+            << files.size() << '\t' << stats.countedSymbols << '\t'
+            << std::fixed << std::setprecision(5)
+            << (double)bits / stats.countedSymbols << '\t' << stats.entropy()
+            << std::endl;
+  return 0;
+}
+
+//
+// runBatch
+//
+// Function handles every file of a batch, options.threads files at a time,
+// and prints a line of statistics per file as it finishes. Returns the exit
+// status of the program, 1 if any file failed.
+int runBatch(const BatchOptions &options) {
+  std::vector<std::string> files;
+  std::string error;
+  BatchTables loaded;
+  bool ok = collectBatchFiles(options, files, error);
+  if (ok && !options.sharedTable.empty()) {
+    ok = parseHuffmanInfoFile(options.sharedTable, loaded.sharedCodes, error);
+  }
+  // a cache is made by the first -a that adds a table to it
+  std::error_code status;
+  if (ok && !options.tableCache.empty() &&
+      (options.mode != 'a' ||
+       std::filesystem::exists(options.tableCache, status))) {
+    ok = loaded.cache.load(options.tableCache, error);
+  }
+  if (ok && options.mode == 'c' && !options.tableCache.empty()) {
+    loaded.table = loaded.cache.findName(options.tableName);
+    if (loaded.table == nullptr) {
+      error = "no table " + options.tableName + " in " + options.tableCache;
+      ok = false;
+    }
+  }
+  if (!ok) {
+    std::cerr << "Error: " << error << std::endl;
+    return 1;
+  }
+  if (options.mode == 'a') {
+    return addBatchTable(options, files, loaded.cache);
+  }
+
+  std::mutex outputMutex;
+  int failed = 0;
+  uint64_t totalIn = 0;
+  uint64_t totalOut = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::cout << "status\tbytes_in\tbytes_out\tratio\tseconds\tinput\toutput\t"
+               "error\n";
+  std::string operation = options.mode == 'c'   ? "compress"
+                          : options.mode == 'd' ? "decompress"
+                                                : "test";
+  // a single file gets the threads to itself, for the blocks of blocked files
+  int fileThreads = files.size() == 1 ? options.threads : 1;
+  ThreadPool pool(files.size() == 1 ? 1 : options.threads);
+  pool.parallelFor(files.size(), [&](size_t i) {
+    std::string output;
+    auto fileStart = std::chrono::steady_clock::now();
+    CodecResult result =
+        processBatchFile(files[i], options, loaded, fileThreads, output);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - fileStart;
+    bool compress = options.mode == 'c';
+    uint64_t original = compress ? result.bytesIn : result.bytesOut;
+    uint64_t compressed = compress ? result.bytesOut : result.bytesIn;
+    double ratio = compressed > 0 ? (double)original / compressed : 0;
+
+    std::lock_guard<std::mutex> lock(outputMutex);
+    std::cout << (result.ok ? "ok" : "error") << '\t' << result.bytesIn << '\t'
+              << result.bytesOut << '\t' << std::fixed << std::setprecision(5)
+              << ratio << '\t' << elapsed.count() << '\t' << files[i] << '\t'
+              << (result.ok ? output : "") << '\t' << result.error << '\n';
+    printStatsJson(operation, files[i], result.ok ? output : "", result);
+    failed += !result.ok;
+    totalIn += result.bytesIn;
+    totalOut += result.bytesOut;
+  });
+  std::cout.flush();
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cerr << files.size() << " files, " << failed << " failed, " << totalIn
+            << " bytes in, " << totalOut << " bytes out in " << std::fixed
+            << std::setprecision(3) << elapsed.count() << " s" << std::endl;
+  return failed > 0 ? 1 : 0;
+}
+
+//
+// readRangeMain
+//
+// Function writes the range of the original data given with -r to standard
+// output, returns the exit status of the program
+int readRangeMain(const BatchOptions &options) {
+  TableCache cache;
+  std::string error;
+  if (!options.tableCache.empty() && !cache.load(options.tableCache, error)) {
+    std::cerr << "Error: " << error << std::endl;
+    return 1;
+  }
+  std::vector<unsigned char> output;
+  const std::string &input = options.paths[0];
+  CodecResult result = readRange(input, options.rangeOffset,
+                                 options.rangeLength, output, cache.lookup());
+  printStatsJson("read", input, "-", result);
+  if (!result.ok) {
+    std::cerr << "Error: " << result.error << std::endl;
+    return 1;
+  }
+  std::cout.write((const char *)output.data(), output.size());
+  std::cout.flush();
+  return std::cout ? 0 : 1;
+}
+
+//
+// fixedTableMain
+//
+// Function writes the header of the fixed table given with -g to standard
+// output, returns the exit status of the program
+int fixedTableMain(const BatchOptions &options) {
+  std::vector<std::string> huffmanCodes;
+  std::string error;
+  const std::string &input = options.paths[0];
+  if (!parseHuffmanInfoFile(input, huffmanCodes, error) ||
+      !writeFixedTable(options.fixedName, huffmanCodes, input, std::cout,
+                       error)) {
+    std::cerr << "Error: " << error << std::endl;
+    return 1;
+  }
+  std::cout.flush();
+  return std::cout ? 0 : 1;
+}
+
+//
+// batchMain
+//
+// Function runs the program without the command loop, returns its exit
+// status
+int batchMain(int argc, char **argv) {
+  BatchOptions options;
+  std::string error;
+  if (!parseBatchOptions(argc, argv, options, error)) {
+    std::cerr << "Error: " << error << std::endl;
+    printBatchUsage();
+    return 2;
+  }
+  if (options.mode == 'r') {
+    return readRangeMain(options);
+  }
+  if (options.mode == 'g') {
+    return fixedTableMain(options);
+  }
+  if (options.paths.empty()) {
+    // without files -c and -d work as a filter in a pipeline
+    if (options.mode == 't') {
+      DiscardBuffer discard;
+      std::ostream nowhere(&discard);
+      std::ios::sync_with_stdio(false);
+      CodecResult result = decompressStream(std::cin, nowhere);
+      printStatsJson("test", "-", "", result);
+      if (!result.ok) {
+        std::cerr << "Error: " << result.error << std::endl;
+        return 1;
+      }
+      return 0;
+    }
+    return streamStandardIO(options.mode == 'c');
+  }
+  std::ios::sync_with_stdio(false);
+  return runBatch(options);
+}
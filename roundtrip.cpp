@@ -0,0 +1,243 @@
+// Adam Shaar
+// ashaar2
+//
+// roundtrip.cpp
+//
+// round-trip checks of the file formats, compressing data in a scratch
+// directory and checking it decompresses to exactly the same bytes
+// g++ -O2 roundtrip.cpp roundtripbuffer.cpp -pthread -o roundtrip +
+// ./roundtrip to run
+// prints one line per check and exits with 1 if any of them failed
+
+#include "filecompress.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// function declarations
+bool writeBytes(const string &filename, const string &data);
+string readBytes(const string &filename);
+vector<string> checkCodes();
+bool writeCodes(const string &filename, const vector<string> &codes);
+bool checkMenuRoundTrip(const string &directory);
+bool checkMenuUncodedByte(const string &directory);
+bool checkDamagedFooter(const string &directory);
+bool checkBatchRoundTrip(const string &directory);
+bool report(const string &name, bool ok);
+// in roundtripbuffer.cpp
+bool checkBufferRoundTrip();
+bool checkBufferDamage();
+
+// Returns true after writing data to the file.
+bool writeBytes(const string &filename, const string &data) {
+  ofstream file(filename, ios::binary);
+  file << data;
+  return (bool)file;
+}
+
+// Returns the contents of the file, empty if it cannot be read.
+string readBytes(const string &filename) {
+  ifstream file(filename, ios::binary);
+  stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+//
+// checkCodes
+//
+// Function returns a complete prefix code of every length from 1 to 9 bits
+// for the letters a to j. The all-zero code of j is longer than the padding
+// of any byte, so the zeros after the last code are never a whole code.
+vector<string> checkCodes() {
+  vector<string> codes(ALPHABET_SIZE, "");
+  codes['a'] = "1";
+  codes['b'] = "01";
+  for (int i = 0; i < 7; i++) {
+    codes['c' + i] = string(i + 2, '0') + "1";
+  }
+  codes['j'] = string(9, '0');
+  return codes;
+}
+
+// Returns true after writing the codes as a .hi file of operation 2.
+bool writeCodes(const string &filename, const vector<string> &codes) {
+  ofstream file(filename);
+  file << endl;
+  for (size_t i = 0; i < codes.size(); i++) {
+    if (!codes[i].empty()) {
+      file << i << "    " << codes[i] << endl;
+    }
+  }
+  return (bool)file;
+}
+
+//
+// checkMenuRoundTrip
+//
+// Function runs the interactive operations 2, 3 and 4 (load a .hi file,
+// compress, decompress) on files whose codes end in the middle of a byte,
+// which must come back without the padding bits, and on one that ends in
+// the middle of the longest code
+bool checkMenuRoundTrip(const string &directory) {
+  string table = directory + "/codes.hi";
+  if (!writeCodes(table, checkCodes())) {
+    return false;
+  }
+  vector<string> originals = {string(35, 'a') + "b", "abcdefghij", "jj",
+                              "jihgfedcbaaaaaaa"};
+  // the operations print their progress, which is not needed here
+  stringstream progress;
+  streambuf *console = cout.rdbuf(progress.rdbuf());
+  bool ok = true;
+  for (size_t i = 0; ok && i < originals.size(); i++) {
+    string input = directory + "/menu" + to_string(i);
+    vector<string> loaded;
+    FlatHuffmanTree tree;
+    ok = writeBytes(input, originals[i]) &&
+         loadHuffmanInfoFile(table, loaded, tree);
+    if (ok) {
+      compressFile(input, loaded);
+      filesystem::remove(input);
+      decompressFile(input + ".hc", tree);
+      ok = readBytes(input) == originals[i];
+    }
+  }
+  cout.rdbuf(console);
+  return ok;
+}
+
+//
+// checkMenuUncodedByte
+//
+// Function compresses a file holding a byte that the loaded .hi file has no
+// code for, which must be refused instead of leaving the byte out
+bool checkMenuUncodedByte(const string &directory) {
+  string table = directory + "/codes.hi";
+  string input = directory + "/uncoded";
+  if (!writeCodes(table, checkCodes()) || !writeBytes(input, "abz")) {
+    return false;
+  }
+  stringstream progress;
+  streambuf *console = cout.rdbuf(progress.rdbuf());
+  vector<string> loaded;
+  FlatHuffmanTree tree;
+  bool ok = loadHuffmanInfoFile(table, loaded, tree);
+  if (ok) {
+    compressFile(input, loaded);
+  }
+  cout.rdbuf(console);
+  return ok && !filesystem::exists(input + ".hc") &&
+         progress.str().find("byte value 122 has no code") != string::npos;
+}
+
+//
+// checkDamagedFooter
+//
+// Function rewrites the footer of a blocked .hz file with block counts too
+// large for the file, and an index offset that only adds up to the file
+// size once the sum wraps around, which decompressing must refuse before it
+// allocates anything for the index
+bool checkDamagedFooter(const string &directory) {
+  string input = directory + "/footer";
+  string output = input + ".hz";
+  vector<int> codeLengths(ALPHABET_SIZE, 0);
+  codeLengths['a'] = codeLengths['b'] = 1;
+  if (!writeBytes(input, "abba") ||
+      !compressToBlockedContainer(input, output, codeLengths, 1, 1).ok) {
+    return false;
+  }
+  string file = readBytes(output);
+  uint64_t fileSize = file.size();
+  for (uint64_t blockCount : {fileSize / 8 + 1, (uint64_t)1 << 30}) {
+    string damaged = file;
+    unsigned char *bytes = (unsigned char *)&damaged[0];
+    unsigned char *footer = bytes + fileSize - CONTAINER_FOOTER_SIZE;
+    // the blocks hold one byte, so the original size gives the same count
+    putLittleEndian(bytes + 8, blockCount, 8);
+    putLittleEndian(footer, blockCount, 4);
+    putLittleEndian(footer + 4,
+                    fileSize - CONTAINER_FOOTER_SIZE - blockCount * 8, 8);
+    if (!writeBytes(output, damaged)) {
+      return false;
+    }
+    CodecResult result = decompressContainer(output, input + ".out", 1);
+    if (result.ok || result.error != "block index is missing or damaged") {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// checkBatchRoundTrip
+//
+// Function compresses files with the codes of the batch -h mode and
+// decompresses them again: an empty file, files whose codes end in the
+// middle of a byte and one of the all-zero code, which looks just like the
+// padding after it. A file whose padding is longer than every code has to
+// be refused.
+bool checkBatchRoundTrip(const string &directory) {
+  vector<string> originals = {"", string(35, 'a') + "b", "abcdefghij", "jj"};
+  for (size_t i = 0; i < originals.size(); i++) {
+    string input = directory + "/batch" + to_string(i);
+    if (!writeBytes(input, originals[i]) ||
+        !compressWithCodes(input, input + ".hc", checkCodes()).ok ||
+        !decompressWithCodes(input + ".hc", input + ".out", checkCodes()).ok ||
+        readBytes(input + ".out") != originals[i]) {
+      return false;
+    }
+  }
+  vector<string> codes(ALPHABET_SIZE, "");
+  codes['a'] = "1";
+  codes['b'] = "0";
+  string input = directory + "/batch" + to_string(originals.size());
+  return writeBytes(input, originals[1]) &&
+         !compressWithCodes(input, input + ".hc", codes).ok;
+}
+
+// Prints the outcome of a check and returns it.
+bool report(const string &name, bool ok) {
+  cout << (ok ? "ok      " : "FAILED  ") << name << endl;
+  return ok;
+}
+
+int main() {
+  filesystem::path directory =
+      filesystem::temp_directory_path() /
+      ("roundtrip-" + to_string(chrono::steady_clock::now()
+                                    .time_since_epoch()
+                                    .count()));
+  if (!filesystem::create_directory(directory)) {
+    cerr << "Error: unable to create " << directory << endl;
+    return 1;
+  }
+  bool ok = true;
+  ok = report("menu .hc, codes ending inside a byte",
+              checkMenuRoundTrip(directory.string())) &&
+       ok;
+  ok = report("menu .hc, byte without a code",
+              checkMenuUncodedByte(directory.string())) &&
+       ok;
+  ok = report(".hz, block index past the end of the file",
+              checkDamagedFooter(directory.string())) &&
+       ok;
+  ok = report("batch .hc, padding taken from the longest code",
+              checkBatchRoundTrip(directory.string())) &&
+       ok;
+  ok = report("buffers, raw, own table and shared table blocks",
+              checkBufferRoundTrip()) &&
+       ok;
+  ok = report("buffers, damaged and truncated ones rejected",
+              checkBufferDamage()) &&
+       ok;
+  filesystem::remove_all(directory);
+  return ok ? 0 : 1;
+}
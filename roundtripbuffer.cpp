@@ -0,0 +1,172 @@
+// Adam Shaar
+// ashaar2
+//
+// roundtripbuffer.cpp
+//
+// round-trip checks of the buffer API of HuffmanBuffer.h, linked into
+// roundtrip with roundtrip.cpp. It is a source file of its own so that the
+// checks also build the header into a second translation unit, as the
+// programs that embed it do.
+
+#include "HuffmanBuffer.h"
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// function declarations
+bool checkBufferRoundTrip();
+bool checkBufferDamage();
+bool bufferRoundTrip(const vector<unsigned char> &original,
+                     huffman::BufferContext &compressContext,
+                     huffman::BufferContext &decompressContext);
+vector<unsigned char> bufferPayload(size_t size, int alphabet, uint32_t seed);
+
+//
+// bufferPayload
+//
+// Function returns `size` random bytes with values below alphabet, skewed
+// towards the small values so that they compress
+vector<unsigned char> bufferPayload(size_t size, int alphabet, uint32_t seed) {
+  mt19937 random(seed);
+  geometric_distribution<int> value(0.2);
+  vector<unsigned char> data(size);
+  for (unsigned char &byte : data) {
+    byte = value(random) % alphabet;
+  }
+  return data;
+}
+
+//
+// bufferRoundTrip
+//
+// Function compresses the original data with one context and decompresses it
+// with the other, returns true if exactly the original data comes back
+bool bufferRoundTrip(const vector<unsigned char> &original,
+                     huffman::BufferContext &compressContext,
+                     huffman::BufferContext &decompressContext) {
+  vector<unsigned char> packed(huffman::compressBound(original.size()));
+  size_t packedSize =
+      huffman::compress(original.data(), original.size(), packed.data(),
+                        packed.size(), compressContext);
+  if (packedSize == huffman::BUFFER_ERROR ||
+      huffman::decompressedSize(packed.data(), packedSize) !=
+          original.size()) {
+    return false;
+  }
+  // one byte more than needed, which must stay untouched
+  vector<unsigned char> unpacked(original.size() + 1, 0xA5);
+  size_t unpackedSize =
+      huffman::decompress(packed.data(), packedSize, unpacked.data(),
+                          original.size(), decompressContext);
+  return unpackedSize == original.size() && unpacked.back() == 0xA5 &&
+         equal(original.begin(), original.end(), unpacked.begin());
+}
+
+//
+// checkBufferRoundTrip
+//
+// Function round-trips payloads of every block mode through reused contexts:
+// an empty one and single bytes, stored raw, skewed ones of many sizes coded
+// with their own table, and the same again with a shared table on both sides
+bool checkBufferRoundTrip() {
+  huffman::BufferContext compressContext;
+  huffman::BufferContext decompressContext;
+  vector<size_t> sizes = {0, 1, 2, 31, 32, 33, 100, 4096, 65537};
+  for (size_t size : sizes) {
+    if (!bufferRoundTrip(bufferPayload(size, 256, size), compressContext,
+                         decompressContext) ||
+        !bufferRoundTrip(bufferPayload(size, 3, size), compressContext,
+                         decompressContext)) {
+      return false;
+    }
+  }
+  // uniformly random bytes do not shrink and are stored as they are
+  vector<unsigned char> noise(1000);
+  mt19937 random(1);
+  for (unsigned char &byte : noise) {
+    byte = random();
+  }
+  if (!bufferRoundTrip(noise, compressContext, decompressContext)) {
+    return false;
+  }
+
+  // a shared table trained on a sample of the payloads
+  vector<unsigned char> sample = bufferPayload(1 << 16, 64, 7);
+  vector<uint64_t> counts(ALPHABET_SIZE, 0);
+  histogram(sample.data(), sample.size(), counts.data());
+  // every byte value gets a code, payloads may hold bytes the sample missed
+  for (uint64_t &count : counts) {
+    count++;
+  }
+  vector<int> codeLengths;
+  if (!optimalCodeLengths(counts, DEFAULT_MAX_CODE_LENGTH, codeLengths) ||
+      !compressContext.setSharedTable(codeLengths) ||
+      !decompressContext.setSharedTable(codeLengths)) {
+    return false;
+  }
+  for (size_t size : sizes) {
+    if (!bufferRoundTrip(bufferPayload(size, 64, size + 1), compressContext,
+                         decompressContext)) {
+      return false;
+    }
+  }
+  // a context without the shared table cannot decompress what it coded
+  vector<unsigned char> payload = bufferPayload(100, 64, 3);
+  vector<unsigned char> packed(huffman::compressBound(payload.size()));
+  size_t packedSize =
+      huffman::compress(payload.data(), payload.size(), packed.data(),
+                        packed.size(), compressContext);
+  huffman::BufferContext plainContext;
+  vector<unsigned char> unpacked(payload.size());
+  return packedSize < payload.size() &&
+         huffman::decompress(packed.data(), packedSize, unpacked.data(),
+                             unpacked.size(),
+                             plainContext) == huffman::BUFFER_ERROR;
+}
+
+//
+// checkBufferDamage
+//
+// Function checks that compress refuses an output buffer that is too small
+// and decompress refuses buffers that are truncated, have a damaged byte
+// or do not fit the output, instead of returning wrong data
+bool checkBufferDamage() {
+  huffman::BufferContext context;
+  vector<unsigned char> payload = bufferPayload(2000, 16, 5);
+  vector<unsigned char> packed(huffman::compressBound(payload.size()));
+  size_t packedSize = huffman::compress(payload.data(), payload.size(),
+                                        packed.data(), packed.size(), context);
+  vector<unsigned char> unpacked(payload.size());
+  if (packedSize == huffman::BUFFER_ERROR ||
+      huffman::compress(payload.data(), payload.size(), packed.data(),
+                        packedSize - 1, context) != huffman::BUFFER_ERROR ||
+      huffman::decompress(packed.data(), packedSize - 1, unpacked.data(),
+                          unpacked.size(), context) != huffman::BUFFER_ERROR ||
+      huffman::decompress(packed.data(), packedSize, unpacked.data(),
+                          unpacked.size() - 1,
+                          context) != huffman::BUFFER_ERROR) {
+    return false;
+  }
+  // compress above failed, so the buffer is written again. Bytes 1 to 3
+  // hold the table distance of the block header, which buffers do not use,
+  // and the last byte may end in padding bits, which carry nothing either.
+  packedSize = huffman::compress(payload.data(), payload.size(), packed.data(),
+                                 packed.size(), context);
+  for (size_t i = 0; i + 1 < packedSize; i++) {
+    if (i >= 1 && i <= 3) {
+      continue;
+    }
+    vector<unsigned char> damaged(packed.begin(), packed.begin() + packedSize);
+    damaged[i] ^= 0x10;
+    if (huffman::decompress(damaged.data(), damaged.size(), unpacked.data(),
+                            unpacked.size(),
+                            context) != huffman::BUFFER_ERROR) {
+      return false;
+    }
+  }
+  return true;
+}